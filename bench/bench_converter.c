@@ -0,0 +1,591 @@
+/*
+ * Throughput benchmark for the converter library.
+ *
+ * A corpus is generated from one WSQ sample: the image is decoded, rescaled
+ * and re-encoded with every supported codec. Each image is then converted
+ * to a minutiae record, and each record type is converted to every other,
+ * for a number of rounds. Results go to stdout as JSON so that runs can be
+ * diffed between releases; progress goes to stderr. Stage timings come
+ * from the library's own measurements (BC_OPT_STATS).
+ *
+ * usage: bench_converter [-s <sample.wsq>] [-n <rounds>] [-t <template rounds>]
+ */
+#include <sys/queue.h>
+#include <sys/resource.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <biomdi.h>
+#include <fmr.h>
+#include <imgdecod.h>
+#include <imgtype.h>
+#include <wsq.h>
+#include <jpegb.h>
+#include <ihead.h>
+#include <png.h>
+#include <png_dec.h>
+#include <jpeg2k.h>
+#include <openjpeg.h>
+#include <converter.h>
+
+#define NUM_SCALES 3
+static const double scales[NUM_SCALES] = {1.0, 0.8, 1.25};
+
+#define NUM_RECORD_TYPES 4
+static char *record_types[NUM_RECORD_TYPES] = {"ANSI", "ISO", "ISONC", "ISOCC"};
+
+// record_types before this index are ANSI and ISO records, the rest card
+// formats, which bc_fmr_transcode() hands to biomdi.
+#define FIRST_CARD_TYPE 2
+
+// Status of a pair a conversion path has no conversion for.
+#define UNSUPPORTED_PAIR BC_ERR_FORMAT
+
+// Resolution in pixels per cm passed for card inputs, matching 500 ppi.
+#define CARD_RES 197
+
+typedef struct {
+    const char *codec;
+    unsigned char *data[NUM_SCALES];
+    int len[NUM_SCALES];
+} codec_corpus;
+
+typedef struct {
+    unsigned char *data;
+    size_t len, cap, pos;
+} membuf;
+
+static double
+now_ms(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static void
+die(const char *what) {
+    fprintf(stderr, "bench_converter: %s\n", what);
+    exit(EXIT_FAILURE);
+}
+
+static int
+membuf_reserve(membuf *mb, size_t size) {
+    unsigned char *data;
+    size_t cap;
+
+    if (size <= mb->cap)
+        return 0;
+    for (cap = mb->cap ? mb->cap : 65536; cap < size; cap *= 2);
+    if ((data = (unsigned char *) realloc(mb->data, cap)) == NULL)
+        return -1;
+    memset(data + mb->cap, 0, cap - mb->cap);
+    mb->data = data;
+    mb->cap = cap;
+    return 0;
+}
+
+static int
+cmp_double(const void *a, const void *b) {
+    double x = *(const double *) a, y = *(const double *) b;
+
+    return x < y ? -1 : x > y;
+}
+
+static double
+percentile(const double *sorted, int n, double p) {
+    int i = (int) (p * n + 0.999999) - 1;
+
+    return sorted[i < 0 ? 0 : (i >= n ? n - 1 : i)];
+}
+
+static void
+print_latency(double *lat, int n) {
+    qsort(lat, n, sizeof(double), cmp_double);
+    printf("\"latency_ms\": {\"p50\": %.4f, \"p90\": %.4f, \"p99\": %.4f, \"max\": %.4f}",
+           percentile(lat, n, 0.50), percentile(lat, n, 0.90), percentile(lat, n, 0.99), lat[n - 1]);
+}
+
+static unsigned char *
+read_file(const char *path, int *len) {
+    unsigned char *data;
+    FILE *fp;
+    long n;
+
+    if ((fp = fopen(path, "rb")) == NULL)
+        return NULL;
+    fseek(fp, 0, SEEK_END);
+    n = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    if (n <= 0 || (data = (unsigned char *) malloc(n)) == NULL ||
+        fread(data, 1, n, fp) != (size_t) n) {
+        fclose(fp);
+        return NULL;
+    }
+    fclose(fp);
+    *len = (int) n;
+    return data;
+}
+
+// Decode any supported image to 8-bit grayscale, as the library does.
+static int
+decode(unsigned char *idata, int ilen, unsigned char **odata, int *w, int *h, int *d, int *ppi) {
+    IMG_DAT *img_dat;
+    int img_type, lossy, len, ret;
+
+    if (image_type(&img_type, idata, ilen) != 0)
+        return -1;
+    switch (img_type) {
+        case WSQ_IMG:
+            return wsq_decode_mem(odata, w, h, d, ppi, &lossy, idata, ilen);
+        case JPEGB_IMG:
+            return jpegb_decode_mem(odata, w, h, d, ppi, &lossy, idata, ilen);
+        case IHEAD_IMG:
+            return ihead_decode_mem(odata, w, h, d, ppi, &lossy, idata, ilen);
+        case JP2_IMG:
+            ret = openjpeg2k_decode_mem(&img_dat, &lossy, idata, ilen);
+            break;
+        case PNG_IMG:
+            ret = png_decode_mem(&img_dat, &lossy, idata, ilen);
+            break;
+        default:
+            return -1;
+    }
+    if (ret != 0)
+        return ret;
+    ret = get_IMG_DAT_image(odata, &len, w, h, d, ppi, img_dat);
+    free_IMG_DAT(img_dat, FREE_IMAGE);
+    return ret;
+}
+
+// Bilinear rescale of an 8-bit grayscale image.
+static unsigned char *
+rescale(const unsigned char *src, int sw, int sh, double scale, int *dw, int *dh) {
+    unsigned char *dst;
+    int x, y, x0, y0, x1, y1;
+    double fx, fy, ax, ay;
+
+    *dw = (int) (sw * scale + 0.5);
+    *dh = (int) (sh * scale + 0.5);
+    if ((dst = (unsigned char *) malloc((size_t) *dw * *dh)) == NULL)
+        return NULL;
+    for (y = 0; y < *dh; y++) {
+        fy = (y + 0.5) / scale - 0.5;
+        y0 = fy < 0 ? 0 : (int) fy;
+        y1 = y0 + 1 < sh ? y0 + 1 : sh - 1;
+        ay = fy - y0 < 0 ? 0 : fy - y0;
+        for (x = 0; x < *dw; x++) {
+            fx = (x + 0.5) / scale - 0.5;
+            x0 = fx < 0 ? 0 : (int) fx;
+            x1 = x0 + 1 < sw ? x0 + 1 : sw - 1;
+            ax = fx - x0 < 0 ? 0 : fx - x0;
+            dst[(size_t) y * *dw + x] = (unsigned char) (
+                    (1 - ay) * ((1 - ax) * src[(size_t) y0 * sw + x0] + ax * src[(size_t) y0 * sw + x1]) +
+                    ay * ((1 - ax) * src[(size_t) y1 * sw + x0] + ax * src[(size_t) y1 * sw + x1]) + 0.5);
+        }
+    }
+    return dst;
+}
+
+static int
+encode_ihead(unsigned char **odata, int *olen, unsigned char *pix, int w, int h, int ppi) {
+    IHEAD ihead;
+    FILE *fp;
+    size_t size = sizeof(IHEAD) + SHORT_CHARS + (size_t) w * h;
+    unsigned char *data;
+
+    if ((data = (unsigned char *) malloc(size)) == NULL)
+        return -1;
+    if ((fp = fmemopen(data, size, "wb")) == NULL) {
+        free(data);
+        return -1;
+    }
+    nullihdr(&ihead);
+    strcpy(ihead.id, "bench_converter");
+    sprintf(ihead.width, "%d", w);
+    sprintf(ihead.height, "%d", h);
+    sprintf(ihead.depth, "%d", 8);
+    sprintf(ihead.density, "%d", ppi);
+    sprintf(ihead.compress, "%d", UNCOMP);
+    sprintf(ihead.complen, "%d", 0);
+    sprintf(ihead.align, "%d", 8);
+    sprintf(ihead.unitsize, "%d", 8);
+    ihead.sigbit = MSBF;
+    ihead.byte_order = HILOW;
+    sprintf(ihead.pix_offset, "%d", 0);
+    sprintf(ihead.whitepix, "%d", 255);
+    ihead.issigned = UNSIGNED;
+    ihead.rm_cm = ROW_MAJ;
+    ihead.tb_bt = TOP2BOT;
+    ihead.lr_rl = LEFT2RIGHT;
+    writeihdr(fp, &ihead);
+    fwrite(pix, 1, (size_t) w * h, fp);
+    *olen = (int) ftell(fp);
+    fclose(fp);
+    *odata = data;
+    return 0;
+}
+
+static void
+png_write_mem(png_structp png, png_bytep data, png_size_t n) {
+    membuf *mb = (membuf *) png_get_io_ptr(png);
+
+    if (membuf_reserve(mb, mb->len + n) != 0)
+        png_error(png, "out of memory");
+    memcpy(mb->data + mb->len, data, n);
+    mb->len += n;
+}
+
+static void
+png_flush_mem(png_structp png) {
+    (void) png;
+}
+
+static int
+encode_png(unsigned char **odata, int *olen, unsigned char *pix, int w, int h, int ppi) {
+    membuf mb = {NULL, 0, 0, 0};
+    png_structp png;
+    png_infop info;
+    int y;
+
+    if ((png = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL)) == NULL)
+        return -1;
+    if ((info = png_create_info_struct(png)) == NULL || setjmp(png_jmpbuf(png))) {
+        png_destroy_write_struct(&png, &info);
+        free(mb.data);
+        return -1;
+    }
+    png_set_write_fn(png, &mb, png_write_mem, png_flush_mem);
+    png_set_IHDR(png, info, w, h, 8, PNG_COLOR_TYPE_GRAY, PNG_INTERLACE_NONE,
+                 PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+    png_set_pHYs(png, info, (png_uint_32) (ppi / 0.0254 + 0.5), (png_uint_32) (ppi / 0.0254 + 0.5),
+                 PNG_RESOLUTION_METER);
+    png_write_info(png, info);
+    for (y = 0; y < h; y++)
+        png_write_row(png, pix + (size_t) y * w);
+    png_write_end(png, info);
+    png_destroy_write_struct(&png, &info);
+    *odata = mb.data;
+    *olen = (int) mb.len;
+    return 0;
+}
+
+static OPJ_SIZE_T
+opj_write_mem(void *buf, OPJ_SIZE_T n, void *user) {
+    membuf *mb = (membuf *) user;
+
+    if (membuf_reserve(mb, mb->pos + n) != 0)
+        return (OPJ_SIZE_T) -1;
+    memcpy(mb->data + mb->pos, buf, n);
+    mb->pos += n;
+    if (mb->len < mb->pos)
+        mb->len = mb->pos;
+    return n;
+}
+
+static OPJ_OFF_T
+opj_skip_mem(OPJ_OFF_T n, void *user) {
+    membuf *mb = (membuf *) user;
+
+    if (membuf_reserve(mb, mb->pos + n) != 0)
+        return -1;
+    mb->pos += n;
+    if (mb->len < mb->pos)
+        mb->len = mb->pos;
+    return n;
+}
+
+static OPJ_BOOL
+opj_seek_mem(OPJ_OFF_T n, void *user) {
+    membuf *mb = (membuf *) user;
+
+    if (membuf_reserve(mb, n) != 0)
+        return OPJ_FALSE;
+    mb->pos = n;
+    return OPJ_TRUE;
+}
+
+// Lossless JPEG 2000 (JP2 container), as produced by most capture SDKs.
+static int
+encode_jp2(unsigned char **odata, int *olen, unsigned char *pix, int w, int h) {
+    membuf mb = {NULL, 0, 0, 0};
+    opj_cparameters_t params;
+    opj_image_cmptparm_t cmpt;
+    opj_image_t *image;
+    opj_codec_t *codec;
+    opj_stream_t *stream;
+    size_t i;
+    int ok;
+
+    opj_set_default_encoder_parameters(&params);
+    params.tcp_numlayers = 1;
+    params.tcp_rates[0] = 0;
+    params.cp_disto_alloc = 1;
+
+    memset(&cmpt, 0, sizeof(cmpt));
+    cmpt.dx = cmpt.dy = 1;
+    cmpt.w = w;
+    cmpt.h = h;
+    cmpt.prec = 8;
+    if ((image = opj_image_create(1, &cmpt, OPJ_CLRSPC_GRAY)) == NULL)
+        return -1;
+    image->x1 = w;
+    image->y1 = h;
+    for (i = 0; i < (size_t) w * h; i++)
+        image->comps[0].data[i] = pix[i];
+
+    codec = opj_create_compress(OPJ_CODEC_JP2);
+    stream = opj_stream_create(OPJ_J2K_STREAM_CHUNK_SIZE, OPJ_FALSE);
+    opj_stream_set_write_function(stream, opj_write_mem);
+    opj_stream_set_skip_function(stream, opj_skip_mem);
+    opj_stream_set_seek_function(stream, opj_seek_mem);
+    opj_stream_set_user_data(stream, &mb, NULL);
+    ok = opj_setup_encoder(codec, &params, image) &&
+         opj_start_compress(codec, image, stream) &&
+         opj_encode(codec, stream) &&
+         opj_end_compress(codec, stream);
+    opj_stream_destroy(stream);
+    opj_destroy_codec(codec);
+    opj_image_destroy(image);
+    if (!ok) {
+        free(mb.data);
+        return -1;
+    }
+    *odata = mb.data;
+    *olen = (int) mb.len;
+    return 0;
+}
+
+static void
+build_corpus(codec_corpus *corpus, int *ncodecs, unsigned char *sample, int sample_len) {
+    unsigned char *pix, *scaled, *data;
+    int w, h, d, ppi, sw, sh, sppi, len, s, c;
+
+    if (decode(sample, sample_len, &pix, &w, &h, &d, &ppi) != 0 || d != 8)
+        die("could not decode sample image");
+    if (ppi <= 0)
+        ppi = 500;
+
+    corpus[0].codec = "WSQ";
+    corpus[1].codec = "JPEG";
+    corpus[2].codec = "JPEG2000";
+    corpus[3].codec = "PNG";
+    corpus[4].codec = "IHEAD";
+    *ncodecs = 5;
+
+    for (s = 0; s < NUM_SCALES; s++) {
+        if ((scaled = rescale(pix, w, h, scales[s], &sw, &sh)) == NULL)
+            die("could not rescale sample image");
+        sppi = (int) (ppi * scales[s] + 0.5);
+        for (c = 0; c < *ncodecs; c++) {
+            switch (c) {
+                case 0:
+                    if (wsq_encode_mem(&data, &len, 0.75f, scaled, sw, sh, 8, sppi, NULL) != 0)
+                        die("could not encode WSQ");
+                    break;
+                case 1:
+                    if (jpegb_encode_mem(&data, &len, 90, scaled, sw, sh, 8, sppi, NULL) != 0)
+                        die("could not encode JPEG");
+                    break;
+                case 2:
+                    if (encode_jp2(&data, &len, scaled, sw, sh) != 0)
+                        die("could not encode JPEG2000");
+                    break;
+                case 3:
+                    if (encode_png(&data, &len, scaled, sw, sh, sppi) != 0)
+                        die("could not encode PNG");
+                    break;
+                default:
+                    if (encode_ihead(&data, &len, scaled, sw, sh, sppi) != 0)
+                        die("could not encode IHEAD");
+                    break;
+            }
+            corpus[c].data[s] = data;
+            corpus[c].len[s] = len;
+        }
+        free(scaled);
+    }
+    free(pix);
+}
+
+static void
+bench_images(bc_context *ctx, codec_corpus *corpus, int ncodecs, int rounds) {
+    unsigned char *odata;
+    double *lat, t0, t1, total;
+    bc_stats st;
+    bc_counters sum;
+    int olen, n, r, s, c;
+    long bytes;
+
+    if ((lat = (double *) malloc((size_t) rounds * NUM_SCALES * sizeof(double))) == NULL)
+        die("out of memory");
+
+    printf("  \"images\": [\n");
+    for (c = 0; c < ncodecs; c++) {
+        fprintf(stderr, "images: %s\n", corpus[c].codec);
+        memset(&sum, 0, sizeof(sum));
+        n = 0;
+        total = 0;
+        bytes = 0;
+        for (r = 0; r < rounds; r++) {
+            for (s = 0; s < NUM_SCALES; s++) {
+                t0 = now_ms();
+                if (bc_img2fmr(ctx, corpus[c].data[s], corpus[c].len[s], "ANSI", &odata, &olen) != BC_OK)
+                    die("image conversion failed");
+                t1 = now_ms();
+                bc_free(odata);
+                lat[n++] = t1 - t0;
+                total += t1 - t0;
+                bytes += corpus[c].len[s];
+
+                bc_context_get_stats(ctx, &st);
+                sum.decode_ns += st.decode_ns;
+                sum.extract_ns += st.extract_ns;
+                sum.build_ns += st.build_ns;
+                sum.serialize_ns += st.serialize_ns;
+                sum.minutiae += st.minutiae;
+                sum.bytes_allocated += st.bytes_allocated;
+            }
+        }
+        printf("    {\"codec\": \"%s\", \"conversions\": %d, \"input_bytes\": %ld, "
+               "\"images_per_s\": %.2f, ", corpus[c].codec, n, bytes, n / (total / 1e3));
+        print_latency(lat, n);
+        printf(", \"stages_ms\": {\"decode\": %.4f, \"extract\": %.4f, \"build\": %.4f, \"serialize\": %.4f}, "
+               "\"minutiae\": %.1f, \"bytes_allocated\": %.0f}%s\n",
+               sum.decode_ns / 1e6 / n, sum.extract_ns / 1e6 / n, sum.build_ns / 1e6 / n,
+               sum.serialize_ns / 1e6 / n, (double) sum.minutiae / n, (double) sum.bytes_allocated / n,
+               c + 1 < ncodecs ? "," : "");
+    }
+    printf("  ],\n");
+    free(lat);
+}
+
+static void
+bench_records(bc_context *ctx, unsigned char *sample, int sample_len, int rounds) {
+    unsigned char *ansi, *src[NUM_RECORD_TYPES], *odata, *obuf;
+    int ansi_len, src_len[NUM_RECORD_TYPES], olen, i, o, r, k;
+    double *lat, t0, t1, total;
+    const char *path;
+    int ret = BC_OK;
+
+    if (bc_img2fmr(ctx, sample, sample_len, "ANSI", &ansi, &ansi_len) != BC_OK)
+        die("could not build the source record");
+    for (i = 0; i < NUM_RECORD_TYPES; i++)
+        if (bc_fmr2fmr(ctx, ansi, ansi_len, &src[i], &src_len[i], "ANSI", record_types[i],
+                       CARD_RES, CARD_RES) != BC_OK)
+            die("could not build the source records");
+    if ((lat = (double *) malloc((size_t) rounds * sizeof(double))) == NULL ||
+        (obuf = (unsigned char *) malloc(65536)) == NULL)
+        die("out of memory");
+
+    // fmr2fmr covers the biomdi path, transcode the single-pass one; card
+    // pairs run through biomdi on both and are labelled transcode_fallback.
+    printf("  \"templates\": [\n");
+    for (k = 0; k < 2; k++) {
+        for (i = 0; i < NUM_RECORD_TYPES; i++) {
+            for (o = 0; o < NUM_RECORD_TYPES; o++) {
+                total = 0;
+                for (r = 0; r < rounds; r++) {
+                    t0 = now_ms();
+                    if (k == 0) {
+                        ret = bc_fmr2fmr(ctx, src[i], src_len[i], &odata, &olen, record_types[i],
+                                         record_types[o], CARD_RES, CARD_RES);
+                        if (ret == BC_OK)
+                            bc_free(odata);
+                    } else {
+                        ret = bc_fmr_transcode(ctx, src[i], src_len[i], record_types[i], record_types[o],
+                                               CARD_RES, CARD_RES, obuf, 65536, &olen);
+                    }
+                    t1 = now_ms();
+                    if (ret != BC_OK) {
+                        // Only a pair that never converts counts as unsupported.
+                        if (ret != UNSUPPORTED_PAIR || r > 0) {
+                            fprintf(stderr, "%s -> %s failed with %d\n", record_types[i], record_types[o], ret);
+                            die("template conversion failed");
+                        }
+                        break;
+                    }
+                    lat[r] = t1 - t0;
+                    total += t1 - t0;
+                }
+                if (k == 0)
+                    path = "fmr2fmr";
+                else if (i >= FIRST_CARD_TYPE || o >= FIRST_CARD_TYPE)
+                    path = "transcode_fallback";
+                else
+                    path = "transcode";
+                printf("    {\"path\": \"%s\", \"from\": \"%s\", \"to\": \"%s\", ",
+                       path, record_types[i], record_types[o]);
+                if (r < rounds) {
+                    // biomdi has no conversion for this pair.
+                    printf("\"supported\": false}");
+                } else {
+                    printf("\"supported\": true, \"templates_per_s\": %.2f, ", r / (total / 1e3));
+                    print_latency(lat, r);
+                    printf("}");
+                }
+                printf("%s\n", k == 1 && i == NUM_RECORD_TYPES - 1 && o == NUM_RECORD_TYPES - 1 ? "" : ",");
+            }
+        }
+    }
+    printf("  ],\n");
+
+    for (i = 0; i < NUM_RECORD_TYPES; i++)
+        bc_free(src[i]);
+    bc_free(ansi);
+    free(obuf);
+    free(lat);
+}
+
+int main(int argc, char *argv[]) {
+    codec_corpus corpus[5];
+    unsigned char *sample;
+    char *sample_path = "example/sample_image.wsq";
+    int sample_len, ncodecs, rounds = 10, template_rounds = 2000;
+    struct rusage usage;
+    bc_context *ctx;
+    int ch, c, s;
+
+    while ((ch = getopt(argc, argv, "s:n:t:")) != -1) {
+        switch (ch) {
+            case 's':
+                sample_path = optarg;
+                break;
+            case 'n':
+                rounds = atoi(optarg);
+                break;
+            case 't':
+                template_rounds = atoi(optarg);
+                break;
+            default:
+                fprintf(stderr, "usage: bench_converter [-s <sample.wsq>] [-n <rounds>] [-t <template rounds>]\n");
+                return EXIT_FAILURE;
+        }
+    }
+    if (rounds <= 0 || template_rounds <= 0)
+        die("rounds must be positive");
+    if ((sample = read_file(sample_path, &sample_len)) == NULL)
+        die("could not read sample image");
+    if ((ctx = bc_context_create()) == NULL)
+        die("could not create context");
+    bc_context_set_option(ctx, BC_OPT_STATS, 1);
+
+    build_corpus(corpus, &ncodecs, sample, sample_len);
+
+    printf("{\n  \"rounds\": %d,\n  \"template_rounds\": %d,\n  \"scales\": [%.2f, %.2f, %.2f],\n",
+           rounds, template_rounds, scales[0], scales[1], scales[2]);
+    bench_images(ctx, corpus, ncodecs, rounds);
+    bench_records(ctx, sample, sample_len, template_rounds);
+    getrusage(RUSAGE_SELF, &usage);
+    printf("  \"peak_rss_kb\": %ld\n}\n", usage.ru_maxrss);
+
+    for (c = 0; c < ncodecs; c++)
+        for (s = 0; s < NUM_SCALES; s++)
+            free(corpus[c].data[s]);
+    free(sample);
+    bc_context_destroy(ctx);
+    return EXIT_SUCCESS;
+}
@@ -14,21 +14,48 @@
 #include <sys/param.h>
 #include <converter.h>
 #include <img_io.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <ctype.h>
+#include <limits.h>
+#include <pthread.h>
+
+// Files converted per library batch; bounds the number of inputs mapped at once.
+#define BATCH_CHUNK 1024
+
+// Stream mode framing. All integers are big-endian.
+//   request:  u32 length of the rest, u32 id, char[8] input type, char[8]
+//             output type (NUL-padded), u16 ISO card x/y resolution, payload
+//   response: u32 length of the rest, u32 id, i32 status, payload
+#define FRAME_TYPE_LEN 8
+#define FRAME_REQUEST_HEADER (4 + 2 * FRAME_TYPE_LEN + 2 + 2)
+#define FRAME_RESPONSE_HEADER (4 + 4)
+#define FRAME_MAX_LENGTH (64 * 1024 * 1024)
 
 void
 usage() {
     printf(
             "usage:\n\tconvert -i <input file> -ti <input type> -o <output file> -to <output type> [-v] \n"
+            "\tconvert -d <input dir> -ti <input type> -o <output dir> -to <output type> [-j <threads>] \n"
+            "\tconvert -m <manifest file> [-j <threads>] \n"
+            "\tconvert -s [-j <threads>] \n"
             "\t\t -i:  Specifies the input file path \n"
             "\t\t -ti:  Specifies the type of the input file (image, 8bit depth only: WSQ, JPEG, IHEAD, JPEG2000, PNG or minutiae: ISO, ISOC, ISOCC, ANSI) \n"
             "\t\t -o:  Specifies the output file path\n"
             "\t\t -to:  Specifies the type of the output file (ISO, ISOC, ISOCC, ANSI)\n"
             "\t\t -v:  Validate output result [0 - validate, 1 - skip] (Optional, defaults to 0)\n"
+            "\t\t -d:  Converts every file in a directory; outputs keep the file name with the output type as extension\n"
+            "\t\t -m:  Converts the files listed in a manifest, one per line: <input path> <input type> <output path> <output type>\n"
+            "\t\t -s:  Serves length-prefixed conversion requests from stdin and writes responses to stdout until EOF\n"
+            "\t\t -j:  Number of worker threads for -d, -m and -s (Optional, defaults to one per CPU)\n"
     );
 }
 
 void
-get_options(int argc, char *argv[], char **in, char **itype, char **out, char **otype, int *validate) {
+get_options(int argc, char *argv[], char **in, char **itype, char **out, char **otype, int *validate,
+            char **dir, char **manifest, int *threads, int *stream) {
     char ch;
     char nch;
     *validate = 0;
@@ -36,8 +63,24 @@ get_options(int argc, char *argv[], char **in, char **itype, char **out, char **
     *out = "";
     *itype = "";
     *otype = "";
-    while ((ch = getopt(argc, argv, "i:o:t:v")) != -1) {
+    *dir = "";
+    *manifest = "";
+    *threads = 0;
+    *stream = 0;
+    while ((ch = getopt(argc, argv, "i:o:t:vd:m:j:s")) != -1) {
         switch (ch) {
+            case 's':
+                *stream = 1;
+                break;
+            case 'd':
+                *dir = optarg;
+                break;
+            case 'm':
+                *manifest = optarg;
+                break;
+            case 'j':
+                *threads = atoi(optarg);
+                break;
             case 'i':
                 *in = malloc(strlen(optarg) + 1);
                 strcpy(*in, optarg);
@@ -71,6 +114,10 @@ get_options(int argc, char *argv[], char **in, char **itype, char **out, char **
         }
     }
 
+    if (strlen(*manifest) > 0 || *stream)
+        return;
+    if (strlen(*dir) > 0)
+        *in = *dir;
     if (strlen(*in) == 0 || strlen(*out) == 0 || strlen(*itype) == 0 || strlen(*otype) == 0) {
         usage();
         goto err_out;
@@ -81,11 +128,449 @@ get_options(int argc, char *argv[], char **in, char **itype, char **out, char **
     exit(EXIT_FAILURE);
 }
 
+int
+is_record_type(const char *type) {
+    return strcmp(type, "ANSI") == 0
+           || strcmp(type, "ISO") == 0
+           || strcmp(type, "ISONC") == 0
+           || strcmp(type, "ISOC") == 0
+           || strcmp(type, "ISOCC") == 0;
+}
+
+// One file of a batch run.
+typedef struct {
+    char *in_path;
+    char *in_type;
+    char *out_path;
+    char *out_type;
+} job;
+
+typedef struct {
+    job *jobs;
+    int count;
+    int alloc;
+} job_list;
+
+void
+add_job(job_list *list, const char *in_path, const char *in_type, const char *out_path, const char *out_type) {
+    job *j;
+
+    if (list->count == list->alloc) {
+        list->alloc = list->alloc == 0 ? 256 : list->alloc * 2;
+        if ((list->jobs = (job *) realloc(list->jobs, list->alloc * sizeof(job))) == NULL)
+            ALLOC_ERR_EXIT("job list");
+    }
+    j = &list->jobs[list->count++];
+    if ((j->in_path = strdup(in_path)) == NULL || (j->in_type = strdup(in_type)) == NULL ||
+        (j->out_path = strdup(out_path)) == NULL || (j->out_type = strdup(out_type)) == NULL)
+        ALLOC_ERR_EXIT("job");
+}
+
+void
+read_manifest(const char *manifest, job_list *list) {
+    char line[4096], in_path[1024], in_type[16], out_path[1024], out_type[16];
+    FILE *fp;
+    int lineno = 0;
+
+    if ((fp = fopen(manifest, "r")) == NULL)
+        OPEN_ERR_EXIT(manifest);
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        lineno++;
+        if (line[strspn(line, " \t\r\n")] == '\0' || line[strspn(line, " \t")] == '#')
+            continue;
+        if (sscanf(line, "%1023s %15s %1023s %15s", in_path, in_type, out_path, out_type) != 4) {
+            fprintf(stderr, "%s:%d: expected <input path> <input type> <output path> <output type>\n",
+                    manifest, lineno);
+            exit(EXIT_FAILURE);
+        }
+        add_job(list, in_path, in_type, out_path, out_type);
+    }
+    fclose(fp);
+}
+
+void
+read_directory(const char *dir, const char *in_type, const char *out_dir, const char *out_type, job_list *list) {
+    char in_path[PATH_MAX], out_path[PATH_MAX], ext[16];
+    struct dirent *de;
+    struct stat st;
+    DIR *dp;
+    char *dot;
+    int i;
+
+    for (i = 0; out_type[i] != '\0' && i < (int) sizeof(ext) - 1; i++)
+        ext[i] = (char) tolower((unsigned char) out_type[i]);
+    ext[i] = '\0';
+
+    if ((dp = opendir(dir)) == NULL)
+        OPEN_ERR_EXIT(dir);
+    while ((de = readdir(dp)) != NULL) {
+        snprintf(in_path, sizeof(in_path), "%s/%s", dir, de->d_name);
+        if (stat(in_path, &st) != 0 || !S_ISREG(st.st_mode))
+            continue;
+        snprintf(out_path, sizeof(out_path), "%s/%s", out_dir, de->d_name);
+        if ((dot = strrchr(out_path + strlen(out_dir) + 1, '.')) != NULL)
+            *dot = '\0';
+        if (strlen(out_path) + strlen(ext) + 1 < sizeof(out_path)) {
+            strcat(out_path, ".");
+            strcat(out_path, ext);
+        }
+        add_job(list, in_path, in_type, out_path, out_type);
+    }
+    closedir(dp);
+}
+
+// Map a whole input file; the mapping is private, so the library may treat
+// it as an ordinary buffer.
+unsigned char *
+map_file(const char *path, int *len) {
+    struct stat st;
+    void *data;
+    int fd;
+
+    if ((fd = open(path, O_RDONLY)) < 0)
+        return NULL;
+    if (fstat(fd, &st) != 0 || st.st_size == 0 || st.st_size > 0x7FFFFFFF) {
+        close(fd);
+        return NULL;
+    }
+    data = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+        return NULL;
+    madvise(data, st.st_size, MADV_SEQUENTIAL);
+    *len = (int) st.st_size;
+    return (unsigned char *) data;
+}
+
+int
+write_file(const char *path, const unsigned char *data, int len) {
+    FILE *fp;
+    int ok;
+
+    if ((fp = fopen(path, "wb")) == NULL)
+        return -1;
+    ok = fwrite(data, 1, len, fp) == (size_t) len;
+    if (fclose(fp) != 0)
+        ok = 0;
+    return ok ? 0 : -1;
+}
+
+/*
+ * Run the jobs in chunks through the library batch calls, images and
+ * records separately, and print a summary. Returns the number of failures.
+ */
+int
+run_jobs(job_list *list, int threads) {
+    bc_context *ctx;
+    bc_batch_item *images, *records, *item;
+    job **image_jobs, **record_jobs;
+    struct timespec start, end;
+    long long bytes_in = 0, bytes_out = 0;
+    int failed = 0, done = 0;
+    int first, n, nimages, nrecords, i, k;
+    double secs;
+
+    if ((ctx = bc_context_create()) == NULL)
+        ALLOC_ERR_EXIT("converter context");
+    if (threads > 0 && bc_context_set_option(ctx, BC_OPT_THREADS, threads) != BC_OK)
+        ERR_EXIT("Invalid thread count");
+
+    images = (bc_batch_item *) calloc(BATCH_CHUNK, sizeof(bc_batch_item));
+    records = (bc_batch_item *) calloc(BATCH_CHUNK, sizeof(bc_batch_item));
+    image_jobs = (job **) malloc(BATCH_CHUNK * sizeof(job *));
+    record_jobs = (job **) malloc(BATCH_CHUNK * sizeof(job *));
+    if (images == NULL || records == NULL || image_jobs == NULL || record_jobs == NULL)
+        ALLOC_ERR_EXIT("batch items");
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (first = 0; first < list->count; first += BATCH_CHUNK) {
+        n = MIN(BATCH_CHUNK, list->count - first);
+        nimages = nrecords = 0;
+        for (i = 0; i < n; i++) {
+            job *j = &list->jobs[first + i];
+            unsigned char *data;
+            int len;
+
+            if ((data = map_file(j->in_path, &len)) == NULL) {
+                fprintf(stderr, "%s: could not read input\n", j->in_path);
+                failed++;
+                continue;
+            }
+            bytes_in += len;
+            if (is_record_type(j->in_type)) {
+                item = &records[nrecords];
+                record_jobs[nrecords++] = j;
+            } else {
+                item = &images[nimages];
+                image_jobs[nimages++] = j;
+            }
+            memset(item, 0, sizeof(*item));
+            item->idata = data;
+            item->ilen = len;
+            item->in_type = j->in_type;
+            item->out_type = j->out_type;
+        }
+
+        if (nimages > 0 && bc_img2fmr_batch(ctx, images, nimages) < 0)
+            ERR_EXIT("Could not run image batch");
+        if (nrecords > 0 && bc_fmr2fmr_batch(ctx, records, nrecords) < 0)
+            ERR_EXIT("Could not run minutiae record batch");
+
+        for (k = 0; k < 2; k++) {
+            bc_batch_item *items = k == 0 ? images : records;
+            job **jobs = k == 0 ? image_jobs : record_jobs;
+            int count = k == 0 ? nimages : nrecords;
+
+            for (i = 0; i < count; i++) {
+                item = &items[i];
+                if (item->status != BC_OK) {
+                    fprintf(stderr, "%s: conversion failed (%d)\n", jobs[i]->in_path, item->status);
+                    failed++;
+                } else if (write_file(jobs[i]->out_path, item->odata, item->olen) != 0) {
+                    fprintf(stderr, "%s: could not write output\n", jobs[i]->out_path);
+                    failed++;
+                } else {
+                    bytes_out += item->olen;
+                    done++;
+                }
+                bc_free(item->odata);
+                munmap(item->idata, item->ilen);
+            }
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    if (secs <= 0)
+        secs = 1e-9;
+    printf("Converted %d of %d files, %d failed, in %.3f s: %.1f files/s, %.2f MB/s in, %.2f MB/s out\n",
+           done, list->count, failed, secs, done / secs, bytes_in / secs / 1e6, bytes_out / secs / 1e6);
+
+    free(images);
+    free(records);
+    free(image_jobs);
+    free(record_jobs);
+    bc_context_destroy(ctx);
+    return failed;
+}
+
+// A request read from stdin, waiting for or being handled by a worker.
+typedef struct frame {
+    unsigned int id;
+    char in_type[FRAME_TYPE_LEN + 1];
+    char out_type[FRAME_TYPE_LEN + 1];
+    int iso_c_xres;
+    int iso_c_yres;
+    unsigned char *payload;
+    int len;
+    struct frame *next;
+} frame;
+
+// Bounded queue between the stdin reader and the workers, so a fast writer
+// cannot make the process buffer its whole input.
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+    frame *head, *tail;
+    int count, capacity;
+    int closed;
+    pthread_mutex_t out_lock;
+} frame_queue;
+
+unsigned int
+get_u32(const unsigned char *p) {
+    return ((unsigned int) p[0] << 24) | ((unsigned int) p[1] << 16) | ((unsigned int) p[2] << 8) | p[3];
+}
+
+void
+put_u32(unsigned char *p, unsigned int v) {
+    p[0] = (unsigned char) (v >> 24);
+    p[1] = (unsigned char) (v >> 16);
+    p[2] = (unsigned char) (v >> 8);
+    p[3] = (unsigned char) v;
+}
+
+/*
+ * Read one request; returns 1 on success, 0 at a clean end of input and -1
+ * on a truncated frame or a bad length, after which the stream cannot be
+ * resynchronized.
+ */
+int
+read_frame(FILE *fp, frame **out) {
+    unsigned char hdr[4 + FRAME_REQUEST_HEADER];
+    unsigned int len;
+    frame *f;
+    size_t n;
+
+    if ((n = fread(hdr, 1, 4, fp)) == 0 && feof(fp))
+        return 0;
+    if (n != 4)
+        goto truncated;
+    len = get_u32(hdr);
+    if (len < FRAME_REQUEST_HEADER || len > FRAME_MAX_LENGTH) {
+        fprintf(stderr, "Invalid request frame length %u\n", len);
+        return -1;
+    }
+    if (fread(hdr + 4, 1, FRAME_REQUEST_HEADER, fp) != FRAME_REQUEST_HEADER)
+        goto truncated;
+
+    if ((f = (frame *) calloc(1, sizeof(frame))) == NULL)
+        ALLOC_ERR_EXIT("request frame");
+    f->id = get_u32(hdr + 4);
+    memcpy(f->in_type, hdr + 8, FRAME_TYPE_LEN);
+    memcpy(f->out_type, hdr + 8 + FRAME_TYPE_LEN, FRAME_TYPE_LEN);
+    f->iso_c_xres = (hdr[8 + 2 * FRAME_TYPE_LEN] << 8) | hdr[9 + 2 * FRAME_TYPE_LEN];
+    f->iso_c_yres = (hdr[10 + 2 * FRAME_TYPE_LEN] << 8) | hdr[11 + 2 * FRAME_TYPE_LEN];
+    f->len = (int) (len - FRAME_REQUEST_HEADER);
+    if ((f->payload = (unsigned char *) malloc(f->len > 0 ? f->len : 1)) == NULL)
+        ALLOC_ERR_EXIT("request payload");
+    if (fread(f->payload, 1, f->len, fp) != (size_t) f->len) {
+        free(f->payload);
+        free(f);
+        goto truncated;
+    }
+    *out = f;
+    return 1;
+
+    truncated:
+    fprintf(stderr, "Truncated request frame\n");
+    return -1;
+}
+
+void
+write_response(frame_queue *q, unsigned int id, int status, const unsigned char *data, int len) {
+    unsigned char hdr[4 + FRAME_RESPONSE_HEADER];
+
+    put_u32(hdr, FRAME_RESPONSE_HEADER + len);
+    put_u32(hdr + 4, id);
+    put_u32(hdr + 8, (unsigned int) status);
+    pthread_mutex_lock(&q->out_lock);
+    if (fwrite(hdr, 1, sizeof(hdr), stdout) != sizeof(hdr) ||
+        (len > 0 && fwrite(data, 1, len, stdout) != (size_t) len) ||
+        fflush(stdout) != 0)
+        ERR_EXIT("Could not write response frame");
+    pthread_mutex_unlock(&q->out_lock);
+}
+
+void *
+stream_worker(void *arg) {
+    frame_queue *q = (frame_queue *) arg;
+    bc_context *ctx;
+    unsigned char *odata;
+    int olen, status;
+    frame *f;
+
+    if ((ctx = bc_context_create()) == NULL)
+        ALLOC_ERR_EXIT("converter context");
+    for (;;) {
+        pthread_mutex_lock(&q->lock);
+        while (q->head == NULL && !q->closed)
+            pthread_cond_wait(&q->not_empty, &q->lock);
+        if ((f = q->head) == NULL) {
+            pthread_mutex_unlock(&q->lock);
+            break;
+        }
+        if ((q->head = f->next) == NULL)
+            q->tail = NULL;
+        q->count--;
+        pthread_cond_signal(&q->not_full);
+        pthread_mutex_unlock(&q->lock);
+
+        odata = NULL;
+        olen = 0;
+        if (is_record_type(f->in_type))
+            status = bc_fmr2fmr(ctx, f->payload, f->len, &odata, &olen, f->in_type, f->out_type,
+                                f->iso_c_xres, f->iso_c_yres);
+        else
+            status = bc_img2fmr(ctx, f->payload, f->len, f->out_type, &odata, &olen);
+        if (status != BC_OK)
+            olen = 0;
+        write_response(q, f->id, status, odata, olen);
+
+        bc_free(odata);
+        free(f->payload);
+        free(f);
+    }
+    bc_context_destroy(ctx);
+    return NULL;
+}
+
+/*
+ * Serve requests from stdin until EOF. Requests are converted concurrently,
+ * so responses come back in completion order, matched by request id. On a
+ * malformed frame reading stops, the requests already read are still
+ * answered, and -1 is returned.
+ */
+int
+run_stream(int threads) {
+    frame_queue q;
+    pthread_t *workers;
+    frame *f;
+    int i, ret;
+
+    if (threads <= 0)
+        threads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads <= 0)
+        threads = 1;
+
+    memset(&q, 0, sizeof(q));
+    pthread_mutex_init(&q.lock, NULL);
+    pthread_mutex_init(&q.out_lock, NULL);
+    pthread_cond_init(&q.not_empty, NULL);
+    pthread_cond_init(&q.not_full, NULL);
+    q.capacity = 2 * threads;
+
+    if ((workers = (pthread_t *) malloc(threads * sizeof(pthread_t))) == NULL)
+        ALLOC_ERR_EXIT("stream workers");
+    for (i = 0; i < threads; i++)
+        if (pthread_create(&workers[i], NULL, stream_worker, &q) != 0)
+            ERR_EXIT("Could not start stream worker");
+
+    while ((ret = read_frame(stdin, &f)) > 0) {
+        pthread_mutex_lock(&q.lock);
+        while (q.count >= q.capacity)
+            pthread_cond_wait(&q.not_full, &q.lock);
+        if (q.tail != NULL)
+            q.tail->next = f;
+        else
+            q.head = f;
+        q.tail = f;
+        q.count++;
+        pthread_cond_signal(&q.not_empty);
+        pthread_mutex_unlock(&q.lock);
+    }
+
+    pthread_mutex_lock(&q.lock);
+    q.closed = 1;
+    pthread_cond_broadcast(&q.not_empty);
+    pthread_mutex_unlock(&q.lock);
+    for (i = 0; i < threads; i++)
+        pthread_join(workers[i], NULL);
+    free(workers);
+    return ret < 0 ? -1 : 0;
+}
+
 int main(int argc, char *argv[]) {
     char *input_file, *input_type, *output_file, *output_type;
-    int validate;
+    char *dir, *manifest;
+    int validate, threads, stream;
+
+    get_options(argc, argv, &input_file, &input_type, &output_file, &output_type, &validate,
+                &dir, &manifest, &threads, &stream);
+
+    if (stream)
+        exit(run_stream(threads) == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
 
-    get_options(argc, argv, &input_file, &input_type, &output_file, &output_type, &validate);
+    if (strlen(manifest) > 0 || strlen(dir) > 0) {
+        job_list jobs = {NULL, 0, 0};
+
+        if (strlen(manifest) > 0)
+            read_manifest(manifest, &jobs);
+        else
+            read_directory(dir, input_type, output_file, output_type, &jobs);
+        exit(run_jobs(&jobs, threads) == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
     printf("input=%s, output=%s\n", input_type, output_type);
 
     unsigned char *idata, *odata;
@@ -106,12 +591,14 @@ int main(int argc, char *argv[]) {
         fread(idata, sizeof(unsigned char), ilen, i_fp);
         fclose(i_fp);
 
-        fmr2fmr(idata, ilen, &odata, &olen, input_file, output_type);
+        if (fmr2fmr(idata, ilen, &odata, &olen, input_type, output_type) != BC_OK)
+            ERR_EXIT("Could not convert minutiae record");
     } else {
 
         if (read_raw_from_filesize(input_file, &idata, &ilen) != 0)
             OPEN_ERR_EXIT(input_file);
-        img2fmr(idata, ilen, output_type, &odata, &olen);
+        if (img2fmr(idata, ilen, output_type, &odata, &olen) != BC_OK)
+            ERR_EXIT("Could not convert image");
     }
 
     FILE *fmr_fp = NULL;
@@ -1,8 +1,238 @@
 #ifndef BIOMETRICAL_CONVERTER_CONVERTER_H
 #define BIOMETRICAL_CONVERTER_CONVERTER_H
 
+/* Status codes returned by the converter functions. */
+#define BC_OK               0
+#define BC_ERR_ARGUMENT     -1  /* invalid argument or unknown format name */
+#define BC_ERR_MEMORY       -2  /* allocation failed */
+#define BC_ERR_DECODE       -3  /* input image could not be decoded */
+#define BC_ERR_EXTRACT      -4  /* minutiae detection failed */
+#define BC_ERR_FORMAT       -5  /* minutiae record could not be built or converted */
+#define BC_ERR_READ         -6  /* input minutiae record could not be parsed */
+#define BC_ERR_WRITE        -7  /* output minutiae record could not be serialized */
+#define BC_ERR_BUFFER_TOO_SMALL -8  /* output buffer too small; *olen holds the size needed */
+
+/*
+ * Conversion context. It owns all state a conversion mutates, so one context
+ * per thread lets conversions run concurrently without locking. A context
+ * must not be used by two threads at the same time.
+ */
+typedef struct bc_context bc_context;
+
+extern bc_context *bc_context_create(void);
+
+extern void bc_context_destroy(bc_context *ctx);
+
+/* Context options, set with bc_context_set_option(). */
+#define BC_OPT_THREADS      1   /* batch worker threads; 0 (default) = one per online CPU */
+#define BC_OPT_EXTRACT_THREADS 2 /* threads detecting minutiae in one image; 0 or 1
+                                   (default) = one. Results do not depend on it */
+#define BC_OPT_STATS        3   /* 1 = measure every call, see bc_stats; 0 (default) = off */
+#define BC_OPT_TARGET_PPI   4   /* detect minutiae on images scaled down to this resolution when
+                                   at least 10% above it, e.g. 500; 0 (default) = off. Records
+                                   keep the original image size and resolution */
+#define BC_OPT_CROP         5   /* 1 = detect minutiae only inside the fingerprint's bounding
+                                   box, skipping blank background; 0 (default) = whole image.
+                                   Records keep the original image size */
+#define BC_OPT_JP2_THREADS  6   /* threads OpenJPEG decodes one JPEG 2000 image on; 0 or 1
+                                   (default) = the calling thread */
+#define BC_OPT_JP2_REDUCE   7   /* wavelet levels discarded when decoding JPEG 2000, halving
+                                   the size each; 0 (default) = full size, or with
+                                   BC_OPT_TARGET_PPI as many as stay at or above the target */
+
+extern int bc_context_set_option(bc_context *ctx, int option, int value);
+
+/*
+ * Measurements of the last call on a context with BC_OPT_STATS set.
+ * Durations are monotonic-clock nanoseconds; stages a call did not run
+ * are 0. Allocations made inside NBIS and biomdi are not counted.
+ */
+typedef struct bc_stats {
+    long long total_ns;
+    long long decode_ns;        /* image decoding */
+    long long extract_ns;       /* minutiae detection */
+    long long build_ns;         /* ANSI record built from the minutiae */
+    long long parse_ns;         /* input record read */
+    long long convert_ns;       /* record converted to the output format */
+    long long serialize_ns;     /* output record written */
+    int width;                  /* image extracted from; 0 for record input */
+    int height;
+    int depth;
+    int ppi;
+    int minutiae;               /* detected, or read from the input record */
+    long long bytes_allocated;  /* decoded pixels, record scratch and output */
+    long long resample_ns;      /* scaling down to BC_OPT_TARGET_PPI */
+} bc_stats;
+
+extern int bc_context_get_stats(bc_context *ctx, bc_stats *stats);
+
+/*
+ * Process-wide totals over all measured calls, from every context with
+ * BC_OPT_STATS set.
+ */
+typedef struct bc_counters {
+    long long calls;
+    long long failures;
+    long long total_ns;
+    long long decode_ns;
+    long long extract_ns;
+    long long build_ns;
+    long long parse_ns;
+    long long convert_ns;
+    long long serialize_ns;
+    long long pixels;
+    long long minutiae;
+    long long bytes_allocated;
+    long long resample_ns;
+} bc_counters;
+
+extern void bc_get_counters(bc_counters *counters);
+
+extern void bc_reset_counters(void);
+
+/*
+ * Result cache: a bounded LRU of output records keyed by a hash of the input
+ * bytes, the input and output types and the ISO card resolution (or the raw
+ * image geometry), and the context options that change the output. A hit
+ * copies the record out and skips decoding, extraction and conversion. Each
+ * entry also holds a copy of its input, which a hit compares byte for byte,
+ * so an entry costs the input size plus the record size plus a small header.
+ * A cache is thread-safe and may be shared by any number of contexts; it
+ * must outlive them. Only successful conversions are cached.
+ */
+typedef struct bc_cache bc_cache;
+
+typedef struct bc_cache_stats {
+    long long hits;
+    long long misses;
+    long long evictions;
+    int entries;                /* records held now */
+    int capacity;
+    long long bytes;            /* memory held by the entries now */
+    long long max_bytes;
+} bc_cache_stats;
+
+/*
+ * Cache holding up to entries records in at most max_bytes of entry memory,
+ * inputs included; NULL if either limit is <= 0 or out of memory.
+ */
+extern bc_cache *bc_cache_create(int entries, long long max_bytes);
+
+extern void bc_cache_destroy(bc_cache *cache);
+
+extern int bc_cache_get_stats(bc_cache *cache, bc_cache_stats *stats);
+
+/* Serve and store this context's conversions through cache; NULL detaches. */
+extern int bc_context_set_cache(bc_context *ctx, bc_cache *cache);
+
+/*
+ * Reentrant variants of img2fmr, raw2fmr and fmr2fmr_iso_card. On success
+ * BC_OK is returned and *odata points to a buffer the caller releases with
+ * bc_free(); on failure a negative BC_ERR_* code is returned and *odata is
+ * untouched.
+ */
+extern int bc_img2fmr(bc_context *ctx, unsigned char *idata, int ilen, char *otype,
+                      unsigned char **odata, int *olen);
+
+/*
+ * Convert raw pixels, row by row with no padding, to a minutiae record.
+ * depth is 8 (grayscale) or 24 (interleaved RGB, reduced to luma first);
+ * ppi <= 0 means unknown and falls back to 500 ppi.
+ */
+extern int bc_raw2fmr(bc_context *ctx, unsigned char *pixels, int w, int h, int depth, int ppi,
+                      char *otype, unsigned char **odata, int *olen);
+
+extern int bc_fmr2fmr(bc_context *ctx, unsigned char *idata, int ilen, unsigned char **odata, int *olen,
+                      char *in_type_str, char *out_type_str, int iso_c_xres, int iso_c_yres);
+
+/*
+ * Caller-buffer variants. The record is serialized into obuf when osize is
+ * at least its size, and *olen receives the length. Otherwise
+ * BC_ERR_BUFFER_TOO_SMALL is returned with the exact size in *olen, and the
+ * record is kept in the context until the next call so bc_result_copy() can
+ * fetch it without converting again. obuf = NULL, osize = 0 is a size query.
+ */
+extern int bc_img2fmr_into(bc_context *ctx, unsigned char *idata, int ilen, char *otype,
+                           unsigned char *obuf, int osize, int *olen);
+
+extern int bc_raw2fmr_into(bc_context *ctx, unsigned char *pixels, int w, int h, int depth, int ppi,
+                           char *otype, unsigned char *obuf, int osize, int *olen);
+
+extern int bc_fmr2fmr_into(bc_context *ctx, unsigned char *idata, int ilen,
+                           char *in_type_str, char *out_type_str, int iso_c_xres, int iso_c_yres,
+                           unsigned char *obuf, int osize, int *olen);
+
+/*
+ * Convert a minutiae record like bc_fmr2fmr_into(), in one pass over the
+ * bytes where that gives the same result: copies within one format and
+ * conversions between ANSI and ISO 2004/2005 records, with no intermediate
+ * record objects; extended data is dropped as in bc_fmr2fmr(). Conversions
+ * to or from the ISONC and ISOCC card formats and other spec versions are
+ * done by bc_fmr2fmr_into() on ctx, through its cache if it has one. Buffer
+ * handling follows the _into variants on both paths.
+ */
+extern int bc_fmr_transcode(bc_context *ctx, unsigned char *idata, int ilen,
+                            char *in_type_str, char *out_type_str, int iso_c_xres, int iso_c_yres,
+                            unsigned char *obuf, int osize, int *olen);
+
+extern int bc_result_copy(bc_context *ctx, unsigned char *obuf, int osize, int *olen);
+
+/* Release a record returned by any of the allocating conversion functions. */
+extern void bc_free(void *ptr);
+
+/* One conversion of a batch. */
+typedef struct bc_batch_item {
+    unsigned char *idata;       /* input image or minutiae record */
+    int ilen;
+    char *in_type;              /* minutiae input type; unused for images */
+    char *out_type;
+    int iso_c_xres;             /* ISO card input resolution; unused for images */
+    int iso_c_yres;
+    unsigned char *odata;       /* result, released with bc_free() */
+    int olen;
+    int status;                 /* BC_OK or the BC_ERR_* code of this item */
+} bc_batch_item;
+
+/*
+ * Convert a batch on BC_OPT_THREADS worker threads with work stealing,
+ * largest inputs first. Every item gets its own status, so one bad input
+ * does not fail the batch. Returns the number of failed items, or a
+ * negative BC_ERR_* code if the batch could not run. ctx supplies the
+ * settings and serves the calling thread, which takes part as a worker.
+ */
+extern int bc_img2fmr_batch(bc_context *ctx, bc_batch_item *items, int count);
+
+extern int bc_fmr2fmr_batch(bc_context *ctx, bc_batch_item *items, int count);
+
+/* One finger image of a multi-finger record. */
+typedef struct bc_finger {
+    unsigned char *idata;       /* encoded image */
+    int ilen;
+    int position;               /* ANSI/ISO finger position, 0 (unknown) to 10 */
+    int impression;             /* impression type, 0 = live-scan plain */
+    int status;                 /* BC_OK or the BC_ERR_* code of this finger */
+} bc_finger;
+
+/*
+ * Build one minutiae record with a view per finger image. Images are decoded
+ * and minutiae detected in parallel on BC_OPT_THREADS threads, then the
+ * record is assembled and serialized once. All images must have the same
+ * resolution; the record carries the largest width and height. Views of the
+ * same position are numbered in order. If any finger fails, its status is
+ * set and its code returned, and no record is produced. Output follows
+ * bc_img2fmr() and bc_img2fmr_into().
+ */
+extern int bc_img2fmr_multi(bc_context *ctx, bc_finger *fingers, int count, char *otype,
+                            unsigned char **odata, int *olen);
+
+extern int bc_img2fmr_multi_into(bc_context *ctx, bc_finger *fingers, int count, char *otype,
+                                 unsigned char *obuf, int osize, int *olen);
+
 extern int img2fmr(unsigned char *idata, int ilen, char *otype, unsigned char **odata, int *olen);
 
+extern int raw2fmr(unsigned char *pixels, int w, int h, int depth, int ppi,
+                   char *otype, unsigned char **odata, int *olen);
+
 extern int fmr2fmr(unsigned char *idata, int ilen, unsigned char **odata, int *olen,
                    char *in_type_str, char *out_type_str);
 
@@ -0,0 +1,102 @@
+#include "arena.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Every allocation is aligned for any scalar type, including the doubles
+// and pointers the minutiae records hold.
+#define ARENA_ALIGN         16
+#define ARENA_ROUND(n)      (((n) + ARENA_ALIGN - 1) & ~((size_t) ARENA_ALIGN - 1))
+#define ARENA_MIN_BLOCK     (64 * 1024)
+
+struct bc_arena_block {
+    bc_arena_block *next;
+    size_t size;
+    size_t used;
+};
+
+#define BLOCK_HEADER        ARENA_ROUND(sizeof(bc_arena_block))
+#define BLOCK_DATA(b)       ((uint8_t *) (b) + BLOCK_HEADER)
+
+static bc_arena_block *
+new_block(size_t size) {
+    bc_arena_block *block;
+
+    block = (bc_arena_block *) malloc(BLOCK_HEADER + size);
+    if (block == NULL)
+        return NULL;
+    block->next = NULL;
+    block->size = size;
+    block->used = 0;
+    return block;
+}
+
+void bc_arena_init(bc_arena *arena) {
+    arena->head = NULL;
+    arena->used = 0;
+    arena->reserved = 0;
+}
+
+void *bc_arena_alloc(bc_arena *arena, size_t size) {
+    bc_arena_block *block;
+    size_t bsize;
+    void *ptr;
+
+    size = ARENA_ROUND(size);
+    block = arena->head;
+    if (block == NULL || block->size - block->used < size) {
+        bsize = ARENA_MIN_BLOCK;
+        if (block != NULL && block->size * 2 > bsize)
+            bsize = block->size * 2;
+        if (size > bsize)
+            bsize = size;
+        if ((block = new_block(bsize)) == NULL)
+            return NULL;
+        block->next = arena->head;
+        arena->head = block;
+        arena->reserved += bsize;
+    }
+
+    ptr = BLOCK_DATA(block) + block->used;
+    block->used += size;
+    arena->used += size;
+    return ptr;
+}
+
+void *bc_arena_calloc(bc_arena *arena, size_t size) {
+    void *ptr;
+
+    if ((ptr = bc_arena_alloc(arena, size)) != NULL)
+        memset(ptr, 0, size);
+    return ptr;
+}
+
+void bc_arena_reset(bc_arena *arena) {
+    bc_arena_block *block, *next;
+    size_t total;
+
+    if (arena->head != NULL && arena->head->next != NULL) {
+        // The last conversion overflowed the first block; replace the chain
+        // with one block that fits it, so steady state is a single block.
+        total = arena->reserved;
+        for (block = arena->head; block != NULL; block = next) {
+            next = block->next;
+            free(block);
+        }
+        arena->head = new_block(total);
+        arena->reserved = arena->head != NULL ? total : 0;
+    }
+    if (arena->head != NULL)
+        arena->head->used = 0;
+    arena->used = 0;
+}
+
+void bc_arena_release(bc_arena *arena) {
+    bc_arena_block *block, *next;
+
+    for (block = arena->head; block != NULL; block = next) {
+        next = block->next;
+        free(block);
+    }
+    bc_arena_init(arena);
+}
@@ -0,0 +1,30 @@
+#ifndef BIOMETRICAL_CONVERTER_ARENA_H
+#define BIOMETRICAL_CONVERTER_ARENA_H
+
+#include <stddef.h>
+
+/*
+ * Bump allocator for objects that live exactly as long as one conversion.
+ * Allocations are never freed one by one; bc_arena_reset() drops all of them
+ * at once and keeps the memory for the next conversion, folding any overflow
+ * blocks into a single block sized for the peak use.
+ */
+typedef struct bc_arena_block bc_arena_block;
+
+typedef struct bc_arena {
+    bc_arena_block *head;   // block allocations are carved from
+    size_t used;            // bytes handed out since the last reset
+    size_t reserved;        // bytes held in blocks
+} bc_arena;
+
+extern void bc_arena_init(bc_arena *arena);
+
+extern void *bc_arena_alloc(bc_arena *arena, size_t size);
+
+extern void *bc_arena_calloc(bc_arena *arena, size_t size);
+
+extern void bc_arena_reset(bc_arena *arena);
+
+extern void bc_arena_release(bc_arena *arena);
+
+#endif //BIOMETRICAL_CONVERTER_ARENA_H
@@ -0,0 +1,311 @@
+#include "cache.h"
+#include <pthread.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+typedef struct bc_cache_entry bc_cache_entry;
+
+struct bc_cache_entry {
+    bc_cache_key key;           // key.idata points into data
+    bc_cache_entry *chain;      // next entry in the same bucket
+    bc_cache_entry *newer;      // LRU list, most recently used at the head
+    bc_cache_entry *older;
+    int len;
+    unsigned char data[];       // the input, then the record
+};
+
+// The part of a key compared with memcmp().
+#define KEY_ID_SIZE offsetof(bc_cache_key, idata)
+
+struct bc_cache {
+    pthread_mutex_t lock;
+    uint64_t seed;
+    bc_cache_entry **buckets;
+    size_t mask;
+    int capacity;
+    int count;
+    long long max_bytes;
+    long long bytes;            // entry sizes, inputs and records included
+    bc_cache_entry *newest;
+    bc_cache_entry *oldest;
+    long long hits;
+    long long misses;
+    long long evictions;
+};
+
+#define P1  0x9E3779B185EBCA87ULL
+#define P2  0xC2B2AE3D27D4EB4FULL
+#define P3  0x165667B19E3779F9ULL
+#define P4  0x85EBCA77C2B2AE63ULL
+#define P5  0x27D4EB2F165667C5ULL
+
+static inline uint64_t
+rotl64(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t
+read64(const unsigned char *p) {
+    uint64_t v;
+
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint32_t
+read32(const unsigned char *p) {
+    uint32_t v;
+
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint64_t
+xxh_round(uint64_t acc, uint64_t input) {
+    acc += input * P2;
+    return rotl64(acc, 31) * P1;
+}
+
+static inline uint64_t
+xxh_merge(uint64_t acc, uint64_t v) {
+    acc ^= xxh_round(0, v);
+    return acc * P1 + P4;
+}
+
+/*
+ * XXH64, which hashes several GB/s with plain 64-bit arithmetic. Byte order
+ * is the host's; hashes never leave the process.
+ */
+static uint64_t
+hash64(const unsigned char *p, size_t len, uint64_t seed) {
+    const unsigned char *end = p + len;
+    uint64_t v1, v2, v3, v4, h;
+
+    if (len >= 32) {
+        v1 = seed + P1 + P2;
+        v2 = seed + P2;
+        v3 = seed;
+        v4 = seed - P1;
+        do {
+            v1 = xxh_round(v1, read64(p));
+            v2 = xxh_round(v2, read64(p + 8));
+            v3 = xxh_round(v3, read64(p + 16));
+            v4 = xxh_round(v4, read64(p + 24));
+            p += 32;
+        } while (end - p >= 32);
+        h = rotl64(v1, 1) + rotl64(v2, 7) + rotl64(v3, 12) + rotl64(v4, 18);
+        h = xxh_merge(h, v1);
+        h = xxh_merge(h, v2);
+        h = xxh_merge(h, v3);
+        h = xxh_merge(h, v4);
+    } else {
+        h = seed + P5;
+    }
+    h += (uint64_t) len;
+
+    for (; end - p >= 8; p += 8) {
+        h ^= xxh_round(0, read64(p));
+        h = rotl64(h, 27) * P1 + P4;
+    }
+    if (end - p >= 4) {
+        h ^= (uint64_t) read32(p) * P1;
+        h = rotl64(h, 23) * P2 + P3;
+        p += 4;
+    }
+    for (; p < end; p++) {
+        h ^= *p * P5;
+        h = rotl64(h, 11) * P1;
+    }
+
+    h ^= h >> 33;
+    h *= P2;
+    h ^= h >> 29;
+    h *= P3;
+    h ^= h >> 32;
+    return h;
+}
+
+bc_cache *bc_cache_create(int entries, long long max_bytes) {
+    struct timespec ts;
+    bc_cache *cache;
+    size_t nbuckets = 1;
+
+    if (entries <= 0 || max_bytes <= 0)
+        return NULL;
+    if ((cache = (bc_cache *) calloc(1, sizeof(bc_cache))) == NULL)
+        return NULL;
+    while (nbuckets < (size_t) entries)
+        nbuckets <<= 1;
+    if ((cache->buckets = (bc_cache_entry **) calloc(nbuckets, sizeof(bc_cache_entry *))) == NULL) {
+        free(cache);
+        return NULL;
+    }
+    pthread_mutex_init(&cache->lock, NULL);
+    cache->mask = nbuckets - 1;
+    cache->capacity = entries;
+    cache->max_bytes = max_bytes;
+    // A per-cache seed keeps hashes from being predictable across
+    // processes, so colliding inputs cannot be prepared in advance.
+    clock_gettime(CLOCK_REALTIME, &ts);
+    cache->seed = hash64((const unsigned char *) &ts, sizeof(ts), (uint64_t) (uintptr_t) cache);
+    return cache;
+}
+
+void bc_cache_destroy(bc_cache *cache) {
+    bc_cache_entry *entry, *older;
+
+    if (cache == NULL)
+        return;
+    for (entry = cache->newest; entry != NULL; entry = older) {
+        older = entry->older;
+        free(entry);
+    }
+    pthread_mutex_destroy(&cache->lock);
+    free(cache->buckets);
+    free(cache);
+}
+
+int bc_cache_get_stats(bc_cache *cache, bc_cache_stats *stats) {
+    if (cache == NULL || stats == NULL)
+        return BC_ERR_ARGUMENT;
+    pthread_mutex_lock(&cache->lock);
+    stats->hits = cache->hits;
+    stats->misses = cache->misses;
+    stats->evictions = cache->evictions;
+    stats->entries = cache->count;
+    stats->capacity = cache->capacity;
+    stats->bytes = cache->bytes;
+    stats->max_bytes = cache->max_bytes;
+    pthread_mutex_unlock(&cache->lock);
+    return BC_OK;
+}
+
+void bc_cache_key_init(const bc_cache *cache, bc_cache_key *key, int source,
+                       const unsigned char *idata, long long ilen, int in_type, int out_type,
+                       const int *params) {
+    memset(key, 0, sizeof(*key));
+    key->hash = hash64(idata, (size_t) ilen, cache->seed);
+    key->ilen = ilen;
+    key->source = source;
+    key->in_type = in_type;
+    key->out_type = out_type;
+    memcpy(key->params, params, sizeof(key->params));
+    key->idata = idata;
+}
+
+static bc_cache_entry **
+bucket(bc_cache *cache, const bc_cache_key *key) {
+    uint64_t h = hash64((const unsigned char *) key, KEY_ID_SIZE, cache->seed);
+
+    return &cache->buckets[h & cache->mask];
+}
+
+static bc_cache_entry *
+find(bc_cache *cache, const bc_cache_key *key) {
+    bc_cache_entry *entry;
+
+    // A 64-bit hash can collide, by chance or by design; only the same
+    // input bytes make a hit.
+    for (entry = *bucket(cache, key); entry != NULL; entry = entry->chain)
+        if (memcmp(&entry->key, key, KEY_ID_SIZE) == 0 &&
+            memcmp(entry->key.idata, key->idata, (size_t) key->ilen) == 0)
+            return entry;
+    return NULL;
+}
+
+static void
+unlink_lru(bc_cache *cache, bc_cache_entry *entry) {
+    if (entry->newer != NULL)
+        entry->newer->older = entry->older;
+    else
+        cache->newest = entry->older;
+    if (entry->older != NULL)
+        entry->older->newer = entry->newer;
+    else
+        cache->oldest = entry->newer;
+}
+
+static void
+push_lru(bc_cache *cache, bc_cache_entry *entry) {
+    entry->newer = NULL;
+    entry->older = cache->newest;
+    if (cache->newest != NULL)
+        cache->newest->newer = entry;
+    else
+        cache->oldest = entry;
+    cache->newest = entry;
+}
+
+// Memory held by an entry.
+static long long
+entry_size(const bc_cache_entry *entry) {
+    return (long long) sizeof(bc_cache_entry) + entry->key.ilen + entry->len;
+}
+
+static void
+evict_oldest(bc_cache *cache) {
+    bc_cache_entry *entry = cache->oldest;
+    bc_cache_entry **link;
+
+    for (link = bucket(cache, &entry->key); *link != entry; link = &(*link)->chain);
+    *link = entry->chain;
+    unlink_lru(cache, entry);
+    cache->bytes -= entry_size(entry);
+    free(entry);
+    cache->count--;
+    cache->evictions++;
+}
+
+int bc_cache_get(bc_cache *cache, const bc_cache_key *key, bc_cache_copy_fn fn, void *arg, int *ret) {
+    bc_cache_entry *entry;
+
+    pthread_mutex_lock(&cache->lock);
+    if ((entry = find(cache, key)) == NULL) {
+        cache->misses++;
+        pthread_mutex_unlock(&cache->lock);
+        return 0;
+    }
+    cache->hits++;
+    if (entry != cache->newest) {
+        unlink_lru(cache, entry);
+        push_lru(cache, entry);
+    }
+    *ret = fn(arg, entry->data + entry->key.ilen, entry->len);
+    pthread_mutex_unlock(&cache->lock);
+    return 1;
+}
+
+void bc_cache_put(bc_cache *cache, const bc_cache_key *key, const unsigned char *data, int len) {
+    bc_cache_entry *entry, **head;
+    long long size;
+
+    size = (long long) sizeof(bc_cache_entry) + key->ilen + len;
+    if (size > cache->max_bytes)
+        return;
+    // Copy outside the lock; a racing thread may have added the same record.
+    if ((entry = (bc_cache_entry *) malloc(sizeof(bc_cache_entry) + (size_t) key->ilen + len)) == NULL)
+        return;
+    entry->key = *key;
+    entry->key.idata = entry->data;
+    entry->len = len;
+    memcpy(entry->data, key->idata, (size_t) key->ilen);
+    memcpy(entry->data + key->ilen, data, len);
+
+    pthread_mutex_lock(&cache->lock);
+    if (find(cache, key) != NULL) {
+        pthread_mutex_unlock(&cache->lock);
+        free(entry);
+        return;
+    }
+    while (cache->count == cache->capacity || cache->bytes + size > cache->max_bytes)
+        evict_oldest(cache);
+    head = bucket(cache, key);
+    entry->chain = *head;
+    *head = entry;
+    push_lru(cache, entry);
+    cache->count++;
+    cache->bytes += size;
+    pthread_mutex_unlock(&cache->lock);
+}
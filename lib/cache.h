@@ -0,0 +1,56 @@
+#ifndef BIOMETRICAL_CONVERTER_CACHE_H
+#define BIOMETRICAL_CONVERTER_CACHE_H
+
+#include <stdint.h>
+#include "converter.h"
+
+/* What a cached record was converted from. */
+#define BC_CACHE_IMAGE      1
+#define BC_CACHE_RAW        2
+#define BC_CACHE_RECORD     3
+
+#define BC_CACHE_PARAMS     8
+
+/*
+ * Identity of a conversion: a hash of the input bytes and every parameter
+ * that changes the output. The fields before idata are compared with
+ * memcmp(), so keys must be built with bc_cache_key_init(), which zeroes the
+ * padding; a hit then also compares the input itself, so inputs that share
+ * a hash never share a record.
+ */
+typedef struct bc_cache_key {
+    uint64_t hash;
+    long long ilen;
+    int source;             // BC_CACHE_*
+    int in_type;
+    int out_type;
+    int params[BC_CACHE_PARAMS];
+    const unsigned char *idata;     // the hashed bytes, ilen of them
+} bc_cache_key;
+
+/*
+ * params holds BC_CACHE_PARAMS values: the card resolution, raw image
+ * geometry and context settings that affect the output. idata must stay
+ * valid while the key is used.
+ */
+extern void bc_cache_key_init(const bc_cache *cache, bc_cache_key *key, int source,
+                              const unsigned char *idata, long long ilen, int in_type, int out_type,
+                              const int *params);
+
+/* Receives a cached record while the cache is locked; returns a BC_* status. */
+typedef int (*bc_cache_copy_fn)(void *arg, const unsigned char *data, int len);
+
+/*
+ * On a hit the record is passed to fn, its status is stored in *ret and 1 is
+ * returned; on a miss 0 is returned.
+ */
+extern int bc_cache_get(bc_cache *cache, const bc_cache_key *key, bc_cache_copy_fn fn, void *arg, int *ret);
+
+/*
+ * Add a record with a copy of its input, evicting the least recently used
+ * ones until both the entry and the byte limit hold. A record whose entry
+ * alone exceeds the byte limit is not stored.
+ */
+extern void bc_cache_put(bc_cache *cache, const bc_cache_key *key, const unsigned char *data, int len);
+
+#endif //BIOMETRICAL_CONVERTER_CACHE_H
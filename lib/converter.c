@@ -1,5 +1,6 @@
 #include "converter.h"
 #include <sys/queue.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -16,41 +17,83 @@
 #include <imgutil.h>
 #include <png_dec.h>
 #include <jpeg2k.h>
-
+#include <pthread.h>
+#include "arena.h"
+#include "cache.h"
+#include "pool.h"
+#include "extract.h"
+#include "jp2.h"
+#include "wsqdec.h"
+#ifdef BC_TURBOJPEG
+#include "jpeg.h"
+#endif
+#include "simd.h"
+#include "transcode.h"
+
+// NBIS libraries read this flag; it is never written here, so sharing it
+// between threads is safe.
 int debug = 0;
 
-// Append a field to a Type-1 record, branching to 'err_out' on error.
-#define APPEND_TYPE1_FIELD(record, fieldname, value)            \
-    do {                                \
-        FIELD *__field = NULL;                    \
-        if(value2field(&__field, TYPE_1_ID, fieldname, value) != 0)\
-            goto err_out;                    \
-        if(append_ANSI_NIST_record(record, __field) != 0)    \
-            goto err_out;                    \
-    } while (0)
-
-#define APPEND_TYPE2_FIELD(record, fieldname, value)            \
-    do {                                \
-        FIELD *__field = NULL;                    \
-        if(value2field(&__field, TYPE_2_ID, fieldname, value) != 0)\
-            goto err_out;                    \
-        if(append_ANSI_NIST_record(record, __field) != 0)    \
-            goto err_out;                    \
-    } while (0)
-
-#define APPEND_TYPE9_FIELD(record, fieldname, value)            \
-    do {                                \
-        FIELD *__field = NULL;                    \
-        if(value2field(&__field, TYPE_9_ID, fieldname, value) != 0)\
-            goto err_out;                    \
-        if(append_ANSI_NIST_record(record, __field) != 0)    \
-            goto err_out;                    \
-    } while (0)
-
-// The maximum field size for a Type-2 record. This value is specified in
-// ELECTRONIC FINGERPRINT TRANSMISSION SPECIFICATION (CJIS-RS-0010),
-// January 1999.
-#define MAX_TYPE2_FIELD_SIZE    120
+// Per-call conversion state. Everything a conversion mutates lives here so
+// that independent contexts can run on different threads without locking.
+struct bc_context {
+    // Settings from bc_context_set_option(); copied to batch worker contexts.
+    int threads;
+    int extract_threads;
+    int stats_enabled;
+    int target_ppi;
+    int crop;
+    int jp2_threads;
+    int jp2_reduce;
+    // Shared result cache, or NULL.
+    bc_cache *cache;
+    // Measurements of the current call, and when it started.
+    bc_stats stats;
+    long long call_start;
+    // View number counters per finger position for the record being built.
+    int fgp_view[MAX_TABLE_6_CODE]; // from an2k.h
+    // Records, scratch buffers and converted pixels of the current call;
+    // reset once the output has been serialized.
+    bc_arena arena;
+    // Last record that did not fit the caller's buffer, for bc_result_copy().
+    unsigned char *result;
+    size_t result_size;
+    int result_len;
+};
+
+// Totals over all measured calls, updated atomically.
+static bc_counters counters;
+
+// Monotonic time in nanoseconds, or 0 without stats, so that unmeasured
+// calls pay one branch per stage.
+static long long
+stats_clock(const bc_context *ctx) {
+    struct timespec ts;
+
+    if (!ctx->stats_enabled)
+        return 0;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+#define STATS_STAGE(ctx, field, start) do { \
+    if ((ctx)->stats_enabled) \
+        (ctx)->stats.field += stats_clock(ctx) - (start); \
+} while (0)
+
+#define STATS_SET(ctx, field, value) do { \
+    if ((ctx)->stats_enabled) \
+        (ctx)->stats.field = (value); \
+} while (0)
+
+#define STATS_ADD(ctx, field, value) do { \
+    if ((ctx)->stats_enabled) \
+        (ctx)->stats.field += (value); \
+} while (0)
+
+// The NBIS lossless JPEG decoder reads its bit stream through static
+// state in getc_nextbits_jpegl, so decoding has to be serialized.
+static pthread_mutex_t jpegl_lock = PTHREAD_MUTEX_INITIALIZER;
 
 void
 convert_xy(unsigned short x_size, unsigned short y_size,
@@ -75,7 +118,10 @@ convert_xy(unsigned short x_size, unsigned short y_size,
         // from size
         factor = (float) y_res / 1000;
         ty = (float) ansi_y * factor;
-        *fmr_y = (unsigned short) (y_size - 1 - ty);
+        if (ty > y_size - 1)
+            *fmr_y = 0;
+        else
+            *fmr_y = (unsigned short) (y_size - 1 - ty);
     } else
         *fmr_y = 0;
 
@@ -100,13 +146,13 @@ convert_quality(int ansi_qual, unsigned char *fmr_qual) {
 
 
 void
-convert_type(char ansi_type, unsigned char *fmr_type) {
-    switch (ansi_type) {
-        case 'A' :
+convert_type(int lfs_type, unsigned char *fmr_type) {
+    switch (lfs_type) {
+        case RIDGE_ENDING :
             *fmr_type = FMD_MINUTIA_TYPE_RIDGE_ENDING;
             break;
 
-        case 'B' :
+        case BIFURCATION :
             *fmr_type = FMD_MINUTIA_TYPE_BIFURCATION;
             break;
 
@@ -116,559 +162,275 @@ convert_type(char ansi_type, unsigned char *fmr_type) {
     }
 }
 
-void
-convert_type4_ISR(RECORD *rec, unsigned short *x_res, unsigned short *y_res) {
-    FIELD *field;
-    int val;
-    int idx;
-    float f;
-
-    if (lookup_ANSI_NIST_field(&field, &idx, ISR_ID, rec) == FALSE)
-        ERR_OUT("Lookup of Type-4 ISR_ID");
-    val = strtol((char *) field->subfields[0]->items[0]->value, NULL, 10);
-
-    if ((val != 0) && (val != 1))
-        ERR_OUT("Type-4 ISR is invalid");
-
-    switch (val) {
-        case 0:            // minimum resolution
-            f = MIN_RESOLUTION * 10;    // px/mm -> px/cm
-            *x_res = (unsigned short) (f + 0.5);
-            f = MIN_RESOLUTION * 10;    // px/mm -> px/cm
-            *y_res = (unsigned short) (f + 0.5);
-            break;
-            // May want to ERR out here
-        default:
-            *x_res = 0;
-            *y_res = 0;
-            break;
-    }
+/*
+ * Arena-backed counterparts of the biomdi new_* constructors for the records
+ * lfs2fmr builds. The objects go away with the context's arena reset and
+ * must never be handed to free_fmr() and friends.
+ */
+static int
+arena_new_fmr(bc_arena *arena, unsigned int format_std, FMR **fmr) {
+    FMR *lfmr;
+
+    if ((lfmr = (FMR *) bc_arena_calloc(arena, sizeof(FMR))) == NULL)
+        return -1;
+    lfmr->format_std = format_std;
+    TAILQ_INIT(&lfmr->finger_views);
+    *fmr = lfmr;
+    return 0;
+}
 
-    err_out:
-    return;
+static int
+arena_new_fvmr(bc_arena *arena, unsigned int format_std, FVMR **fvmr) {
+    FVMR *lfvmr;
+
+    if ((lfvmr = (FVMR *) bc_arena_calloc(arena, sizeof(FVMR))) == NULL)
+        return -1;
+    lfvmr->format_std = format_std;
+    TAILQ_INIT(&lfvmr->minutiae_data);
+    *fvmr = lfvmr;
+    return 0;
 }
 
-void
-convert_type13_SLC(RECORD *rec, unsigned short *x_res, unsigned short *y_res) {
-    FIELD *field;
-    int val;
-    int hps, vps;
-    int idx;
-    float f;
-
-    if (lookup_ANSI_NIST_field(&field, &idx, SLC_ID, rec) == FALSE)
-        ERR_OUT("Lookup of SLC_ID");
-    val = strtol((char *) field->subfields[0]->items[0]->value, NULL, 10);
-
-    if ((val == 1) || (val == 2)) {
-        if (lookup_ANSI_NIST_field(&field, &idx, HPS_ID, rec) == FALSE)
-            ERR_OUT("Lookup of HPS_ID");
-        hps = strtol((char *) field->subfields[0]->items[0]->value,
-                     NULL, 10);
-        if (lookup_ANSI_NIST_field(&field, &idx, VPS_ID, rec) == FALSE)
-            ERR_OUT("Lookup of VPS_ID");
-        vps = strtol((char *) field->subfields[0]->items[0]->value,
-                     NULL, 10);
-    }
+static int
+arena_new_fmd(bc_arena *arena, unsigned int format_std, FMD **fmd, unsigned int index) {
+    FMD *lfmd;
+
+    if ((lfmd = (FMD *) bc_arena_calloc(arena, sizeof(FMD))) == NULL)
+        return -1;
+    lfmd->format_std = format_std;
+    lfmd->index = index;
+    *fmd = lfmd;
+    return 0;
+}
 
-    switch (val) {
-        case 1:            // pixels/inch
-            f = (float) hps / 2.54;
-            *x_res = (unsigned short) f;
-            f = (float) vps / 2.54;
-            *y_res = (unsigned short) f;
-            break;
-        case 2:            // pixels/cm
-            *x_res = hps;
-            *y_res = vps;
-            break;
-            // May want to ERR out here
-        default:
-            *x_res = 0;
-            *y_res = 0;
-            break;
-    }
+static int
+arena_new_fedb(bc_arena *arena, FEDB **fedb) {
+    FEDB *lfedb;
 
-    err_out:
-    return;
+    if ((lfedb = (FEDB *) bc_arena_calloc(arena, sizeof(FEDB))) == NULL)
+        return -1;
+    TAILQ_INIT(&lfedb->extended_data);
+    *fedb = lfedb;
+    return 0;
 }
 
-int
-set_fmr_img(struct finger_minutiae_record *fmr, RECORD *rec) {
-    FIELD *field;
-    int idx;
-    int factor;
-
-    // Some image record types give resolution as half the minimum or
-    // native, so set a factor for the resolution
-    switch (rec->type) {
-        case TYPE_3_ID:
-        case TYPE_5_ID:
-            factor = 2;
-            break;
-        default:
-            factor = 1;
-            break;
-    }
+// Only ridge count records are built here, so only that payload is set up.
+static int
+arena_new_rc_fed(bc_arena *arena, FED **fed, unsigned short length) {
+    FED *lfed;
+    struct ridge_count_data_block *rcdb;
+
+    lfed = (FED *) bc_arena_calloc(arena, sizeof(FED));
+    rcdb = (struct ridge_count_data_block *)
+            bc_arena_calloc(arena, sizeof(struct ridge_count_data_block));
+    if (lfed == NULL || rcdb == NULL)
+        return -1;
+    TAILQ_INIT(&rcdb->ridge_counts);
+    lfed->type_id = FED_RIDGE_COUNT;
+    lfed->length = length;
+    lfed->rcdb = rcdb;
+    *fed = lfed;
+    return 0;
+}
 
-    switch (rec->type) {
-        case TYPE_13_ID:
-            convert_type13_SLC(rec, &fmr->x_resolution, &fmr->y_resolution);
-            break;
-        case TYPE_4_ID:
-            convert_type4_ISR(rec, &fmr->x_resolution, &fmr->y_resolution);
-            break;
-        default:
-            // XXX: implement
-            fmr->x_resolution = 0;
-            fmr->y_resolution = 0;
-            break;
+/*
+ * Add the ridge counts of one minutia to the view's extended data block,
+ * creating the block and its ridge count record on first use. Indices are
+ * one-based as in the AN2K Type-9 minutiae field; neighbors that were cut
+ * by the FMR minutiae limit are skipped.
+ */
+static int
+add_ridge_counts(bc_arena *arena, FVMR *fvmr, FED **rc_fed, const MINUTIA *minutia, int index,
+                 int num_minutiae) {
+    FEDB *fedb;
+    FED *fed;
+    RCD *rcd;
+    int n;
+
+    for (n = 0; n < minutia->num_nbrs; n++) {
+        if (minutia->nbrs[n] >= num_minutiae)
+            continue;
+        if (fvmr->extended == NULL) {
+            if (arena_new_fedb(arena, &fedb) != 0)
+                ALLOC_ERR_OUT("Extended Data Block");
+            add_fedb_to_fvmr(fedb, fvmr);
+        }
+        /* The FEDB length does NOT include the block length field
+         * itself; it is summed up from the FED once all counts are in.
+         */
+        if (*rc_fed == NULL) {
+            if (arena_new_rc_fed(arena, &fed, FED_HEADER_LENGTH) != 0)
+                ALLOC_ERR_OUT("Extended Data record");
+            fed->length += RIDGE_COUNT_HEADER_LENGTH;
+            // XXX Set fed->rcdb->method
+            add_fed_to_fedb(fed, fvmr->extended);
+            *rc_fed = fed;
+        }
+        if ((rcd = (RCD *) bc_arena_calloc(arena, sizeof(RCD))) == NULL)
+            ALLOC_ERR_OUT("Ridge Count Data");
+        rcd->index_one = (unsigned short) (index + 1);
+        rcd->index_two = (unsigned short) (minutia->nbrs[n] + 1);
+        rcd->count = (unsigned short) minutia->ridge_counts[n];
+        (*rc_fed)->length += RIDGE_COUNT_DATA_LENGTH;
+        add_rcd_to_rcdb(rcd, (*rc_fed)->rcdb);
     }
-
-    if (lookup_ANSI_NIST_field(&field, &idx, HLL_ID, rec) == FALSE)
-        ERR_OUT("Lookup of field HLL_ID");
-    fmr->x_image_size =
-            strtol((char *) field->subfields[0]->items[0]->value, NULL, 10);
-
-    if (lookup_ANSI_NIST_field(&field, &idx, VLL_ID, rec) == FALSE)
-        ERR_OUT("Lookup of VLL_ID");
-    fmr->y_image_size =
-            strtol((char *) field->subfields[0]->items[0]->value, NULL, 10);;
-
     return 0;
 
     err_out:
     return -1;
 }
 
-int
-init_fmr(struct finger_minutiae_record *fmr, ANSI_NIST *ansi_nist, int idc) {
-    RECORD *rec;
-    int idx;
-    int ret;
-
-    strcpy(fmr->format_id, FMR_FORMAT_ID);
-    strcpy(fmr->spec_version, FMR_ANSI_SPEC_VERSION);
-    fmr->record_length = FMR_ANSI_SMALL_HEADER_LENGTH;
-    fmr->record_length_type = FMR_ANSI_SMALL_HEADER_TYPE;
-    fmr->product_identifier_owner = 1; // XXX: replace with something valid?
-    fmr->product_identifier_type = 1; // XXX: replace with something valid?
-    fmr->scanner_id = 0;
-    fmr->compliance = 0;
-
-    ret = lookup_fingerprint_with_IDC(&rec, &idx, idc, 1, ansi_nist);
-    if (ret < 0)
-        ERR_OUT("System error locating image record");
-    if (ret == TRUE) {
-        if (set_fmr_img(fmr, rec) != 0)
-            ERR_OUT("Initializing FMR image info");
-    } else {
-        fmr->x_image_size = 0;
-        fmr->y_image_size = 0;
-        fmr->x_resolution = 0;
-        fmr->y_resolution = 0;
-    }
-
-    fmr->num_views = 0;
+/*
+ * Geometry of one view: the image the record describes, the pixels decoded
+ * from it and the pixels minutiae are detected on. They differ when the
+ * context normalizes high-resolution input to BC_OPT_TARGET_PPI, in the
+ * decoder or before detection.
+ */
+typedef struct {
+    int iw, ih;                 // image the record describes
+    double ippmm;
+    int pw, ph;                 // pixels the decoder returned
+    int ew, eh;                 // image minutiae are detected on
+    double eppmm;
+    double xscale, yscale;      // record pixels per detection pixel
+} bc_geometry;
 
+/*
+ * Start an ANSI FMR with no views in the context's arena. The image size
+ * and resolution in the header apply to every view added to it.
+ */
+static int
+new_ansi_fmr(bc_context *ctx, int iw, int ih, int ippi, double ippmm,
+             struct finger_minutiae_record **fmr) {
+    struct finger_minutiae_record *lfmr;
+
+    memset(ctx->fgp_view, 0, sizeof(ctx->fgp_view));
+
+    if (arena_new_fmr(&ctx->arena, FMR_STD_ANSI, &lfmr) != 0)
+        return -1;
+    strcpy(lfmr->format_id, FMR_FORMAT_ID);
+    strcpy(lfmr->spec_version, FMR_ANSI_SPEC_VERSION);
+    lfmr->record_length = FMR_ANSI_SMALL_HEADER_LENGTH;
+    lfmr->record_length_type = FMR_ANSI_SMALL_HEADER_TYPE;
+    lfmr->product_identifier_owner = 1; // XXX: replace with something valid?
+    lfmr->product_identifier_type = 1; // XXX: replace with something valid?
+    lfmr->scanner_id = 0;
+    lfmr->compliance = 0;
+    lfmr->x_image_size = (unsigned short) iw;
+    lfmr->y_image_size = (unsigned short) ih;
+    if (ippi == UNDEFINED)
+        ippi = sround(ippmm * MM_PER_INCH);
+    lfmr->x_resolution = (unsigned short) ippi;
+    lfmr->y_resolution = (unsigned short) ippi;
+
+    *fmr = lfmr;
     return 0;
-
-    err_out:
-    return -1;
 }
 
-int
-init_fvmr(struct finger_view_minutiae_record *fvmr, RECORD *anrecord) {
-    int idx;
-    int subfield, item;
-    unsigned short x, y, q;
-    int tval;
-    char buf[8];
+/*
+ * Add a view built straight from LFS minutiae to an FMR from
+ * new_ansi_fmr(). Coordinates are scaled from the detection image back to
+ * the image the record describes, then go through the same AN2K
+ * quantization (0.01 mm units, whole degrees) and convert_* helpers as a
+ * Type-9 record would, without formatting and re-parsing every value as
+ * text.
+ */
+static int
+add_lfs_view(bc_context *ctx, struct finger_minutiae_record *lfmr, MINUTIAE *minutiae,
+             const bc_geometry *geo, int finger, int impression) {
+    struct finger_view_minutiae_record *fvmr;
     struct finger_minutiae_data *fmd;
-    struct finger_extended_data *fed;
-    struct finger_extended_data_block *fedb;
-    struct ridge_count_data *rcd;
-    struct core_data *cd;
-    struct delta_data *dd;
-    int have_fedb = 0;    /* So we have only one extended data block */
-    int have_rcdb = 0;
-    int have_cddb = 0;
-    FIELD *field;
-
-    /*
-     * Create an array of counts for the finger positions; used to
-     * maintain the view number for the finger across calls.
-     */
-    static int fgp_view[MAX_TABLE_6_CODE] = {0}; // from an2k.h
-
-    /*** Finger number                 ***/
-    if (lookup_ANSI_NIST_field(&field, &idx, FGP2_ID, anrecord) == FALSE)
-        ERR_OUT("FGP field not found");
-    fvmr->finger_number = (unsigned char)
-            strtol((char *) field->subfields[0]->items[0]->value, NULL, 10);
-
-    /*** View number/impression type    ***/
-    // XXX: Check finger_number in range
-    fvmr->view_number = (unsigned char) fgp_view[fvmr->finger_number];
-    fgp_view[fvmr->finger_number]++;
-
-    if (lookup_ANSI_NIST_field(&field, &idx, IMP_ID, anrecord) == FALSE)
-        ERR_OUT("IMP_ID field not found");
-    fvmr->impression_type = (unsigned char)
-            strtol((char *) field->subfields[0]->items[0]->value, NULL, 10);
-
-    // What it should be set to?
-    fvmr->impression_type = 0;
-
-    /*** Finger quality                 ***/
+    FED *rc_fed = NULL;
+    MINUTIA *minutia;
+    unsigned short res;
+    int nx, ny, nt;
+    int i, num;
+
+    if (arena_new_fvmr(&ctx->arena, FMR_STD_ANSI, &fvmr) != 0)
+        ALLOC_ERR_OUT("FVMR");
+    add_fvmr_to_fmr(fvmr, lfmr);
+
+    fvmr->finger_number = (unsigned char) finger;
+    fvmr->view_number = (unsigned char) ctx->fgp_view[fvmr->finger_number]++;
+    fvmr->impression_type = (unsigned char) impression;
     // XXX: What should the overall finger quality be set to?
     fvmr->finger_quality = 0;
 
-    /* Add the core records */
-    fed = NULL;
-    if (lookup_ANSI_NIST_field(&field, &idx, CRP_ID, anrecord) == TRUE) {
-        if (have_fedb == 0) {
-            if (new_fedb(FMR_STD_ANSI, &fedb) != 0)
-                ALLOC_ERR_OUT("Extended Data Block");
-            have_fedb = 1;
-        }
-        /* The FEDB length does NOT include the
-         * block length field itself, so we add the
-         * the new core/delta data block length only.
-         */
-        if (have_cddb == 0) {
-            if (new_fed(FMR_STD_ANSI, &fed, FED_CORE_AND_DELTA,
-                        FED_HEADER_LENGTH) != 0)
-                ALLOC_ERR_EXIT("Extended Data record");
-            have_cddb = 1;
-        }
-        fed->length += CORE_DATA_HEADER_LENGTH;
-
-        for (subfield = 0; subfield < field->num_subfields;
-             subfield++) {
-            if (new_cd(FMR_STD_ANSI, &cd) != 0)
-                ALLOC_ERR_EXIT("Core Data");
-            /* The x,y coordinates are strung together;
-             * separate them. */
-            memcpy(buf,
-                   field->subfields[subfield]->items[0]->value, 4);
-            buf[4] = '\0';
-            cd->x_coord =
-                    (unsigned short) strtoul(buf, (char **) NULL, 10);
-            memcpy(buf,
-                   &field->subfields[subfield]->items[0]->value[4], 4);
-            buf[4] = '\0';
-            cd->y_coord =
-                    (unsigned short) strtoul(buf, (char **) NULL, 10);
-            /* No angle in AN2K; leave at default of 0 */
-            fed->length += CORE_DATA_MIN_LENGTH;
-            fed->cddb->num_cores++;
-            add_cd_to_cddb(cd, fed->cddb);
-        }
-    }
-    /* Add the delta records */
-    if (lookup_ANSI_NIST_field(&field, &idx, DLT_ID, anrecord) == TRUE) {
-        if (have_fedb == 0) {
-            if (new_fedb(FMR_STD_ANSI, &fedb) != 0)
-                ALLOC_ERR_OUT("Extended Data Block");
-            have_fedb = 1;
-        }
-        /* The FEDB length does NOT include the
-         * block length field itself, so we add the
-         * the new core/delta data block length only.
-         */
-        if (have_cddb == 0) {
-            if (new_fed(FMR_STD_ANSI, &fed, FED_CORE_AND_DELTA,
-                        FED_HEADER_LENGTH) != 0)
-                ALLOC_ERR_EXIT("Extended Data record");
-            have_cddb = 1;
-        }
-        fed->length += DELTA_DATA_HEADER_LENGTH;
-
-        for (subfield = 0; subfield < field->num_subfields;
-             subfield++) {
-            if (new_dd(FMR_STD_ANSI, &dd) != 0)
-                ALLOC_ERR_EXIT("Delta Data");
-            memcpy(buf,
-                   field->subfields[subfield]->items[0]->value, 4);
-            buf[4] = '\0';
-            dd->x_coord =
-                    (unsigned short) strtoul(buf, (char **) NULL, 10);
-            memcpy(buf,
-                   &field->subfields[subfield]->items[0]->value[4], 4);
-            buf[4] = '\0';
-            dd->y_coord =
-                    (unsigned short) strtoul(buf, (char **) NULL, 10);
-            /* No angles in AN2K; leave at default of 0 */
-            fed->length += DELTA_DATA_MIN_LENGTH;
-            fed->cddb->num_deltas++;
-            add_dd_to_cddb(dd, fed->cddb);
-        }
-    }
-    if (have_cddb) {
-        fedb->block_length += fed->length;
-        add_fed_to_fedb(fed, fedb);
-    }
+    num = minutiae->num;
+    if (num > FMR_MAX_NUM_MINUTIAE)
+        num = FMR_MAX_NUM_MINUTIAE;
+    fvmr->number_of_minutiae = (unsigned char) num;
 
-    /*** Number of minutiae             ***/
-    if (lookup_ANSI_NIST_field(&field, &idx, MIN_ID, anrecord) == FALSE)
-        ERR_OUT("Number of minutiae field not found");
-    tval = (int) strtol((char *) field->subfields[0]->items[0]->value,
-                        NULL, 10);
-    if (tval > FMR_MAX_NUM_MINUTIAE) {
-        tval = FMR_MAX_NUM_MINUTIAE;
-    }
-    fvmr->number_of_minutiae = (unsigned char) tval;
-
-    /*** Finger minutiae data           ***/
-    if (lookup_ANSI_NIST_field(&field, &idx, MRC_ID, anrecord) == FALSE)
-        ERR_OUT("Minutiae and ridge count data field not found");
+    // Resolution the AN2K image record would carry, in pixels/cm.
+    res = (unsigned short) sround(geo->ippmm * 10);
 
-    /* For each minutiae index number, create the minutiae data records */
-    for (subfield = 0; subfield < fvmr->number_of_minutiae; subfield++) {
-        if (new_fmd(FMR_STD_ANSI, &fmd, subfield) != 0)
+    for (i = 0; i < num; i++) {
+        minutia = minutiae->list[i];
+        if (arena_new_fmd(&ctx->arena, FMR_STD_ANSI, &fmd, i) != 0)
             ALLOC_ERR_OUT("finger minutiae data record");
 
-        /* The x,y,theta values are in the second item,
-         * strung together; separate them.
-         */
-        memcpy(buf, field->subfields[subfield]->items[1]->value, 4);
-        buf[4] = '\0';
-        x = (unsigned short) strtoul(buf, (char **) NULL, 10);
-
-        memcpy(buf, &field->subfields[subfield]->items[1]->value[4], 4);
-        buf[4] = '\0';
-        y = (unsigned short) strtoul(buf, (char **) NULL, 10);
-
-        convert_xy(fvmr->fmr->x_image_size, fvmr->fmr->y_image_size,
-                   fvmr->fmr->x_resolution, fvmr->fmr->y_resolution,
-                   x, y,
+        lfs2nist_minutia_XYT(&nx, &ny, &nt, minutia, geo->ew, geo->eh);
+        convert_xy((unsigned short) geo->iw, (unsigned short) geo->ih, res, res,
+                   (unsigned short) sround(nx * geo->xscale * 100.0 / geo->ippmm),
+                   (unsigned short) sround(ny * geo->yscale * 100.0 / geo->ippmm),
                    &fmd->x_coord, &fmd->y_coord);
-
-        memcpy(buf, &field->subfields[subfield]->items[1]->value[8], 3);
-        buf[3] = '\0';
-        convert_theta(strtoul(buf, (char **) NULL, 10), &fmd->angle);
-
-        q = (unsigned short) strtoul(
-                (char *) field->subfields[subfield]->items[2]->value,
-                (char **) NULL, 10);
-        convert_quality(q, &fmd->quality);
-
-        convert_type(field->subfields[subfield]->items[3]->value[0],
-                     &fmd->type);
-
-        /* Ridge count data is stored as items 5 .. num_items in
-         * 'second-index,count' format. The first index is stored
-         * in the first item of the field.
-         */
-        if (field->subfields[subfield]->num_items > 4) {
-            if (have_fedb == 0) {
-                if (new_fedb(FMR_STD_ANSI, &fedb) != 0)
-                    ALLOC_ERR_OUT("Extended Data Block");
-                have_fedb = 1;
-            }
-            /* The FEDB length does NOT include the
-             * block length field itself, so we add the
-             * the new ridge count data block length only.
-             */
-            if (have_rcdb == 0) {
-                if (new_fed(FMR_STD_ANSI, &fed, FED_RIDGE_COUNT,
-                            FED_HEADER_LENGTH) != 0)
-                    ALLOC_ERR_EXIT("Extended Data record");
-                have_rcdb = 1;
-                fed->length += RIDGE_COUNT_HEADER_LENGTH;
-                // XXX Set fed->rcdb->method
-            }
-
-            for (item = 4;
-                 item < field->subfields[subfield]->num_items;
-                 item++) {
-                char *c;
-                if (new_rcd(&rcd) != 0)
-                    ALLOC_ERR_EXIT("Ridge Count Data");
-                rcd->index_one = (unsigned short) strtoul(
-                        (char *) field->subfields[subfield]->items[0]->value,
-                        (char **) NULL, 10);
-                c = strtok(
-                        (char *) field->subfields[subfield]->items[item]->value,
-                        ",");
-                rcd->index_two = (unsigned short) strtoul(c,
-                                                          (char **) NULL, 10);
-                c = strtok(NULL, ",");
-                rcd->count = (unsigned short) strtoul(c,
-                                                      (char **) NULL, 10);
-                fed->length += RIDGE_COUNT_DATA_LENGTH;
-                add_rcd_to_rcdb(rcd, fed->rcdb);
-            }
-        }
+        convert_theta((unsigned int) nt, &fmd->angle);
+        convert_quality(sround(minutia->reliability * 100.0), &fmd->quality);
+        convert_type(minutia->type, &fmd->type);
         add_fmd_to_fvmr(fmd, fvmr);
+
+        if (add_ridge_counts(&ctx->arena, fvmr, &rc_fed, minutia, i, num) != 0)
+            ERR_OUT("adding ridge counts");
     }
-    if (have_rcdb) {
-        fedb->block_length += fed->length;
-        add_fed_to_fedb(fed, fedb);
+    if (rc_fed != NULL)
+        fvmr->extended->block_length += rc_fed->length;
+
+    lfmr->num_views++;
+    lfmr->record_length += FVMR_HEADER_LENGTH +
+                           (FMD_DATA_LENGTH * fvmr->number_of_minutiae);
+    if (fvmr->extended != NULL)
+        lfmr->record_length += FEDB_HEADER_LENGTH +
+                               fvmr->extended->block_length;
+    // Several views can outgrow the 2-byte length of the small header.
+    if (lfmr->record_length_type == FMR_ANSI_SMALL_HEADER_TYPE && lfmr->record_length > 0xFFFF) {
+        lfmr->record_length_type = FMR_ANSI_LARGE_HEADER_TYPE;
+        lfmr->record_length += FMR_ANSI_LARGE_HEADER_LENGTH - FMR_ANSI_SMALL_HEADER_LENGTH;
     }
-
-    /* There is only one extended data block per FVMR */
-    if (have_fedb)
-        add_fedb_to_fvmr(fedb, fvmr);
-
     return 0;
 
     err_out:
-    //XXX free memory for FEDs, FEDBs, RCDBs
     return -1;
 }
 
-void ansi2fmr(ANSI_NIST *ansi_nist, struct finger_minutiae_record **fmr, struct finger_view_minutiae_record **fvmr,
-              int ppi) {
-
-    FIELD *field;
-    int i;
-    int idc;
-    int idx;
-
-    for (i = 1; i < ansi_nist->num_records; i++) {
-        if (ansi_nist->records[i]->type == TYPE_9_ID) {
-
-            /*** Image designation character   ***/
-            if (lookup_ANSI_NIST_field(&field, &idx, IDC_ID,
-                                       ansi_nist->records[i]) == FALSE)
-                ERR_OUT("IDC field not found");
-            idc = strtol((char *) field->subfields[0]->items[0]->value,
-                         NULL, 10);
-
-            if (new_fmr(FMR_STD_ANSI, fmr) != 0)
-                ALLOC_ERR_EXIT("FMR");
-
-            if (init_fmr(*fmr, ansi_nist, idc) != 0)
-                ERR_OUT("Initializing FMR");
-
-            if (new_fvmr(FMR_STD_ANSI, fvmr) != 0)
-                ALLOC_ERR_EXIT("FVMR");
-            add_fvmr_to_fmr(*fvmr, *fmr);
-
-            if (init_fvmr(*fvmr, ansi_nist->records[i]) != 0)
-                ERR_OUT("Could not convert Type-9 record");
-
-            (*fmr)->x_resolution = ppi;
-            (*fmr)->y_resolution = ppi;
-            (*fmr)->num_views++;
-            (*fmr)->record_length += FVMR_HEADER_LENGTH +
-                                     (FMD_DATA_LENGTH * (*fvmr)->number_of_minutiae);
-            if ((*fvmr)->extended != NULL)
-                (*fmr)->record_length += FEDB_HEADER_LENGTH +
-                                         (*fvmr)->extended->block_length;
-        }
-    }
-    return;
-
-    err_out:
-    exit(EXIT_FAILURE);
-}
-
-
+// Build an ANSI FMR with a single view, of unknown finger position.
 static int
-create_type1(RECORD **anrecord) {
-    ITEM *item = NULL;
-    SUBFIELD *subfield = NULL;
-    FIELD *field = NULL;
-    RECORD *lrecord;    // For local convenience
-    char buf[32];
-    char *date_str;
-    time_t tod;
-    struct tm *tm;
-
-    if (new_ANSI_NIST_record(anrecord, TYPE_1_ID) != 0)
-        ALLOC_ERR_EXIT("Type-1 Record");
-
-    lrecord = *anrecord;
-
-    /*** 1.001 Logical record length ***/
-    // Set the length to 0 for now; it will be updated when the record
-    // is closed
-    APPEND_TYPE1_FIELD(lrecord, LEN_ID, "0");
-
-    /*** 1.002 - Version number ***/
-    snprintf(buf, sizeof(buf), "%04d", VERSION_0300);
-    APPEND_TYPE1_FIELD(lrecord, VER_ID, buf);
-
-    /*** 1.003 - File content ***/
-    snprintf(buf, sizeof(buf), "%d", TYPE_1_ID);
-    // Allocate a new subfield and set the first item
-    if (value2subfield(&subfield, buf) != 0)
-        ERR_OUT("allocating Type-1 subfield");
-    // Add the second item to the subfield, the count of remaining records
-    if (value2item(&item, "0") != 0)
-        ERR_OUT("allocating Type-1 item");
-    if (append_ANSI_NIST_subfield(subfield, item) != 0)
-        ERR_OUT("appending Type-1 item");
-    // Add the subfield to the field
-    if (new_ANSI_NIST_field(&field, TYPE_1_ID, CNT_ID) != 0)
-        ERR_OUT("allocating Type-1 field");
-    if (append_ANSI_NIST_field(field, subfield) != 0)
-        ERR_OUT("appending Type-1 subfield");
-
-    // Add the entire field to the record
-    if (append_ANSI_NIST_record(lrecord, field) != 0)
-        ERR_OUT("appending Type-1 field");
-
-    /*** 1.004 - Type of transaction ***/
-    APPEND_TYPE1_FIELD(lrecord, 4, "LFFS");
-
-    /*** 1.005 - Date ***/
-    if (get_ANSI_NIST_date(&date_str) != 0)
-        ERR_OUT("getting ANSI/NIST date");
-    APPEND_TYPE1_FIELD(lrecord, DAT_ID, date_str);
-    free(date_str);
-
-    /*** 1.007 - Destination agency identifier ***/
-    APPEND_TYPE1_FIELD(lrecord, 7, "ANSI/NIST");
-
-    /*** 1.008 - Originating agency identifier ***/
-    APPEND_TYPE1_FIELD(lrecord, 8, "M1/FMR");
-
-    /*** 1.009 - Transaction control number ***/
-    // Use the current UTC time string YYYYMMDDHHMMSS
-    tod = time(NULL);
-    tm = gmtime(&tod);
-    snprintf(buf, sizeof(buf), "%04d%02d%02d%02d%02d%02d",
-             tm->tm_year + 1900, tm->tm_mon + 1, tm->tm_mday, tm->tm_hour,
-             tm->tm_min, tm->tm_sec);
-
-    APPEND_TYPE1_FIELD(lrecord, 9, buf);
-
-    /*** 1.011 - Native scanning resolution ***/
-    // XXX Set the NSR to the minimum, but we may want to base this
-    // XXX value on something from the FMR
-    snprintf(buf, sizeof(buf), "%5.2f", MIN_RESOLUTION);
-    APPEND_TYPE1_FIELD(lrecord, 11, buf);
-
-    /*** 1.012 - Nominal transmitting resolution ***/
-    APPEND_TYPE1_FIELD(lrecord, 12, buf);
-
-    if (update_ANSI_NIST_tagged_record_LEN(lrecord) != 0)
-        ERR_OUT("updating record length");
-
+lfs2fmr(bc_context *ctx, MINUTIAE *minutiae, const bc_geometry *geo, int ippi,
+        struct finger_minutiae_record **fmr) {
+    struct finger_minutiae_record *lfmr;
+
+    if (new_ansi_fmr(ctx, geo->iw, geo->ih, ippi, geo->ippmm, &lfmr) != 0)
+        ALLOC_ERR_OUT("FMR");
+    // LFS does not know the finger position.
+    if (add_lfs_view(ctx, lfmr, minutiae, geo, 0, 0) != 0)
+        return -1;
+    *fmr = lfmr;
     return 0;
 
     err_out:
-    fprintf(stderr, "Error creating Type-1 record\n");
-    if (item != NULL)
-        free_ANSI_NIST_item(item);
-    if (subfield != NULL)
-        free_ANSI_NIST_subfield(subfield);
-    if (field != NULL)
-        free_ANSI_NIST_field(field);
-    if (lrecord != NULL)
-        free_ANSI_NIST_record(lrecord);
-
     return -1;
 }
 
-int scan_and_decode_image(unsigned char *idata, int ilen, int *oimg_type,
+/*
+ * Decode an image of any supported format with the decoder settings of ctx.
+ * The image is *ow x *oh; the pixels returned are *opw x *oph, smaller when
+ * a decoder that scales while decoding (libjpeg-turbo, OpenJPEG) brought
+ * them closer to BC_OPT_TARGET_PPI or was told to reduce.
+ */
+int scan_and_decode_image(const bc_context *ctx, unsigned char *idata, int ilen, int *oimg_type,
                           unsigned char **odata, int *olen,
-                          int *ow, int *oh, int *od, int *oppi) {
+                          int *ow, int *oh, int *od, int *oppi, int *opw, int *oph) {
     int ret, i;
+    int pw = 0, ph = 0;
     unsigned char *ndata;
     int img_type, nlen;
     int w, h, d, ppi, lossyflag, intrlvflag = 0, n_cmpnts;
@@ -690,14 +452,17 @@ int scan_and_decode_image(unsigned char *idata, int ilen, int *oimg_type,
             *oppi = -1;
             return (0);
         case WSQ_IMG:
-            if ((ret = wsq_decode_mem(&ndata, &w, &h, &d, &ppi, &lossyflag,
-                                      idata, ilen))) {
+            if ((ret = bc_wsq_decode(idata, ilen, &ndata, &w, &h, &ppi))) {
                 return (ret);
             }
+            d = 8;
             nlen = w * h;
             break;
         case JPEGL_IMG:
-            if ((ret = jpegl_decode_mem(&img_dat, &lossyflag, idata, ilen))) {
+            pthread_mutex_lock(&jpegl_lock);
+            ret = jpegl_decode_mem(&img_dat, &lossyflag, idata, ilen);
+            pthread_mutex_unlock(&jpegl_lock);
+            if (ret) {
                 return (ret);
             }
             if ((ret = get_IMG_DAT_image(&ndata, &nlen, &w, &h, &d, &ppi,
@@ -708,10 +473,18 @@ int scan_and_decode_image(unsigned char *idata, int ilen, int *oimg_type,
             free_IMG_DAT(img_dat, FREE_IMAGE);
             break;
         case JPEGB_IMG:
+#ifdef BC_TURBOJPEG
+            if ((ret = bc_jpeg_decode(idata, ilen, ctx->target_ppi, &ndata, &w, &h, &d, &ppi, &pw, &ph))) {
+                return (ret);
+            }
+            nlen = pw * ph * (d >> 3);
+            break;
+#else
             if ((ret = jpegb_decode_mem(&ndata, &w, &h, &d, &ppi, &lossyflag,
                                         idata, ilen))) {
                 return (ret);
             }
+#endif
             if (d == 8) {
                 n_cmpnts = 1;
                 intrlvflag = 0;
@@ -722,7 +495,7 @@ int scan_and_decode_image(unsigned char *idata, int ilen, int *oimg_type,
                 fprintf(stderr, "ERROR : read_and_decode_image : ");
                 fprintf(stderr, "JPEGB decoder returned d=%d ", d);
                 fprintf(stderr, "not equal to 8 or 24\n");
-                free(idata);
+                free(ndata);
                 return (-2);
             }
             nlen = w * h * (d >> 3);
@@ -744,10 +517,21 @@ int scan_and_decode_image(unsigned char *idata, int ilen, int *oimg_type,
                 fprintf(stderr, "ERROR : read_and_decode_image : ");
                 fprintf(stderr, "IHead decoder returned d=%d ", d);
                 fprintf(stderr, "not equal to {1,8,24}\n");
+                free(ndata);
                 return (-2);
             }
             break;
         case JP2_IMG:
+            // The NBIS decoder stays the default; threads and reduced
+            // resolutions need OpenJPEG's own settings.
+            if (ctx->jp2_threads > 1 || ctx->jp2_reduce > 0 || ctx->target_ppi > 0) {
+                if ((ret = bc_jp2_decode(idata, ilen, ctx->jp2_threads, ctx->jp2_reduce, ctx->target_ppi,
+                                         &ndata, &w, &h, &d, &ppi, &pw, &ph))) {
+                    return (ret);
+                }
+                nlen = pw * ph * (d >> 3);
+                break;
+            }
             if ((ret = openjpeg2k_decode_mem(&img_dat, &lossyflag, idata, ilen))) {
                 return (ret);
             }
@@ -784,138 +568,137 @@ int scan_and_decode_image(unsigned char *idata, int ilen, int *oimg_type,
     *oh = h;
     *od = d;
     *oppi = ppi;
+    *opw = pw > 0 ? pw : w;
+    *oph = ph > 0 ? ph : h;
 
     return (0);
 }
 
 
-void read_image(unsigned char *indata, int ilen,
-                unsigned char **odata, int *olen,
-                int *img_type,
-                int *iw, int *ih, int *id, int *ippi,
-                double *ippmm) {
-
-    if (scan_and_decode_image(indata, ilen, img_type, odata, olen, iw, ih, id, ippi) != 0)
-        ERR_EXIT("cannot open input image file");
-
-    if (*ippi == UNDEFINED)
-        *ippmm = DEFAULT_PPI / (double) MM_PER_INCH;
-    else
-        *ippmm = *ippi / (double) MM_PER_INCH;
-}
-
-void read_minutiae_to_ansi_fmr(unsigned char *idata, int iw, int ih, int id, int ippi, double ippmm,
-                               struct finger_minutiae_record **fmr, struct finger_view_minutiae_record **fvmr) {
-    unsigned char *bdata;
-    int bw, bh, bd;
-    int *direction_map, *low_contrast_map, *low_flow_map;
-    int *high_curve_map, *quality_map;
-    int map_w, map_h;
-
-    MINUTIAE *minutiae;
+int read_image(const bc_context *ctx, unsigned char *indata, int ilen,
+               unsigned char **odata, int *olen,
+               int *img_type,
+               int *iw, int *ih, int *id, int *ippi, int *ipw, int *iph) {
 
-    if (get_minutiae(&minutiae, &quality_map, &direction_map,
-                     &low_contrast_map, &low_flow_map, &high_curve_map,
-                     &map_w, &map_h, &bdata, &bw, &bh, &bd,
-                     idata, iw, ih, id, ippmm, &lfsparms_V2) != 0) {
-        ERR_EXIT("cannot read minutiae");
+    if (scan_and_decode_image(ctx, indata, ilen, img_type, odata, olen, iw, ih, id, ippi, ipw, iph) != 0) {
+        fprintf(stderr, "cannot decode input image\n");
+        return BC_ERR_DECODE;
     }
-
-    ANSI_NIST *ansi_nist;
-    RECORD *type1;
-    int img_idc, img_imp = 0;
-
-    if (alloc_ANSI_NIST(&ansi_nist) != 0)
-        ALLOC_ERR_EXIT("AN2K record");
-
-    create_type1(&type1);
-    if (update_ANSI_NIST(ansi_nist, type1) != 0)
-        ALLOC_ERR_EXIT("inserting Type-1 Record");
-
-    if (update_ANSI_NIST_lfs_results(ansi_nist, minutiae, bdata, bw, bh, bd, ippmm, img_idc, img_imp) != 0) {
-        free_minutiae(minutiae);
-        free(bdata);
-        ERR_EXIT("could not create ANSI record from minutiae");
+    if (*img_type == UNKNOWN_IMG) {
+        fprintf(stderr, "unknown input image format\n");
+        return BC_ERR_DECODE;
     }
-
-    free_minutiae(minutiae);
-    free(bdata);
-
-
-    if (new_fmr(FMR_STD_ANSI, fmr) != 0)
-        ALLOC_ERR_EXIT("FMR");
-    if (new_fvmr(FMR_STD_ANSI, fvmr) != 0)
-        ALLOC_ERR_EXIT("FVMR");
-    add_fvmr_to_fmr(*fvmr, *fmr);
-
-    ansi2fmr(ansi_nist, fmr, fvmr, ippi);
-    free_ANSI_NIST(ansi_nist);
+    return BC_OK;
 }
 
-void convert_ansi2iso(struct finger_minutiae_record **fmr, struct finger_view_minutiae_record **fvmr, int ippi) {
-    struct finger_minutiae_record *ofmr;
-    struct finger_view_minutiae_record *ofvmr;
-
-    if (new_fmr(FMR_STD_ISO, &ofmr) != 0)
-        ALLOC_ERR_EXIT("FMR");
-    if (new_fvmr(FMR_STD_ISO, &ofvmr) != 0)
-        ALLOC_ERR_EXIT("FVMR");
-    add_fvmr_to_fmr(ofvmr, ofmr);
+/*
+ * Reduce interleaved 24-bit RGB to 8-bit luma in the context's arena, using
+ * fixed-point BT.601 weights.
+ */
+static int
+rgb_to_gray(bc_context *ctx, const unsigned char *rgb, int w, int h, unsigned char **gray) {
+    size_t n;
+    unsigned char *g;
 
-    COPY_FMR((*fmr), ofmr);
-    ofmr->record_length = FMR_ISO_HEADER_LENGTH;
-    ofmr->record_length_type = FMR_ISO_HEADER_TYPE;
+    n = (size_t) w * h;
+    if ((g = (unsigned char *) bc_arena_alloc(&ctx->arena, n)) == NULL)
+        ALLOC_ERR_OUT("grayscale buffer");
+    bc_rgb_to_gray(rgb, g, n);
 
-    unsigned int fmr_len;
-    ansi2iso_fvmr(*fvmr, ofvmr, &fmr_len, ippi, ippi);
-    ofmr->record_length = fmr_len;
+    *gray = g;
+    return 0;
 
-    *fmr = ofmr;
-    *fvmr = ofvmr;
+    err_out:
+    return -1;
 }
 
-void convert_ansi2iso_c(struct finger_minutiae_record **fmr, struct finger_view_minutiae_record **fvmr, int ippi) {
-    struct finger_minutiae_record *ofmr;
-    struct finger_view_minutiae_record *ofvmr;
-
-    if (new_fmr(FMR_STD_ISO_NORMAL_CARD, &ofmr) != 0)
-        ALLOC_ERR_EXIT("FMR");
-    if (new_fvmr(FMR_STD_ISO_NORMAL_CARD, &ofvmr) != 0)
-        ALLOC_ERR_EXIT("FVMR");
-    add_fvmr_to_fmr(ofvmr, ofmr);
-
-    COPY_FMR((*fmr), ofmr);
-    ofmr->record_length = FMR_ISO_HEADER_LENGTH;
-    ofmr->record_length_type = FMR_ISO_HEADER_TYPE;
-
-    unsigned int fmr_len;
-    ansi2iso_fvmr(*fvmr, ofvmr, &fmr_len, ippi, ippi);
-    ofmr->record_length = fmr_len;
-
-    *fmr = ofmr;
-    *fvmr = ofvmr;
+/*
+ * Set up the geometry of a w x h image at ppi (UNDEFINED if unknown),
+ * decoded to pw x ph pixels. With a target resolution, pixels at least 10%
+ * above it are detected on a copy scaled down to the target; unknown
+ * resolutions are left alone.
+ */
+static void
+plan_geometry(int target_ppi, int w, int h, int ppi, int pw, int ph, bc_geometry *geo) {
+    int pppi;
+
+    geo->iw = w;
+    geo->ih = h;
+    geo->pw = geo->ew = pw;
+    geo->ph = geo->eh = ph;
+    geo->ippmm = (ppi == UNDEFINED ? DEFAULT_PPI : ppi) / (double) MM_PER_INCH;
+    geo->xscale = (double) w / pw;
+    geo->yscale = (double) h / ph;
+    geo->eppmm = geo->ippmm / geo->xscale;
+    if (target_ppi <= 0 || ppi == UNDEFINED)
+        return;
+    pppi = (int) ((long long) ppi * pw / w);
+    if (pppi * 10 < target_ppi * 11)
+        return;
+    geo->ew = (int) ((long long) pw * target_ppi / pppi);
+    geo->eh = (int) ((long long) ph * target_ppi / pppi);
+    if (geo->ew < 1 || geo->eh < 1) {
+        geo->ew = pw;
+        geo->eh = ph;
+        return;
+    }
+    if (geo->ew == pw / 2 && geo->eh == ph / 2 && pw == w && ph == h) {
+        geo->xscale = geo->yscale = 2.0;
+    } else {
+        geo->xscale = (double) w / geo->ew;
+        geo->yscale = (double) h / geo->eh;
+    }
+    geo->eppmm = geo->ippmm / geo->xscale;
 }
 
-void convert_ansi2iso_cc(struct finger_minutiae_record **fmr, struct finger_view_minutiae_record **fvmr, int ippi) {
-    struct finger_minutiae_record *ofmr;
-    struct finger_view_minutiae_record *ofvmr;
-
-    if (new_fmr(FMR_STD_ISO_COMPACT_CARD, &ofmr) != 0)
-        ALLOC_ERR_EXIT("FMR");
-    if (new_fvmr(FMR_STD_ISO_COMPACT_CARD, &ofvmr) != 0)
-        ALLOC_ERR_EXIT("FVMR");
-    add_fvmr_to_fmr(ofvmr, ofmr);
+// Scale the decoded pixels down to the detection size of geo; dst holds
+// ew * eh bytes.
+static int
+downsample(const unsigned char *pixels, const bc_geometry *geo, unsigned char *dst) {
+    // 2:1, typically 1000 to 500 ppi, has a vectorized kernel.
+    if (geo->ew == geo->pw / 2 && geo->eh == geo->ph / 2) {
+        bc_halve(pixels, geo->pw, geo->ph, dst);
+        return 0;
+    }
+    return bc_resample_area(pixels, geo->pw, geo->ph, dst, geo->ew, geo->eh);
+}
 
-    COPY_FMR((*fmr), ofmr);
-    ofmr->record_length = FMR_ISO_HEADER_LENGTH;
-    ofmr->record_length_type = FMR_ISO_HEADER_TYPE;
+// Detect minutiae on the ew x eh detection image of geo with the context's
+// thread and cropping settings.
+static int
+detect_minutiae(MINUTIAE **minutiae, unsigned char *idata, const bc_geometry *geo, int extract_threads,
+                int crop, bc_arena *scratch) {
+    if (crop)
+        return get_minutiae_cropped(minutiae, idata, geo->ew, geo->eh, geo->eppmm, extract_threads, scratch);
+    return get_minutiae_only(minutiae, idata, geo->ew, geo->eh, geo->eppmm, extract_threads, scratch);
+}
 
-    unsigned int fmr_len;
-    ansi2isocc_fvmr(*fvmr, ofvmr, &fmr_len, ippi, ippi);
-    ofmr->record_length = fmr_len;
+// Detect minutiae on idata, the ew x eh detection image of geo.
+static int
+read_minutiae_to_ansi_fmr(bc_context *ctx, unsigned char *idata, const bc_geometry *geo, int id, int ippi,
+                          struct finger_minutiae_record **fmr) {
+    MINUTIAE *minutiae = NULL;
+    long long start = stats_clock(ctx);
+    int retval = BC_ERR_EXTRACT;
+
+    if (id != 8)
+        ERR_OUT("minutiae detection needs 8-bit grayscale, got %d bits", id);
+    if (detect_minutiae(&minutiae, idata, geo, ctx->extract_threads, ctx->crop, &ctx->arena) != 0)
+        ERR_OUT("cannot read minutiae");
+    STATS_STAGE(ctx, extract_ns, start);
+    STATS_SET(ctx, minutiae, minutiae->num);
+
+    retval = BC_ERR_FORMAT;
+    start = stats_clock(ctx);
+    if (lfs2fmr(ctx, minutiae, geo, ippi, fmr) != 0)
+        ERR_OUT("could not create FMR from minutiae");
+    STATS_STAGE(ctx, build_ns, start);
+    retval = BC_OK;
 
-    *fmr = ofmr;
-    *fvmr = ofvmr;
+    err_out:
+    if (minutiae != NULL)
+        free_minutiae(minutiae);
+    return retval;
 }
 
 static int
@@ -947,6 +730,7 @@ copy_without_conversion(FMR *ifmr, FMR *ofmr, int fmr_type) {
             COPY_FVMR(ifvmrs[r], ofvmr);
             mcount = get_fmd_count(ifvmrs[r]);
             if (mcount != 0) {
+                free(ifmds);
                 ifmds = (FMD **) malloc(mcount * sizeof(FMD *));
                 if (ifmds == NULL)
                     ALLOC_ERR_RETURN("FMD array");
@@ -1020,6 +804,16 @@ copy_with_conversion(FMR *ifmr, FMR *ofmr, int in_type, int out_type) {
             fmr_len = FMR_ISO_HEADER_LENGTH;
             ver = FMR_ISO_SPEC_VERSION;
             break;
+        case FMR_STD_ISO_NORMAL_CARD:
+        case FMR_STD_ISO_COMPACT_CARD:
+            /* Card formats carry neither a record header nor an
+             * extended data block.
+             */
+            fmr_len = 0;
+            ver = FMR_ISO_SPEC_VERSION;
+            break;
+        default:
+            ERR_OUT("Invalid output type");
     }
 
     /* Fix up the output FMR header for those input types that don't
@@ -1101,7 +895,9 @@ copy_with_conversion(FMR *ifmr, FMR *ofmr, int in_type, int out_type) {
             ofvmr->extended = NULL;
             add_fvmr_to_fmr(ofvmr, ofmr);
 
-            fmr_len += FEDB_HEADER_LENGTH;
+            if ((out_type != FMR_STD_ISO_NORMAL_CARD) &&
+                (out_type != FMR_STD_ISO_COMPACT_CARD))
+                fmr_len += FEDB_HEADER_LENGTH;
         }
 
     } else {
@@ -1120,114 +916,1074 @@ copy_with_conversion(FMR *ifmr, FMR *ofmr, int in_type, int out_type) {
 }
 
 
-int img2fmr(unsigned char *idata, int ilen, char *otype, unsigned char **odata, int *olen) {
-
-    unsigned char *imdata;
-    int img_len;
-    int img_type;
-    int iw, ih, id, ippi;
-    double ippmm;
+static int
+str_to_type(char *stdstr) {
+    if (strcmp(stdstr, "ANSI") == 0)
+        return (FMR_STD_ANSI);
+    if (strcmp(stdstr, "ISO") == 0)
+        return (FMR_STD_ISO);
+    if ((strcmp(stdstr, "ISONC") == 0) || (strcmp(stdstr, "ISOC") == 0))
+        return (FMR_STD_ISO_NORMAL_CARD);
+    if (strcmp(stdstr, "ISOCC") == 0)
+        return (FMR_STD_ISO_COMPACT_CARD);
+    return (-1);
+}
 
-    read_image(idata, ilen, &imdata, &img_len, &img_type,
-               &iw, &ih, &id, &ippi, &ippmm);
+/*
+ * Destination of a serialized record: either a buffer allocated here and
+ * handed to the caller (odata), or a caller-provided buffer (obuf/osize).
+ */
+typedef struct {
+    unsigned char **odata;
+    unsigned char *obuf;
+    int osize;
+    int *olen;
+} bc_output;
 
-    struct finger_minutiae_record *fmr;
-    struct finger_view_minutiae_record *fvmr;
-    read_minutiae_to_ansi_fmr(idata, iw, ih, id, ippi, ippmm, &fmr, &fvmr);
+/*
+ * Pick the buffer a record of len bytes is written to: a new one handed to
+ * the caller, the caller's own if it fits, or else the context's result
+ * buffer, for bc_result_copy() to pick up, with BC_ERR_BUFFER_TOO_SMALL.
+ */
+static int
+output_buffer(bc_context *ctx, bc_output *out, int len, unsigned char **buf) {
+    unsigned char *result;
 
-    if (strcmp(otype, "ISO") == 0) {
-        convert_ansi2iso(&fmr, &fvmr, ippi);
+    if (out->odata != NULL) {
+        if ((*buf = (unsigned char *) malloc(len)) == NULL)
+            ALLOC_ERR_OUT("FMR output buffer");
+        return BC_OK;
     }
-    if (strcmp(otype, "ISONC") == 0) {
-        convert_ansi2iso_c(&fmr, &fvmr, ippi);
+    if (out->obuf != NULL && out->osize >= len) {
+        *buf = out->obuf;
+        return BC_OK;
     }
-    if (strcmp(otype, "ISOCC") == 0) {
-        convert_ansi2iso_cc(&fmr, &fvmr, ippi);
+    if (ctx->result_size < (size_t) len) {
+        if ((result = (unsigned char *) realloc(ctx->result, len)) == NULL)
+            ALLOC_ERR_OUT("FMR result buffer");
+        ctx->result = result;
+        ctx->result_size = len;
     }
+    *buf = ctx->result;
+    return BC_ERR_BUFFER_TOO_SMALL;
+
+    err_out:
+    return BC_ERR_MEMORY;
+}
+
+// Report a record written to the buffer output_buffer() picked.
+static void
+finish_output(bc_context *ctx, bc_output *out, unsigned char *buf, int len, int ret) {
+    if (out->odata != NULL)
+        *out->odata = buf;
+    if (ret == BC_ERR_BUFFER_TOO_SMALL)
+        ctx->result_len = len;
+    *out->olen = len;
+}
+
+/*
+ * Serialize an FMR to its destination. The record length was summed up
+ * while the record was built, so it is the exact serialized size.
+ */
+static int
+emit_fmr(bc_context *ctx, FMR *fmr, bc_output *out) {
+    unsigned char *buf;
+    BDB bdb;
+    int len = (int) fmr->record_length;
+    long long start = stats_clock(ctx);
+    int ret;
 
-    uint8_t *buf;
-    BDB *bdb;
-    buf = (uint8_t *) malloc(fmr->record_length);
-    bdb = (BDB *) malloc(sizeof(BDB));
-    INIT_BDB(bdb, buf, fmr->record_length);
+    if ((ret = output_buffer(ctx, out, len, &buf)) == BC_ERR_MEMORY)
+        return ret;
+    INIT_BDB(&bdb, buf, len);
 
-    if (push_fmr(bdb, fmr) != WRITE_OK) {
+    if (push_fmr(&bdb, fmr) != WRITE_OK) {
+        if (out->odata != NULL)
+            free(buf);
         fprintf(stderr, "could not push FMR\n");
-        exit(EXIT_FAILURE);
+        return BC_ERR_WRITE;
     }
 
-    *odata = bdb->bdb_start;
-    *olen = bdb->bdb_size;
+    finish_output(ctx, out, buf, len, ret);
+    STATS_STAGE(ctx, serialize_ns, start);
+    STATS_ADD(ctx, bytes_allocated, len);
+    return ret;
+}
 
-    return 0;
+typedef struct {
+    bc_context *ctx;
+    bc_output *out;
+} bc_cache_hit;
+
+// Copy a cached record to the call's destination.
+static int
+emit_cached(void *arg, const unsigned char *data, int len) {
+    bc_cache_hit *hit = (bc_cache_hit *) arg;
+    unsigned char *buf;
+    int ret;
+
+    if ((ret = output_buffer(hit->ctx, hit->out, len, &buf)) == BC_ERR_MEMORY)
+        return ret;
+    memcpy(buf, data, len);
+    finish_output(hit->ctx, hit->out, buf, len, ret);
+    return ret;
 }
 
+/*
+ * Serve a call from the context's cache. Returns 1 with *ret set on a hit;
+ * on a miss the caller converts and stores the result with cache_result().
+ */
 static int
-str_to_type(char *stdstr) {
-    if (strcmp(stdstr, "ANSI") == 0)
-        return (FMR_STD_ANSI);
-    if (strcmp(stdstr, "ISO") == 0)
-        return (FMR_STD_ISO);
-    if (strcmp(stdstr, "ISONC") == 0)
-        return (FMR_STD_ISO_NORMAL_CARD);
-    if (strcmp(stdstr, "ISOCC") == 0)
-        return (FMR_STD_ISO_COMPACT_CARD);
-    return (-1);
+cache_lookup(bc_context *ctx, const bc_cache_key *key, bc_output *out, int *ret) {
+    bc_cache_hit hit = {ctx, out};
+
+    return bc_cache_get(ctx->cache, key, emit_cached, &hit, ret);
 }
 
-int fmr2fmr(unsigned char *idata, int ilen, unsigned char **odata, int *olen,
-            char *in_type_str, char *out_type_str) {
-    fmr2fmr_iso_card(idata, ilen, odata, olen, in_type_str, out_type_str, 0, 0);
+static void
+cache_result(bc_context *ctx, const bc_cache_key *key, bc_output *out, int ret) {
+    const unsigned char *data;
+
+    if (ret == BC_OK)
+        data = out->odata != NULL ? *out->odata : out->obuf;
+    else if (ret == BC_ERR_BUFFER_TOO_SMALL)
+        data = ctx->result;
+    else
+        return;
+    bc_cache_put(ctx->cache, key, data, *out->olen);
 }
 
-int fmr2fmr_iso_card(unsigned char *idata, int ilen, unsigned char **odata, int *olen,
-                     char *in_type_str, char *out_type_str, int iso_c_xres, int iso_c_yres) {
+/*
+ * Convert a record to another format. The converted record is built by
+ * biomdi and released with free_fmr(); the input is left alone.
+ */
+static int
+convert_fmr(FMR *ifmr, FMR **fmr, int in_type, int out_type) {
+    FMR *ofmr;
+    int ret;
 
-    BDB *rbdb;
-    rbdb = (BDB *) malloc(sizeof(BDB));
-    INIT_BDB(rbdb, idata, ilen);
+    if (new_fmr(out_type, &ofmr) != 0)
+        ALLOC_ERR_OUT("Output FMR");
 
-    struct finger_minutiae_record *ifmr;
-    struct finger_minutiae_record *ofmr;
+    /* If the input and output file types are the same,
+     * do a straight copy.
+     */
+    if (in_type == out_type)
+        ret = copy_without_conversion(ifmr, ofmr, in_type);
+    else
+        ret = copy_with_conversion(ifmr, ofmr, in_type, out_type);
+    if (ret != 0) {
+        free_fmr(ofmr);
+        ERR_OUT("converting FMR");
+    }
+
+    *fmr = ofmr;
+    return BC_OK;
+
+    err_out:
+    return BC_ERR_FORMAT;
+}
+
+bc_context *bc_context_create(void) {
+    bc_context *ctx;
 
-    if (scan_fmr(rbdb, ifmr) != READ_OK) {
-        fprintf(stderr, "Could not read FMR from file.\n");
-        exit(EXIT_FAILURE);
+    ctx = (bc_context *) calloc(1, sizeof(bc_context));
+    if (ctx == NULL) {
+        fprintf(stderr, "could not allocate converter context\n");
+        return NULL;
     }
+    bc_arena_init(&ctx->arena);
+    return ctx;
+}
+
+void bc_context_destroy(bc_context *ctx) {
+    if (ctx == NULL)
+        return;
+    bc_arena_release(&ctx->arena);
+    free(ctx->result);
+    free(ctx);
+}
 
-    int in_type = str_to_type(in_type_str);
-    int out_type = str_to_type(out_type_str);
+int bc_context_set_option(bc_context *ctx, int option, int value) {
+    if (ctx == NULL)
+        return BC_ERR_ARGUMENT;
+    switch (option) {
+        case BC_OPT_THREADS:
+            if (value < 0)
+                return BC_ERR_ARGUMENT;
+            ctx->threads = value;
+            break;
+        case BC_OPT_EXTRACT_THREADS:
+            if (value < 0)
+                return BC_ERR_ARGUMENT;
+            ctx->extract_threads = value;
+            break;
+        case BC_OPT_STATS:
+            if (value != 0 && value != 1)
+                return BC_ERR_ARGUMENT;
+            ctx->stats_enabled = value;
+            break;
+        case BC_OPT_TARGET_PPI:
+            if (value < 0)
+                return BC_ERR_ARGUMENT;
+            ctx->target_ppi = value;
+            break;
+        case BC_OPT_CROP:
+            if (value != 0 && value != 1)
+                return BC_ERR_ARGUMENT;
+            ctx->crop = value;
+            break;
+        case BC_OPT_JP2_THREADS:
+            if (value < 0)
+                return BC_ERR_ARGUMENT;
+            ctx->jp2_threads = value;
+            break;
+        case BC_OPT_JP2_REDUCE:
+            if (value < 0)
+                return BC_ERR_ARGUMENT;
+            ctx->jp2_reduce = value;
+            break;
+        default:
+            return BC_ERR_ARGUMENT;
+    }
+    return BC_OK;
+}
+
+int bc_context_set_cache(bc_context *ctx, bc_cache *cache) {
+    if (ctx == NULL)
+        return BC_ERR_ARGUMENT;
+    ctx->cache = cache;
+    return BC_OK;
+}
+
+// New context with the settings of ctx, for a batch worker.
+static bc_context *
+clone_context(bc_context *ctx) {
+    bc_context *wctx;
+
+    if ((wctx = bc_context_create()) == NULL)
+        return NULL;
+    wctx->threads = ctx->threads;
+    wctx->extract_threads = ctx->extract_threads;
+    wctx->stats_enabled = ctx->stats_enabled;
+    wctx->target_ppi = ctx->target_ppi;
+    wctx->crop = ctx->crop;
+    wctx->jp2_threads = ctx->jp2_threads;
+    wctx->jp2_reduce = ctx->jp2_reduce;
+    wctx->cache = ctx->cache;
+    return wctx;
+}
+
+// Detect minutiae on pw x ph pixels decoded from a w x h image.
+static int
+raw2fmr_out(bc_context *ctx, unsigned char *pixels, int w, int h, int depth, int ppi, int pw, int ph,
+            char *otype, bc_output *out) {
+
+    unsigned char *gray, *small;
+    bc_geometry geo;
+    long long start;
+    int out_type;
+    int ret;
+    struct finger_minutiae_record *fmr, *ofmr = NULL;
+
+    if (pixels == NULL || w <= 0 || h <= 0 || pw <= 0 || ph <= 0 || otype == NULL)
+        return BC_ERR_ARGUMENT;
+    if ((out_type = str_to_type(otype)) < 0) {
+        fprintf(stderr, "unknown output type %s\n", otype);
+        return BC_ERR_ARGUMENT;
+    }
+
+    switch (depth) {
+        case 8:
+            gray = pixels;
+            break;
+        case 24:
+            if (rgb_to_gray(ctx, pixels, pw, ph, &gray) != 0) {
+                bc_arena_reset(&ctx->arena);
+                return BC_ERR_MEMORY;
+            }
+            break;
+        default:
+            fprintf(stderr, "unsupported pixel depth %d\n", depth);
+            return BC_ERR_ARGUMENT;
+    }
+
+    if (ppi <= 0)
+        ppi = UNDEFINED;
+
+    STATS_SET(ctx, width, w);
+    STATS_SET(ctx, height, h);
+    STATS_SET(ctx, depth, depth);
+    STATS_SET(ctx, ppi, ppi == UNDEFINED ? 0 : ppi);
+
+    plan_geometry(ctx->target_ppi, w, h, ppi, pw, ph, &geo);
+    if (geo.ew != pw || geo.eh != ph) {
+        start = stats_clock(ctx);
+        small = (unsigned char *) bc_arena_alloc(&ctx->arena, (size_t) geo.ew * geo.eh);
+        if (small == NULL || downsample(gray, &geo, small) != 0) {
+            ret = BC_ERR_MEMORY;
+            goto err_out;
+        }
+        gray = small;
+        STATS_STAGE(ctx, resample_ns, start);
+    }
+
+    if ((ret = read_minutiae_to_ansi_fmr(ctx, gray, &geo, 8, ppi, &fmr)) != BC_OK)
+        goto err_out;
+
+    if (out_type != FMR_STD_ANSI) {
+        start = stats_clock(ctx);
+        if ((ret = convert_fmr(fmr, &ofmr, FMR_STD_ANSI, out_type)) != BC_OK)
+            goto err_out;
+        STATS_STAGE(ctx, convert_ns, start);
+        fmr = ofmr;
+    }
+
+    ret = emit_fmr(ctx, fmr, out);
+
+    err_out:
+    if (ofmr != NULL)
+        free_fmr(ofmr);
+    STATS_ADD(ctx, bytes_allocated, (long long) ctx->arena.used);
+    // Everything the ANSI record and its scratch used goes in one step.
+    bc_arena_reset(&ctx->arena);
+    return ret;
+}
+
+static int
+img2fmr_out(bc_context *ctx, unsigned char *idata, int ilen, char *otype, bc_output *out) {
+
+    unsigned char *imdata;
+    int img_len;
+    int img_type;
+    int iw, ih, id, ippi, ipw, iph;
+    long long start;
+    int ret;
+
+    if (idata == NULL || ilen <= 0)
+        return BC_ERR_ARGUMENT;
+
+    start = stats_clock(ctx);
+    if ((ret = read_image(ctx, idata, ilen, &imdata, &img_len, &img_type,
+                          &iw, &ih, &id, &ippi, &ipw, &iph)) != BC_OK)
+        return ret;
+    STATS_STAGE(ctx, decode_ns, start);
+    STATS_ADD(ctx, bytes_allocated, img_len);
+
+    // The decoded buffer goes to extraction as is; no second decode or copy.
+    ret = raw2fmr_out(ctx, imdata, iw, ih, id, ippi, ipw, iph, otype, out);
+    free(imdata);
+    return ret;
+}
+
+static int
+fmr2fmr_out(bc_context *ctx, unsigned char *idata, int ilen,
+            char *in_type_str, char *out_type_str,
+            int iso_c_xres, int iso_c_yres, bc_output *out) {
+
+    BDB rbdb;
+    struct finger_minutiae_record *fmr, *ofmr;
+    long long start;
+    int in_type, out_type;
+    int ret;
+
+    if (idata == NULL || ilen <= 0 || in_type_str == NULL || out_type_str == NULL)
+        return BC_ERR_ARGUMENT;
+    in_type = str_to_type(in_type_str);
+    out_type = str_to_type(out_type_str);
+    if (in_type < 0 || out_type < 0) {
+        fprintf(stderr, "unknown conversion %s -> %s\n", in_type_str, out_type_str);
+        return BC_ERR_ARGUMENT;
+    }
+
+    start = stats_clock(ctx);
+    if (new_fmr(in_type, &fmr) != 0)
+        return BC_ERR_MEMORY;
+    INIT_BDB(&rbdb, idata, ilen);
+    if (scan_fmr(&rbdb, fmr) != READ_OK) {
+        fprintf(stderr, "Could not read FMR from buffer.\n");
+        free_fmr(fmr);
+        return BC_ERR_READ;
+    }
+    STATS_STAGE(ctx, parse_ns, start);
+    if (ctx->stats_enabled) {
+        FVMR *fvmr;
+        TAILQ_FOREACH(fvmr, &fmr->finger_views, list)
+            ctx->stats.minutiae += fvmr->number_of_minutiae;
+    }
 
     /* ISO card formats have no input resolution, so set it here
-	 * from the input options.
-	 */
-    unsigned short iso_xres, iso_yres;
+     * from the input options.
+     */
     if ((in_type == FMR_STD_ISO_NORMAL_CARD) ||
         (in_type == FMR_STD_ISO_COMPACT_CARD)) {
-        ifmr->x_resolution = iso_c_xres;
-        ifmr->y_resolution = iso_c_yres;
+        fmr->x_resolution = iso_c_xres;
+        fmr->y_resolution = iso_c_yres;
     }
-    /* If the input and output file types are the same,
-     * do a straight copy.
-     */
-    if (in_type == out_type)
-        copy_without_conversion(ifmr, ofmr, in_type);
+
+    start = stats_clock(ctx);
+    ret = convert_fmr(fmr, &ofmr, in_type, out_type);
+    free_fmr(fmr);
+    if (ret != BC_OK)
+        return ret;
+    STATS_STAGE(ctx, convert_ns, start);
+
+    ret = emit_fmr(ctx, ofmr, out);
+    free_fmr(ofmr);
+    return ret;
+}
+
+/*
+ * Check the arguments common to all entry points and drop any record kept
+ * from a previous call.
+ */
+static int
+begin_call(bc_context *ctx, bc_output *out) {
+    if (ctx == NULL || out->olen == NULL)
+        return BC_ERR_ARGUMENT;
+    if (out->odata == NULL && out->osize < 0)
+        return BC_ERR_ARGUMENT;
+    ctx->result_len = 0;
+    if (ctx->stats_enabled) {
+        memset(&ctx->stats, 0, sizeof(ctx->stats));
+        ctx->call_start = stats_clock(ctx);
+    }
+    return BC_OK;
+}
+
+#define COUNT(field, value) __atomic_fetch_add(&counters.field, (value), __ATOMIC_RELAXED)
+
+// Finish the measurement begun in begin_call() and add it to the totals.
+static int
+end_call(bc_context *ctx, int ret) {
+    bc_stats *st = &ctx->stats;
+
+    if (!ctx->stats_enabled)
+        return ret;
+    st->total_ns = stats_clock(ctx) - ctx->call_start;
+    COUNT(calls, 1);
+    if (ret != BC_OK && ret != BC_ERR_BUFFER_TOO_SMALL)
+        COUNT(failures, 1);
+    COUNT(total_ns, st->total_ns);
+    COUNT(decode_ns, st->decode_ns);
+    COUNT(extract_ns, st->extract_ns);
+    COUNT(build_ns, st->build_ns);
+    COUNT(parse_ns, st->parse_ns);
+    COUNT(convert_ns, st->convert_ns);
+    COUNT(serialize_ns, st->serialize_ns);
+    COUNT(resample_ns, st->resample_ns);
+    COUNT(pixels, (long long) st->width * st->height);
+    COUNT(minutiae, st->minutiae);
+    COUNT(bytes_allocated, st->bytes_allocated);
+    return ret;
+}
+
+int bc_context_get_stats(bc_context *ctx, bc_stats *stats) {
+    if (ctx == NULL || stats == NULL || !ctx->stats_enabled)
+        return BC_ERR_ARGUMENT;
+    *stats = ctx->stats;
+    return BC_OK;
+}
+
+void bc_get_counters(bc_counters *out) {
+    long long *src = (long long *) &counters, *dst = (long long *) out;
+    size_t i;
+
+    for (i = 0; i < sizeof(bc_counters) / sizeof(long long); i++)
+        dst[i] = __atomic_load_n(&src[i], __ATOMIC_RELAXED);
+}
+
+void bc_reset_counters(void) {
+    long long *dst = (long long *) &counters;
+    size_t i;
+
+    for (i = 0; i < sizeof(bc_counters) / sizeof(long long); i++)
+        __atomic_store_n(&dst[i], 0, __ATOMIC_RELAXED);
+}
+
+/*
+ * Entry points: measure the call and serve it from the cache when the
+ * context has one and the arguments make a valid key. Invalid arguments
+ * bypass the cache and fail in the conversion itself.
+ */
+static int
+img2fmr_call(bc_context *ctx, unsigned char *idata, int ilen, char *otype, bc_output *out) {
+    bc_cache_key key;
+    int out_type, cached;
+    int ret;
+
+    if ((ret = begin_call(ctx, out)) != BC_OK)
+        return ret;
+    cached = ctx->cache != NULL && idata != NULL && ilen > 0 && otype != NULL &&
+             (out_type = str_to_type(otype)) >= 0;
+    if (cached) {
+        int params[BC_CACHE_PARAMS] = {ctx->target_ppi, ctx->crop, ctx->jp2_reduce};
+
+        bc_cache_key_init(ctx->cache, &key, BC_CACHE_IMAGE, idata, ilen, 0, out_type, params);
+        if (cache_lookup(ctx, &key, out, &ret))
+            return end_call(ctx, ret);
+    }
+    ret = img2fmr_out(ctx, idata, ilen, otype, out);
+    if (cached)
+        cache_result(ctx, &key, out, ret);
+    return end_call(ctx, ret);
+}
+
+static int
+raw2fmr_call(bc_context *ctx, unsigned char *pixels, int w, int h, int depth, int ppi,
+             char *otype, bc_output *out) {
+    bc_cache_key key;
+    int out_type, cached;
+    int ret;
+
+    if ((ret = begin_call(ctx, out)) != BC_OK)
+        return ret;
+    cached = ctx->cache != NULL && pixels != NULL && w > 0 && h > 0 &&
+             (depth == 8 || depth == 24) && otype != NULL && (out_type = str_to_type(otype)) >= 0;
+    if (cached) {
+        int params[BC_CACHE_PARAMS] = {w, h, depth, ppi > 0 ? ppi : 0, ctx->target_ppi, ctx->crop};
+
+        bc_cache_key_init(ctx->cache, &key, BC_CACHE_RAW, pixels, (long long) w * h * (depth / 8),
+                          0, out_type, params);
+        if (cache_lookup(ctx, &key, out, &ret))
+            return end_call(ctx, ret);
+    }
+    ret = raw2fmr_out(ctx, pixels, w, h, depth, ppi, w, h, otype, out);
+    if (cached)
+        cache_result(ctx, &key, out, ret);
+    return end_call(ctx, ret);
+}
+
+static int
+fmr2fmr_call(bc_context *ctx, unsigned char *idata, int ilen, char *in_type_str, char *out_type_str,
+             int iso_c_xres, int iso_c_yres, bc_output *out) {
+    bc_cache_key key;
+    int in_type, out_type, cached;
+    int ret;
+
+    if ((ret = begin_call(ctx, out)) != BC_OK)
+        return ret;
+    cached = ctx->cache != NULL && idata != NULL && ilen > 0 && in_type_str != NULL && out_type_str != NULL &&
+             (in_type = str_to_type(in_type_str)) >= 0 && (out_type = str_to_type(out_type_str)) >= 0;
+    if (cached) {
+        // The resolution is only read for card input.
+        int card = in_type == FMR_STD_ISO_NORMAL_CARD || in_type == FMR_STD_ISO_COMPACT_CARD;
+        int params[BC_CACHE_PARAMS] = {card ? iso_c_xres : 0, card ? iso_c_yres : 0};
+
+        bc_cache_key_init(ctx->cache, &key, BC_CACHE_RECORD, idata, ilen, in_type, out_type, params);
+        if (cache_lookup(ctx, &key, out, &ret))
+            return end_call(ctx, ret);
+    }
+    ret = fmr2fmr_out(ctx, idata, ilen, in_type_str, out_type_str, iso_c_xres, iso_c_yres, out);
+    if (cached)
+        cache_result(ctx, &key, out, ret);
+    return end_call(ctx, ret);
+}
+
+int bc_img2fmr(bc_context *ctx, unsigned char *idata, int ilen, char *otype,
+               unsigned char **odata, int *olen) {
+    bc_output out = {odata, NULL, 0, olen};
+
+    if (odata == NULL)
+        return BC_ERR_ARGUMENT;
+    return img2fmr_call(ctx, idata, ilen, otype, &out);
+}
+
+int bc_raw2fmr(bc_context *ctx, unsigned char *pixels, int w, int h, int depth, int ppi,
+               char *otype, unsigned char **odata, int *olen) {
+    bc_output out = {odata, NULL, 0, olen};
+
+    if (odata == NULL)
+        return BC_ERR_ARGUMENT;
+    return raw2fmr_call(ctx, pixels, w, h, depth, ppi, otype, &out);
+}
+
+int bc_fmr2fmr(bc_context *ctx, unsigned char *idata, int ilen,
+               unsigned char **odata, int *olen,
+               char *in_type_str, char *out_type_str,
+               int iso_c_xres, int iso_c_yres) {
+    bc_output out = {odata, NULL, 0, olen};
+
+    if (odata == NULL)
+        return BC_ERR_ARGUMENT;
+    return fmr2fmr_call(ctx, idata, ilen, in_type_str, out_type_str, iso_c_xres, iso_c_yres, &out);
+}
+
+int bc_img2fmr_into(bc_context *ctx, unsigned char *idata, int ilen, char *otype,
+                    unsigned char *obuf, int osize, int *olen) {
+    bc_output out = {NULL, obuf, osize, olen};
+
+    return img2fmr_call(ctx, idata, ilen, otype, &out);
+}
+
+int bc_raw2fmr_into(bc_context *ctx, unsigned char *pixels, int w, int h, int depth, int ppi,
+                    char *otype, unsigned char *obuf, int osize, int *olen) {
+    bc_output out = {NULL, obuf, osize, olen};
+
+    return raw2fmr_call(ctx, pixels, w, h, depth, ppi, otype, &out);
+}
+
+int bc_fmr2fmr_into(bc_context *ctx, unsigned char *idata, int ilen,
+                    char *in_type_str, char *out_type_str,
+                    int iso_c_xres, int iso_c_yres,
+                    unsigned char *obuf, int osize, int *olen) {
+    bc_output out = {NULL, obuf, osize, olen};
+
+    return fmr2fmr_call(ctx, idata, ilen, in_type_str, out_type_str, iso_c_xres, iso_c_yres, &out);
+}
+
+int bc_fmr_transcode(bc_context *ctx, unsigned char *idata, int ilen, char *in_type_str, char *out_type_str,
+                     int iso_c_xres, int iso_c_yres, unsigned char *obuf, int osize, int *olen) {
+    bc_output out = {NULL, obuf, osize, olen};
+    unsigned char *buf;
+    int in_type, out_type;
+    size_t len;
+    int ret;
+
+    if (idata == NULL || ilen <= 0 || in_type_str == NULL || out_type_str == NULL)
+        return BC_ERR_ARGUMENT;
+    if ((ret = begin_call(ctx, &out)) != BC_OK)
+        return ret;
+    in_type = str_to_type(in_type_str);
+    out_type = str_to_type(out_type_str);
+    if (in_type < 0 || out_type < 0) {
+        fprintf(stderr, "unknown conversion %s -> %s\n", in_type_str, out_type_str);
+        return end_call(ctx, BC_ERR_ARGUMENT);
+    }
+
+    ret = transcode_fmr(idata, ilen, in_type, out_type, iso_c_xres, iso_c_yres,
+                        obuf, osize, &len);
+    if (ret == TRANSCODE_UNSUPPORTED) {
+        // Other versions and conversions take the biomdi path.
+        return fmr2fmr_call(ctx, idata, ilen, in_type_str, out_type_str, iso_c_xres, iso_c_yres, &out);
+    }
+    if (ret == BC_ERR_BUFFER_TOO_SMALL) {
+        // Keep the record for bc_result_copy() instead of converting again.
+        if ((ret = output_buffer(ctx, &out, (int) len, &buf)) == BC_ERR_MEMORY)
+            return end_call(ctx, ret);
+        transcode_fmr(idata, ilen, in_type, out_type, iso_c_xres, iso_c_yres, buf, len, &len);
+        finish_output(ctx, &out, buf, (int) len, ret);
+    } else if (ret == BC_OK) {
+        *olen = (int) len;
+    }
+    return end_call(ctx, ret);
+}
+
+int bc_result_copy(bc_context *ctx, unsigned char *obuf, int osize, int *olen) {
+    if (ctx == NULL || olen == NULL || ctx->result_len == 0)
+        return BC_ERR_ARGUMENT;
+    *olen = ctx->result_len;
+    if (obuf == NULL || osize < ctx->result_len)
+        return BC_ERR_BUFFER_TOO_SMALL;
+    memcpy(obuf, ctx->result, ctx->result_len);
+    ctx->result_len = 0;
+    return BC_OK;
+}
+
+void bc_free(void *ptr) {
+    free(ptr);
+}
+
+typedef struct {
+    bc_batch_item *items;
+    bc_context **contexts;
+    int images;
+} bc_batch;
+
+static void
+batch_task(void *arg, int worker, int task) {
+    bc_batch *batch = (bc_batch *) arg;
+    bc_batch_item *item = &batch->items[task];
+    bc_context *ctx = batch->contexts[worker];
+
+    item->odata = NULL;
+    item->olen = 0;
+    if (batch->images)
+        item->status = bc_img2fmr(ctx, item->idata, item->ilen, item->out_type,
+                                  &item->odata, &item->olen);
     else
-        copy_with_conversion(ifmr, ofmr, in_type, out_type);
+        item->status = bc_fmr2fmr(ctx, item->idata, item->ilen, &item->odata, &item->olen,
+                                  item->in_type, item->out_type,
+                                  item->iso_c_xres, item->iso_c_yres);
+}
 
-    uint8_t *buf;
-    BDB *bdb;
-    buf = (uint8_t *) malloc(ofmr->record_length);
-    bdb = (BDB *) malloc(sizeof(BDB));
-    INIT_BDB(bdb, buf, ofmr->record_length);
+typedef struct {
+    int len;
+    int index;
+} bc_batch_order;
 
-    if (push_fmr(bdb, ofmr) != WRITE_OK) {
-        fprintf(stderr, "could not push FMR\n");
-        exit(EXIT_FAILURE);
+static int
+cmp_batch_order(const void *a, const void *b) {
+    const bc_batch_order *oa = (const bc_batch_order *) a;
+    const bc_batch_order *ob = (const bc_batch_order *) b;
+
+    if (oa->len != ob->len)
+        return oa->len < ob->len ? 1 : -1;
+    return oa->index - ob->index;
+}
+
+// Fill order with the task indices of sorted, largest input first.
+static void
+largest_first(bc_batch_order *sorted, int *order, int count) {
+    int i;
+
+    qsort(sorted, count, sizeof(bc_batch_order), cmp_batch_order);
+    for (i = 0; i < count; i++)
+        order[i] = sorted[i].index;
+}
+
+/*
+ * Convert every item on a work-stealing pool with one context per worker.
+ * Items are scheduled largest input first so one big image does not end up
+ * as the tail of the batch; the encoded size stands in for the image size
+ * since finding the dimensions would mean parsing every header.
+ */
+static int
+run_batch(bc_context *ctx, bc_batch_item *items, int count, int images) {
+    bc_batch batch;
+    bc_batch_order *sorted = NULL;
+    int *order = NULL;
+    int nworkers, w, i, failed;
+    int retval = BC_ERR_MEMORY;
+
+    if (ctx == NULL || (items == NULL && count > 0) || count < 0)
+        return BC_ERR_ARGUMENT;
+    if (count == 0)
+        return 0;
+
+    nworkers = ctx->threads > 0 ? ctx->threads : bc_pool_default_workers();
+    if (nworkers > count)
+        nworkers = count;
+
+    batch.items = items;
+    batch.images = images;
+    batch.contexts = (bc_context **) calloc(nworkers, sizeof(bc_context *));
+    sorted = (bc_batch_order *) malloc(count * sizeof(bc_batch_order));
+    order = (int *) malloc(count * sizeof(int));
+    if (batch.contexts == NULL || sorted == NULL || order == NULL)
+        ALLOC_ERR_OUT("batch schedule");
+
+    batch.contexts[0] = ctx;
+    for (w = 1; w < nworkers; w++) {
+        if ((batch.contexts[w] = clone_context(ctx)) == NULL)
+            break;
     }
+    nworkers = w;
 
-    *odata = bdb->bdb_start;
-    *olen = bdb->bdb_size;
+    for (i = 0; i < count; i++) {
+        sorted[i].len = items[i].ilen;
+        sorted[i].index = i;
+    }
+    largest_first(sorted, order, count);
 
-    return 0;
-}
\ No newline at end of file
+    if (bc_pool_run(nworkers, count, order, batch_task, &batch) != 0)
+        ERR_OUT("starting batch workers");
+
+    failed = 0;
+    for (i = 0; i < count; i++)
+        if (items[i].status != BC_OK)
+            failed++;
+    retval = failed;
+
+    err_out:
+    if (batch.contexts != NULL) {
+        for (w = 1; w < nworkers; w++)
+            bc_context_destroy(batch.contexts[w]);
+        free(batch.contexts);
+    }
+    free(sorted);
+    free(order);
+    return retval;
+}
+
+int bc_img2fmr_batch(bc_context *ctx, bc_batch_item *items, int count) {
+    return run_batch(ctx, items, count, 1);
+}
+
+int bc_fmr2fmr_batch(bc_context *ctx, bc_batch_item *items, int count) {
+    return run_batch(ctx, items, count, 0);
+}
+
+// ANSI/ISO finger position codes run from 0 (unknown) to 10.
+#define MAX_FINGER_POSITION 10
+
+// Decoded and detected state of one finger of a multi-finger record.
+typedef struct {
+    MINUTIAE *minutiae;
+    int w, h, depth;
+    int ppi;                    // UNDEFINED if the image did not say
+    bc_geometry geo;
+    long long decode_ns;
+    long long resample_ns;
+    long long extract_ns;
+} bc_finger_scan;
+
+typedef struct {
+    bc_context *ctx;            // settings only; tasks do not touch its state
+    bc_finger *fingers;
+    bc_finger_scan *scans;
+    bc_arena *arenas;           // detection scratch of each worker
+    int extract_threads;
+} bc_multi;
+
+/*
+ * Decode one finger and detect its minutiae. Runs on a pool worker, so
+ * scratch memory comes from malloc or the worker's own arena rather than
+ * the shared context's arena.
+ */
+static void
+scan_finger_task(void *arg, int worker, int task) {
+    bc_multi *multi = (bc_multi *) arg;
+    bc_finger *finger = &multi->fingers[task];
+    bc_finger_scan *scan = &multi->scans[task];
+    unsigned char *imdata, *gray = NULL, *small = NULL, *pixels;
+    int img_len, img_type, pw, ph;
+    long long start = stats_clock(multi->ctx);
+    int ret;
+
+    // Nothing from the worker's previous finger lives in its arena.
+    bc_arena_reset(&multi->arenas[worker]);
+    if ((ret = read_image(multi->ctx, finger->idata, finger->ilen, &imdata, &img_len, &img_type,
+                          &scan->w, &scan->h, &scan->depth, &scan->ppi, &pw, &ph)) != BC_OK) {
+        finger->status = ret;
+        return;
+    }
+    if (multi->ctx->stats_enabled)
+        scan->decode_ns = stats_clock(multi->ctx) - start;
+
+    finger->status = BC_ERR_EXTRACT;
+    switch (scan->depth) {
+        case 8:
+            pixels = imdata;
+            break;
+        case 24:
+            if ((gray = (unsigned char *) malloc((size_t) pw * ph)) == NULL) {
+                finger->status = BC_ERR_MEMORY;
+                goto err_out;
+            }
+            bc_rgb_to_gray(imdata, gray, (size_t) pw * ph);
+            pixels = gray;
+            break;
+        default:
+            ERR_OUT("minutiae detection needs 8-bit grayscale, got %d bits", scan->depth);
+    }
+
+    if (scan->ppi <= 0)
+        scan->ppi = UNDEFINED;
+    plan_geometry(multi->ctx->target_ppi, scan->w, scan->h, scan->ppi, pw, ph, &scan->geo);
+    if (scan->geo.ew != pw || scan->geo.eh != ph) {
+        start = stats_clock(multi->ctx);
+        small = (unsigned char *) malloc((size_t) scan->geo.ew * scan->geo.eh);
+        if (small == NULL || downsample(pixels, &scan->geo, small) != 0) {
+            finger->status = BC_ERR_MEMORY;
+            goto err_out;
+        }
+        pixels = small;
+        if (multi->ctx->stats_enabled)
+            scan->resample_ns = stats_clock(multi->ctx) - start;
+    }
+
+    start = stats_clock(multi->ctx);
+    if (detect_minutiae(&scan->minutiae, pixels, &scan->geo, multi->extract_threads, multi->ctx->crop,
+                        &multi->arenas[worker]) != 0)
+        ERR_OUT("cannot read minutiae");
+    if (multi->ctx->stats_enabled)
+        scan->extract_ns = stats_clock(multi->ctx) - start;
+    finger->status = BC_OK;
+
+    err_out:
+    free(small);
+    free(gray);
+    free(imdata);
+}
+
+static int
+multi2fmr_out(bc_context *ctx, bc_finger *fingers, int count, char *otype, bc_output *out) {
+    bc_multi multi;
+    bc_batch_order *sorted = NULL;
+    int *order = NULL;
+    struct finger_minutiae_record *fmr, *ofmr = NULL;
+    double ippmm;
+    long long start;
+    int nworkers, out_type, ppi, w, h, i;
+    int ret;
+
+    if (fingers == NULL || count <= 0 || count > UCHAR_MAX || otype == NULL)
+        return BC_ERR_ARGUMENT;
+    if ((out_type = str_to_type(otype)) < 0) {
+        fprintf(stderr, "unknown output type %s\n", otype);
+        return BC_ERR_ARGUMENT;
+    }
+    ret = BC_OK;
+    for (i = 0; i < count; i++) {
+        fingers[i].status = BC_OK;
+        if (fingers[i].idata == NULL || fingers[i].ilen <= 0 ||
+            fingers[i].position < 0 || fingers[i].position > MAX_FINGER_POSITION ||
+            fingers[i].impression < 0 || fingers[i].impression > UCHAR_MAX) {
+            fingers[i].status = BC_ERR_ARGUMENT;
+            ret = BC_ERR_ARGUMENT;
+        }
+    }
+    if (ret != BC_OK)
+        return ret;
+
+    ret = BC_ERR_MEMORY;
+    multi.ctx = ctx;
+    multi.fingers = fingers;
+    nworkers = ctx->threads > 0 ? ctx->threads : bc_pool_default_workers();
+    multi.scans = (bc_finger_scan *) calloc(count, sizeof(bc_finger_scan));
+    if ((multi.arenas = (bc_arena *) malloc(nworkers * sizeof(bc_arena))) != NULL)
+        for (i = 0; i < nworkers; i++)
+            bc_arena_init(&multi.arenas[i]);
+    sorted = (bc_batch_order *) malloc(count * sizeof(bc_batch_order));
+    order = (int *) malloc(count * sizeof(int));
+    if (multi.scans == NULL || multi.arenas == NULL || sorted == NULL || order == NULL)
+        ALLOC_ERR_OUT("multi-finger schedule");
+
+    // Threaded detection only pays off when there are no other fingers to
+    // keep the workers busy.
+    multi.extract_threads = count == 1 ? ctx->extract_threads : 0;
+    for (i = 0; i < count; i++) {
+        sorted[i].len = fingers[i].ilen;
+        sorted[i].index = i;
+    }
+    largest_first(sorted, order, count);
+    if (bc_pool_run(nworkers, count, order, scan_finger_task, &multi) != 0)
+        ERR_OUT("starting finger workers");
+
+    // The first failure in finger order decides the result.
+    for (i = 0; i < count; i++) {
+        if (fingers[i].status != BC_OK) {
+            ret = fingers[i].status;
+            goto err_out;
+        }
+    }
+
+    w = h = 0;
+    ppi = multi.scans[0].ppi;
+    for (i = 0; i < count; i++) {
+        if (multi.scans[i].ppi != ppi) {
+            fprintf(stderr, "finger %d has resolution %d, not %d\n", i, multi.scans[i].ppi, ppi);
+            fingers[i].status = BC_ERR_FORMAT;
+            ret = BC_ERR_FORMAT;
+            goto err_out;
+        }
+        w = MAX(w, multi.scans[i].w);
+        h = MAX(h, multi.scans[i].h);
+        STATS_ADD(ctx, decode_ns, multi.scans[i].decode_ns);
+        STATS_ADD(ctx, resample_ns, multi.scans[i].resample_ns);
+        STATS_ADD(ctx, extract_ns, multi.scans[i].extract_ns);
+        STATS_ADD(ctx, minutiae, multi.scans[i].minutiae->num);
+        STATS_ADD(ctx, bytes_allocated, (long long) multi.scans[i].w * multi.scans[i].h);
+    }
+    ippmm = (ppi == UNDEFINED ? DEFAULT_PPI : ppi) / (double) MM_PER_INCH;
+    STATS_SET(ctx, width, w);
+    STATS_SET(ctx, height, h);
+    STATS_SET(ctx, depth, 8);
+    STATS_SET(ctx, ppi, ppi == UNDEFINED ? 0 : ppi);
+
+    ret = BC_ERR_FORMAT;
+    start = stats_clock(ctx);
+    if (new_ansi_fmr(ctx, w, h, ppi, ippmm, &fmr) != 0)
+        ERR_OUT("could not create FMR");
+    for (i = 0; i < count; i++)
+        if (add_lfs_view(ctx, fmr, multi.scans[i].minutiae, &multi.scans[i].geo,
+                         fingers[i].position, fingers[i].impression) != 0)
+            ERR_OUT("could not add view %d to FMR", i);
+    STATS_STAGE(ctx, build_ns, start);
+
+    if (out_type != FMR_STD_ANSI) {
+        start = stats_clock(ctx);
+        if ((ret = convert_fmr(fmr, &ofmr, FMR_STD_ANSI, out_type)) != BC_OK)
+            goto err_out;
+        STATS_STAGE(ctx, convert_ns, start);
+        fmr = ofmr;
+    }
+
+    ret = emit_fmr(ctx, fmr, out);
+
+    err_out:
+    if (ofmr != NULL)
+        free_fmr(ofmr);
+    if (multi.scans != NULL) {
+        for (i = 0; i < count; i++)
+            if (multi.scans[i].minutiae != NULL)
+                free_minutiae(multi.scans[i].minutiae);
+        free(multi.scans);
+    }
+    if (multi.arenas != NULL) {
+        for (i = 0; i < nworkers; i++) {
+            STATS_ADD(ctx, bytes_allocated, (long long) multi.arenas[i].used);
+            bc_arena_release(&multi.arenas[i]);
+        }
+        free(multi.arenas);
+    }
+    free(sorted);
+    free(order);
+    STATS_ADD(ctx, bytes_allocated, (long long) ctx->arena.used);
+    bc_arena_reset(&ctx->arena);
+    return ret;
+}
+
+int bc_img2fmr_multi(bc_context *ctx, bc_finger *fingers, int count, char *otype,
+                     unsigned char **odata, int *olen) {
+    bc_output out = {odata, NULL, 0, olen};
+    int ret;
+
+    if (odata == NULL)
+        return BC_ERR_ARGUMENT;
+    if ((ret = begin_call(ctx, &out)) != BC_OK)
+        return ret;
+    return end_call(ctx, multi2fmr_out(ctx, fingers, count, otype, &out));
+}
+
+int bc_img2fmr_multi_into(bc_context *ctx, bc_finger *fingers, int count, char *otype,
+                          unsigned char *obuf, int osize, int *olen) {
+    bc_output out = {NULL, obuf, osize, olen};
+    int ret;
+
+    if ((ret = begin_call(ctx, &out)) != BC_OK)
+        return ret;
+    return end_call(ctx, multi2fmr_out(ctx, fingers, count, otype, &out));
+}
+
+int img2fmr(unsigned char *idata, int ilen, char *otype, unsigned char **odata, int *olen) {
+    bc_context *ctx;
+    int ret;
+
+    if ((ctx = bc_context_create()) == NULL)
+        return BC_ERR_MEMORY;
+    ret = bc_img2fmr(ctx, idata, ilen, otype, odata, olen);
+    bc_context_destroy(ctx);
+    return ret;
+}
+
+int raw2fmr(unsigned char *pixels, int w, int h, int depth, int ppi,
+            char *otype, unsigned char **odata, int *olen) {
+    bc_context *ctx;
+    int ret;
+
+    if ((ctx = bc_context_create()) == NULL)
+        return BC_ERR_MEMORY;
+    ret = bc_raw2fmr(ctx, pixels, w, h, depth, ppi, otype, odata, olen);
+    bc_context_destroy(ctx);
+    return ret;
+}
+
+int fmr2fmr(unsigned char *idata, int ilen, unsigned char **odata, int *olen,
+            char *in_type_str, char *out_type_str) {
+    return fmr2fmr_iso_card(idata, ilen, odata, olen, in_type_str, out_type_str, 0, 0);
+}
+
+int fmr2fmr_iso_card(unsigned char *idata, int ilen, unsigned char **odata, int *olen,
+                     char *in_type_str, char *out_type_str, int iso_c_xres, int iso_c_yres) {
+    bc_context *ctx;
+    int ret;
+
+    if ((ctx = bc_context_create()) == NULL)
+        return BC_ERR_MEMORY;
+    ret = bc_fmr2fmr(ctx, idata, ilen, odata, olen, in_type_str, out_type_str,
+                     iso_c_xres, iso_c_yres);
+    bc_context_destroy(ctx);
+    return ret;
+}
@@ -0,0 +1,645 @@
+#include "extract.h"
+#include "arena.h"
+#include "pool.h"
+#include "simd.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <sys/param.h>
+
+// Tasks per worker for the per-block stages, so that a worker done early
+// takes bands from the others instead of idling.
+#define BANDS_PER_WORKER    4
+// A 16x16 block is foreground when its pixels vary at least this much
+// (standard deviation in gray levels); flat background stays well below.
+#define FOREGROUND_STDDEV   12
+// Block rows and columns with fewer foreground blocks are edge noise.
+#define FOREGROUND_MIN_BLOCKS 2
+// Context kept around the foreground, in mm; it covers the margin blocks
+// LFS discards near the image edge.
+#define CROP_MARGIN_MM      3.0
+// Crops keeping more of the image than this do not pay for the copy.
+#define CROP_MAX_AREA       0.8
+
+// LFS lookup tables for one image size, built once per detection.
+typedef struct {
+    DIR2RAD *dir2rad;
+    DFTWAVES *dftwaves;
+    ROTGRIDS *dftgrids;
+    ROTGRIDS *dirbingrids;
+    // dftwaves laid out for bc_dft_powers(), in the scratch arena; NULL when
+    // it has too many waves.
+    double *waves;
+} bc_lfs_tables;
+
+// Per-block DFT working memory, in the scratch arena.
+typedef struct {
+    double **powers;    // [wave][direction], as the NBIS tests read them
+    double *flat;       // bc_dft_powers() output
+    int *wis, *powmax_dirs;
+    double *powmaxs, *pownorms;
+} bc_dft_scratch;
+
+/*
+ * The per-block stages of one detection, split into bands of block rows.
+ * Blocks are classified and binarized independently of each other, so each
+ * task writes only its band of the maps and of the binarized image and the
+ * result does not depend on how many workers run the tasks.
+ */
+typedef struct {
+    const bc_lfs_tables *tables;
+    const LFSPARMS *lfsparms;
+    const int *blkoffs;
+    unsigned char *pdata;
+    int pw, ph;
+    int *direction_map, *low_contrast_map, *low_flow_map;
+    int mw, mh;
+    unsigned char *bdata;
+    int bw, bh;
+    int band;               // block rows per task
+    int ntasks, nworkers;
+    int *order;
+    int *rets;              // of each task
+    bc_dft_scratch *dft;    // of each worker
+} bc_lfs_bands;
+
+static size_t
+wave_table_size(const DFTWAVES *dftwaves) {
+    return (size_t) dftwaves->wavelen * 2 * BC_DFT_WAVES * sizeof(double);
+}
+
+static void
+fill_wave_table(double *waves, const DFTWAVES *dftwaves) {
+    int i, w;
+
+    memset(waves, 0, wave_table_size(dftwaves));
+    for (i = 0; i < dftwaves->wavelen; i++) {
+        for (w = 0; w < dftwaves->nwaves; w++) {
+            waves[(i * 2) * BC_DFT_WAVES + w] = dftwaves->waves[w]->cos[i];
+            waves[(i * 2 + 1) * BC_DFT_WAVES + w] = dftwaves->waves[w]->sin[i];
+        }
+    }
+}
+
+// Whether bc_dft_powers() can stand in for dft_dir_powers().
+static int
+simd_dft(const DFTWAVES *dftwaves, const ROTGRIDS *dftgrids) {
+    return dftwaves->nwaves <= BC_DFT_WAVES && dftgrids->grid_w == dftgrids->grid_h &&
+           dftgrids->grid_w == dftwaves->wavelen;
+}
+
+static void
+free_lfs_tables(bc_lfs_tables *tables) {
+    if (tables->dir2rad != NULL)
+        free_dir2rad(tables->dir2rad);
+    if (tables->dftwaves != NULL)
+        free_dftwaves(tables->dftwaves);
+    if (tables->dftgrids != NULL)
+        free_rotgrids(tables->dftgrids);
+    if (tables->dirbingrids != NULL)
+        free_rotgrids(tables->dirbingrids);
+}
+
+// The tables lfs_detect_minutiae_V2() builds, for an iw x ih image.
+static int
+init_lfs_tables(bc_lfs_tables *tables, int iw, int ih, const LFSPARMS *lfsparms, bc_arena *scratch) {
+    int maxpad, ret;
+
+    memset(tables, 0, sizeof(bc_lfs_tables));
+    maxpad = get_max_padding_V2(lfsparms->windowsize, lfsparms->windowoffset,
+                                lfsparms->dirbin_grid_w, lfsparms->dirbin_grid_h);
+    if ((ret = init_dir2rad(&tables->dir2rad, lfsparms->num_directions)) != 0 ||
+        (ret = init_dftwaves(&tables->dftwaves, g_dft_coefs, lfsparms->num_dft_waves,
+                             lfsparms->windowsize)) != 0 ||
+        (ret = init_rotgrids(&tables->dftgrids, iw, ih, maxpad, lfsparms->start_dir_angle,
+                             lfsparms->num_directions, lfsparms->windowsize, lfsparms->windowsize,
+                             RELATIVE2ORIGIN)) != 0 ||
+        (ret = init_rotgrids(&tables->dirbingrids, iw, ih, maxpad, lfsparms->start_dir_angle,
+                             lfsparms->num_directions, lfsparms->dirbin_grid_w, lfsparms->dirbin_grid_h,
+                             RELATIVE2CENTER)) != 0)
+        goto err_out;
+    if (simd_dft(tables->dftwaves, tables->dftgrids)) {
+        if ((tables->waves = (double *) bc_arena_alloc(scratch, wave_table_size(tables->dftwaves))) == NULL) {
+            fprintf(stderr, "could not allocate DFT wave table\n");
+            ret = -1;
+            goto err_out;
+        }
+        fill_wave_table(tables->waves, tables->dftwaves);
+    }
+    return 0;
+
+    err_out:
+    free_lfs_tables(tables);
+    return ret;
+}
+
+/*
+ * pad_uchar_image() from NBIS, with BC_DFT_SLACK zero bytes after the
+ * padded image for bc_dft_powers().
+ */
+static unsigned char *
+pad_image(bc_arena *scratch, const unsigned char *idata, int iw, int ih, int pad, int pad_value,
+          int *opw, int *oph) {
+    unsigned char *pdata;
+    size_t size;
+    int pw = iw + 2 * pad, ph = ih + 2 * pad, y;
+
+    size = (size_t) pw * ph;
+    if ((pdata = (unsigned char *) bc_arena_alloc(scratch, size + BC_DFT_SLACK)) == NULL)
+        return NULL;
+    memset(pdata, pad_value, size);
+    memset(pdata + size, 0, BC_DFT_SLACK);
+    for (y = 0; y < ih; y++)
+        memcpy(pdata + (size_t) (pad + y) * pw + pad, idata + (size_t) y * iw, iw);
+    *opw = pw;
+    *oph = ph;
+    return pdata;
+}
+
+// Run bc_dft_powers() on the window at blk and store the powers the way
+// dft_dir_powers() does.
+static void
+dir_powers(double **powers, double *flat, const unsigned char *blk, const DFTWAVES *dftwaves,
+           const ROTGRIDS *dftgrids, const double *waves) {
+    int d, w;
+
+    bc_dft_powers(blk, dftgrids->grids, dftgrids->ngrids, dftgrids->grid_w, waves, flat);
+    for (d = 0; d < dftgrids->ngrids; d++)
+        for (w = 0; w < dftwaves->nwaves; w++)
+            powers[w][d] = flat[d * BC_DFT_WAVES + w];
+}
+
+int bc_dft_dir_powers(double **powers, unsigned char *pdata, int blkoffset, int pw, int ph,
+                      const DFTWAVES *dftwaves, const ROTGRIDS *dftgrids) {
+    double *waves, *flat;
+
+    if (!simd_dft(dftwaves, dftgrids))
+        return dft_dir_powers(powers, pdata, blkoffset, pw, ph, dftwaves, dftgrids);
+    waves = (double *) malloc(wave_table_size(dftwaves));
+    flat = (double *) malloc((size_t) dftgrids->ngrids * BC_DFT_WAVES * sizeof(double));
+    if (waves == NULL || flat == NULL) {
+        fprintf(stderr, "could not allocate DFT powers\n");
+        free(waves);
+        free(flat);
+        return -1;
+    }
+    fill_wave_table(waves, dftwaves);
+    dir_powers(powers, flat, pdata + blkoffset, dftwaves, dftgrids, waves);
+    free(waves);
+    free(flat);
+    return 0;
+}
+
+static int
+alloc_dft_scratch(bc_dft_scratch *scratch, const bc_lfs_tables *tables, bc_arena *arena) {
+    int nwaves = tables->dftwaves->nwaves, ngrids = tables->dftgrids->ngrids;
+    int nstats = nwaves - 1, w;
+
+    scratch->powers = (double **) bc_arena_alloc(arena, nwaves * sizeof(double *));
+    scratch->flat = (double *) bc_arena_alloc(arena, (size_t) ngrids * BC_DFT_WAVES * sizeof(double));
+    scratch->wis = (int *) bc_arena_alloc(arena, nstats * sizeof(int));
+    scratch->powmax_dirs = (int *) bc_arena_alloc(arena, nstats * sizeof(int));
+    scratch->powmaxs = (double *) bc_arena_alloc(arena, nstats * sizeof(double));
+    scratch->pownorms = (double *) bc_arena_alloc(arena, nstats * sizeof(double));
+    if (scratch->powers == NULL || scratch->flat == NULL || scratch->wis == NULL ||
+        scratch->powmax_dirs == NULL || scratch->powmaxs == NULL || scratch->pownorms == NULL)
+        goto err_out;
+    for (w = 0; w < nwaves; w++)
+        if ((scratch->powers[w] = (double *) bc_arena_alloc(arena, ngrids * sizeof(double))) == NULL)
+            goto err_out;
+    return 0;
+
+    err_out:
+    fprintf(stderr, "could not allocate DFT scratch\n");
+    return -1;
+}
+
+/*
+ * Classify block bi like gen_initial_maps() in NBIS: low contrast, a ridge
+ * direction from the DFT tests, or low ridge flow. The maps start out
+ * INVALID_DIR, FALSE and FALSE.
+ */
+static int
+block_direction(int bi, const int *blkoffs, unsigned char *pdata, int pw, int ph,
+                int *direction_map, int *low_contrast_map, int *low_flow_map,
+                const bc_lfs_tables *tables, bc_dft_scratch *scratch, const LFSPARMS *lfsparms) {
+    const DFTWAVES *dftwaves = tables->dftwaves;
+    const ROTGRIDS *dftgrids = tables->dftgrids;
+    int nstats = dftwaves->nwaves - 1;
+    int offset, win_x, win_y, dir, ret;
+
+    // Window around the block, moved inside the image when it sticks out.
+    offset = blkoffs[bi] - lfsparms->windowoffset * pw - lfsparms->windowoffset;
+    win_x = offset % pw;
+    win_y = offset / pw;
+    win_x = MAX(win_x, dftgrids->pad);
+    win_x = MIN(win_x, pw - dftgrids->pad - lfsparms->windowsize - 1);
+    win_y = MAX(win_y, dftgrids->pad);
+    win_y = MIN(win_y, ph - dftgrids->pad - lfsparms->windowsize - 1);
+    offset = win_y * pw + win_x;
+
+    if ((ret = low_contrast_block(offset, lfsparms->windowsize, pdata, pw, ph, lfsparms)) != 0) {
+        if (ret < 0)
+            return ret;
+        low_contrast_map[bi] = TRUE;
+        return 0;
+    }
+
+    if (tables->waves != NULL)
+        dir_powers(scratch->powers, scratch->flat, pdata + offset, dftwaves, dftgrids, tables->waves);
+    else if ((ret = dft_dir_powers(scratch->powers, pdata, offset, pw, ph, dftwaves, dftgrids)) != 0)
+        return ret;
+    if ((ret = dft_power_stats(scratch->wis, scratch->powmaxs, scratch->powmax_dirs, scratch->pownorms,
+                               scratch->powers, 1, dftwaves->nwaves, dftgrids->ngrids)) != 0)
+        return ret;
+
+    dir = primary_dir_test(scratch->powers, scratch->wis, scratch->powmaxs, scratch->powmax_dirs,
+                           scratch->pownorms, nstats, lfsparms);
+    if (dir == INVALID_DIR)
+        dir = secondary_fork_test(scratch->powers, scratch->wis, scratch->powmaxs, scratch->powmax_dirs,
+                                  scratch->pownorms, nstats, lfsparms);
+    if (dir != INVALID_DIR)
+        direction_map[bi] = dir;
+    else
+        low_flow_map[bi] = TRUE;
+    return 0;
+}
+
+// Classify the blocks of one band.
+static void
+map_band(void *arg, int worker, int task) {
+    bc_lfs_bands *bands = (bc_lfs_bands *) arg;
+    int by1 = MIN((task + 1) * bands->band, bands->mh);
+    int bi, ret;
+
+    for (bi = task * bands->band * bands->mw; bi < by1 * bands->mw; bi++) {
+        if ((ret = block_direction(bi, bands->blkoffs, bands->pdata, bands->pw, bands->ph,
+                                   bands->direction_map, bands->low_contrast_map, bands->low_flow_map,
+                                   bands->tables, &bands->dft[worker], bands->lfsparms)) != 0) {
+            bands->rets[task] = ret;
+            return;
+        }
+    }
+}
+
+// Run fn on every band and return the first failure.
+static int
+run_bands(bc_lfs_bands *bands, bc_task_fn fn) {
+    int t;
+
+    memset(bands->rets, 0, bands->ntasks * sizeof(int));
+    if (bc_pool_run(bands->nworkers, bands->ntasks, bands->order, fn, bands) != 0) {
+        fprintf(stderr, "could not start detection workers\n");
+        return -1;
+    }
+    for (t = 0; t < bands->ntasks; t++)
+        if (bands->rets[t] != 0)
+            return bands->rets[t];
+    return 0;
+}
+
+// Split the block rows into bands for up to nthreads workers.
+static int
+init_bands(bc_lfs_bands *bands, int nthreads, bc_arena *arena) {
+    int t;
+
+    nthreads = MAX(nthreads, 1);
+    bands->band = MAX(bands->mh / (nthreads * BANDS_PER_WORKER), 1);
+    bands->ntasks = (bands->mh + bands->band - 1) / bands->band;
+    bands->nworkers = MAX(MIN(nthreads, bands->ntasks), 1);
+    bands->order = (int *) bc_arena_alloc(arena, MAX(bands->ntasks, 1) * sizeof(int));
+    bands->rets = (int *) bc_arena_alloc(arena, MAX(bands->ntasks, 1) * sizeof(int));
+    bands->dft = (bc_dft_scratch *) bc_arena_alloc(arena, bands->nworkers * sizeof(bc_dft_scratch));
+    if (bands->order == NULL || bands->rets == NULL || bands->dft == NULL) {
+        fprintf(stderr, "could not allocate detection bands\n");
+        return -1;
+    }
+    for (t = 0; t < bands->ntasks; t++)
+        bands->order[t] = t;
+    for (t = 0; t < bands->nworkers; t++)
+        if (alloc_dft_scratch(&bands->dft[t], bands->tables, arena) != 0)
+            return -1;
+    return 0;
+}
+
+/*
+ * gen_image_maps() from NBIS with the block DFTs done by bc_dft_powers():
+ * the initial maps, computed band by band on up to nthreads workers, then
+ * the same clean-up passes in the same order. bands holds the tables, the
+ * parameters and the padded image; the direction, low contrast and low flow
+ * maps come from the scratch arena, the high curvature map is NBIS's and
+ * must be freed.
+ */
+static int
+gen_maps(bc_lfs_bands *bands, int **ohcmap, int nthreads, bc_arena *arena) {
+    const bc_lfs_tables *tables = bands->tables;
+    const ROTGRIDS *dftgrids = tables->dftgrids;
+    const LFSPARMS *lfsparms = bands->lfsparms;
+    int *blkoffs = NULL, *direction_map, *low_contrast_map, *low_flow_map;
+    int *high_curve_map = NULL;
+    int mw, mh, ret;
+
+    if (dftgrids->grid_w != dftgrids->grid_h) {
+        fprintf(stderr, "DFT grids must be square\n");
+        return -1;
+    }
+    if ((ret = block_offsets(&blkoffs, &mw, &mh, bands->pw - 2 * dftgrids->pad, bands->ph - 2 * dftgrids->pad,
+                             dftgrids->pad, lfsparms->blocksize)) != 0)
+        return ret;
+
+    direction_map = (int *) bc_arena_alloc(arena, (size_t) mw * mh * sizeof(int));
+    low_contrast_map = (int *) bc_arena_calloc(arena, (size_t) mw * mh * sizeof(int));
+    low_flow_map = (int *) bc_arena_calloc(arena, (size_t) mw * mh * sizeof(int));
+    if (direction_map == NULL || low_contrast_map == NULL || low_flow_map == NULL) {
+        fprintf(stderr, "could not allocate block maps\n");
+        ret = -1;
+        goto err_out;
+    }
+    memset(direction_map, INVALID_DIR, (size_t) mw * mh * sizeof(int));
+    bands->blkoffs = blkoffs;
+    bands->direction_map = direction_map;
+    bands->low_contrast_map = low_contrast_map;
+    bands->low_flow_map = low_flow_map;
+    bands->mw = mw;
+    bands->mh = mh;
+    if ((ret = init_bands(bands, nthreads, arena)) != 0 ||
+        (ret = run_bands(bands, map_band)) != 0)
+        goto err_out;
+
+    if ((ret = morph_TF_map(low_flow_map, mw, mh, lfsparms)) != 0)
+        goto err_out;
+    remove_incon_dirs(direction_map, mw, mh, tables->dir2rad, lfsparms);
+    smooth_direction_map(direction_map, low_contrast_map, mw, mh, tables->dir2rad, lfsparms);
+    if ((ret = interpolate_direction_map(direction_map, low_contrast_map, mw, mh, lfsparms)) != 0)
+        goto err_out;
+    remove_incon_dirs(direction_map, mw, mh, tables->dir2rad, lfsparms);
+    smooth_direction_map(direction_map, low_contrast_map, mw, mh, tables->dir2rad, lfsparms);
+    set_margin_blocks(direction_map, mw, mh, INVALID_DIR);
+    if ((ret = gen_high_curve_map(&high_curve_map, direction_map, mw, mh, lfsparms)) != 0)
+        goto err_out;
+
+    *ohcmap = high_curve_map;
+    ret = 0;
+
+    err_out:
+    bands->blkoffs = NULL;
+    free(blkoffs);
+    return ret;
+}
+
+/*
+ * Directionally binarize the block rows by0 .. by1 - 1 of the image into
+ * bdata, white where the block has no direction.
+ */
+static void
+binarize_blocks(unsigned char *bdata, int bw, int bh, const unsigned char *pdata, int pw,
+                const int *direction_map, int mw, int by0, int by1, const ROTGRIDS *dirbingrids,
+                int blocksize) {
+    const unsigned char *origin = pdata + (size_t) dirbingrids->pad * pw + dirbingrids->pad;
+    unsigned char *dst;
+    int bx, by, x0, y0, nx, ny, y, dir, cy;
+
+    // Center row of the grid, rounded the way dirbinarize() rounds it.
+    cy = sround(trunc_dbl_precision((dirbingrids->grid_h - 1) / 2.0, TRUNC_SCALE));
+    for (by = by0; by < by1; by++) {
+        y0 = by * blocksize;
+        ny = MIN(blocksize, bh - y0);
+        for (bx = 0; bx < mw; bx++) {
+            x0 = bx * blocksize;
+            nx = MIN(blocksize, bw - x0);
+            dst = bdata + (size_t) y0 * bw + x0;
+            dir = direction_map[by * mw + bx];
+            if (dir == INVALID_DIR) {
+                for (y = 0; y < ny; y++)
+                    memset(dst + (size_t) y * bw, WHITE_PIXEL, nx);
+            } else {
+                bc_dirbin_block(origin + (size_t) y0 * pw + x0, pw, dst, bw, nx, ny,
+                                dirbingrids->grids[dir], dirbingrids->grid_w, dirbingrids->grid_h, cy);
+            }
+        }
+    }
+}
+
+static void
+binarize_band(void *arg, int worker, int task) {
+    bc_lfs_bands *bands = (bc_lfs_bands *) arg;
+
+    (void) worker;
+    binarize_blocks(bands->bdata, bands->bw, bands->bh, bands->pdata, bands->pw, bands->direction_map,
+                    bands->mw, task * bands->band, MIN((task + 1) * bands->band, bands->mh),
+                    bands->tables->dirbingrids, bands->lfsparms->blocksize);
+}
+
+int bc_binarize(unsigned char **odata, int *ow, int *oh, unsigned char *pdata, int pw, int ph,
+                int *direction_map, int mw, int mh, const ROTGRIDS *dirbingrids, const LFSPARMS *lfsparms) {
+    unsigned char *bdata;
+    int bw = pw - 2 * dirbingrids->pad, bh = ph - 2 * dirbingrids->pad;
+    int i;
+
+    if ((bdata = (unsigned char *) malloc((size_t) bw * bh)) == NULL) {
+        fprintf(stderr, "could not allocate binarized image\n");
+        return -1;
+    }
+    binarize_blocks(bdata, bw, bh, pdata, pw, direction_map, mw, 0, mh, dirbingrids, lfsparms->blocksize);
+    for (i = 0; i < lfsparms->num_fill_holes; i++)
+        fill_holes(bdata, bw, bh);
+
+    *odata = bdata;
+    *ow = bw;
+    *oh = bh;
+    return 0;
+}
+
+/*
+ * The stages of lfs_detect_minutiae_V2() and get_minutiae(), in the same
+ * order on the same data, except that the block DFTs and the directional
+ * binarization run on the SIMD kernels, band by band on the pool. The
+ * padded and binarized images, the block maps and the DFT working memory
+ * come from scratch.
+ */
+int get_minutiae_only(MINUTIAE **ominutiae, unsigned char *idata, int iw, int ih,
+                      double ippmm, int nthreads, bc_arena *scratch) {
+    const LFSPARMS *lfsparms = &lfsparms_V2;
+    bc_lfs_tables tables;
+    bc_lfs_bands bands;
+    MINUTIAE *minutiae = NULL;
+    int *high_curve_map = NULL, *quality_map = NULL;
+    int i, ret;
+
+    if ((ret = init_lfs_tables(&tables, iw, ih, lfsparms, scratch)) != 0)
+        return ret;
+    memset(&bands, 0, sizeof(bc_lfs_bands));
+    bands.tables = &tables;
+    bands.lfsparms = lfsparms;
+    bands.pdata = pad_image(scratch, idata, iw, ih, tables.dftgrids->pad, lfsparms->pad_value,
+                            &bands.pw, &bands.ph);
+    if (bands.pdata == NULL) {
+        fprintf(stderr, "could not allocate padded image\n");
+        ret = -1;
+        goto err_out;
+    }
+    // LFS works on 6-bit pixels.
+    bits_8to6(bands.pdata, bands.pw, bands.ph);
+
+    if ((ret = gen_maps(&bands, &high_curve_map, nthreads, scratch)) != 0)
+        goto err_out;
+    bands.bw = bands.pw - 2 * tables.dirbingrids->pad;
+    bands.bh = bands.ph - 2 * tables.dirbingrids->pad;
+    if (bands.bw != iw || bands.bh != ih) {
+        fprintf(stderr, "binarized image has bad dimensions: %d, %d\n", bands.bw, bands.bh);
+        ret = -1;
+        goto err_out;
+    }
+    if ((bands.bdata = (unsigned char *) bc_arena_alloc(scratch, (size_t) iw * ih)) == NULL) {
+        fprintf(stderr, "could not allocate binarized image\n");
+        ret = -1;
+        goto err_out;
+    }
+    if ((ret = run_bands(&bands, binarize_band)) != 0)
+        goto err_out;
+    for (i = 0; i < lfsparms->num_fill_holes; i++)
+        fill_holes(bands.bdata, iw, ih);
+
+    // Minutiae, their ridge counts and qualities come from the whole image.
+    gray2bin(1, 1, 0, bands.bdata, iw, ih);
+    if ((ret = alloc_minutiae(&minutiae, MAX_MINUTIAE)) != 0 ||
+        (ret = detect_minutiae_V2(minutiae, bands.bdata, iw, ih, bands.direction_map, bands.low_flow_map,
+                                  high_curve_map, bands.mw, bands.mh, lfsparms)) != 0 ||
+        (ret = remove_false_minutia_V2(minutiae, bands.bdata, iw, ih, bands.direction_map,
+                                       bands.low_flow_map, high_curve_map, bands.mw, bands.mh,
+                                       lfsparms)) != 0 ||
+        (ret = count_minutiae_ridges(minutiae, bands.bdata, iw, ih, lfsparms)) != 0)
+        goto err_out;
+
+    ret = gen_quality_map(&quality_map, bands.direction_map, bands.low_contrast_map,
+                          bands.low_flow_map, high_curve_map, bands.mw, bands.mh);
+    if (ret != 0)
+        goto err_out;
+    ret = combined_minutia_quality(minutiae, quality_map, bands.mw, bands.mh,
+                                   lfsparms->blocksize, idata, iw, ih, 8, ippmm);
+    free(quality_map);
+    if (ret != 0)
+        goto err_out;
+
+    free(high_curve_map);
+    free_lfs_tables(&tables);
+    *ominutiae = minutiae;
+    return 0;
+
+    err_out:
+    if (minutiae != NULL)
+        free_minutiae(minutiae);
+    free(high_curve_map);
+    free_lfs_tables(&tables);
+    return ret;
+}
+
+// Grow [lo, hi) by margin on both sides within [0, n).
+static void
+pad_range(int *lo, int *hi, int margin, int n) {
+    *lo = *lo - margin < 0 ? 0 : *lo - margin;
+    *hi = *hi + margin > n ? n : *hi + margin;
+}
+
+/*
+ * Bounding box of the fingerprint: the blocks whose pixels vary like ridges
+ * do, trimmed of sparse edge rows and columns and padded by the crop margin.
+ * Returns 1 with the box in x, y, w, h when it is worth cropping to, 0 when
+ * the foreground fills most of the image or none is found, and -1 when out
+ * of memory.
+ */
+static int
+find_foreground(const unsigned char *idata, int iw, int ih, double ippmm, int *x, int *y, int *w, int *h) {
+    unsigned int *sum = NULL, *sumsq = NULL;
+    int *cols = NULL, *rows = NULL;
+    int bw = iw / 16, bh = ih / 16;
+    int bx0, bx1, by0, by1, bx, by, margin;
+    long long var;
+    int ret = -1;
+
+    if (bw < 1 || bh < 1)
+        return 0;
+    sum = (unsigned int *) malloc((size_t) bw * bh * sizeof(unsigned int));
+    sumsq = (unsigned int *) malloc((size_t) bw * bh * sizeof(unsigned int));
+    cols = (int *) calloc(bw, sizeof(int));
+    rows = (int *) calloc(bh, sizeof(int));
+    if (sum == NULL || sumsq == NULL || cols == NULL || rows == NULL) {
+        fprintf(stderr, "could not allocate foreground blocks\n");
+        goto err_out;
+    }
+
+    bc_block_stats(idata, iw, ih, sum, sumsq);
+    for (by = 0; by < bh; by++) {
+        for (bx = 0; bx < bw; bx++) {
+            // Variance times 256 * 256, kept in integers.
+            var = 256LL * sumsq[by * bw + bx] - (long long) sum[by * bw + bx] * sum[by * bw + bx];
+            if (var >= 65536LL * FOREGROUND_STDDEV * FOREGROUND_STDDEV) {
+                cols[bx]++;
+                rows[by]++;
+            }
+        }
+    }
+
+    for (bx0 = 0; bx0 < bw && cols[bx0] < FOREGROUND_MIN_BLOCKS; bx0++);
+    for (bx1 = bw - 1; bx1 >= bx0 && cols[bx1] < FOREGROUND_MIN_BLOCKS; bx1--);
+    for (by0 = 0; by0 < bh && rows[by0] < FOREGROUND_MIN_BLOCKS; by0++);
+    for (by1 = bh - 1; by1 >= by0 && rows[by1] < FOREGROUND_MIN_BLOCKS; by1--);
+    ret = 0;
+    if (bx0 > bx1 || by0 > by1)
+        goto err_out;
+
+    // The partial blocks past the last full one were never measured; keep
+    // them when the foreground reaches that far.
+    *x = bx0 * 16;
+    *w = bx1 == bw - 1 ? iw : (bx1 + 1) * 16;
+    *y = by0 * 16;
+    *h = by1 == bh - 1 ? ih : (by1 + 1) * 16;
+    margin = (int) ceil(CROP_MARGIN_MM * ippmm);
+    pad_range(x, w, margin, iw);
+    pad_range(y, h, margin, ih);
+    *w -= *x;
+    *h -= *y;
+    ret = (double) *w * *h <= CROP_MAX_AREA * iw * ih;
+
+    err_out:
+    free(sum);
+    free(sumsq);
+    free(cols);
+    free(rows);
+    return ret;
+}
+
+int get_minutiae_cropped(MINUTIAE **ominutiae, unsigned char *idata, int iw, int ih,
+                         double ippmm, int nthreads, bc_arena *scratch) {
+    MINUTIAE *minutiae;
+    MINUTIA *m;
+    unsigned char *cdata;
+    int cx, cy, cw, ch, y, i;
+    int ret;
+
+    if ((ret = find_foreground(idata, iw, ih, ippmm, &cx, &cy, &cw, &ch)) < 0)
+        return -1;
+    if (ret == 0)
+        return get_minutiae_only(ominutiae, idata, iw, ih, ippmm, nthreads, scratch);
+
+    if ((cdata = (unsigned char *) bc_arena_alloc(scratch, (size_t) cw * ch)) == NULL) {
+        fprintf(stderr, "could not allocate foreground crop\n");
+        return -1;
+    }
+    for (y = 0; y < ch; y++)
+        memcpy(cdata + (size_t) y * cw, idata + (size_t) (cy + y) * iw + cx, cw);
+    if ((ret = get_minutiae_only(&minutiae, cdata, cw, ch, ippmm, nthreads, scratch)) != 0)
+        return ret;
+
+    // Back to image coordinates; the order and neighbor indices still hold.
+    for (i = 0; i < minutiae->num; i++) {
+        m = minutiae->list[i];
+        m->x += cx;
+        m->y += cy;
+        m->ex += cx;
+        m->ey += cy;
+    }
+    *ominutiae = minutiae;
+    return 0;
+}
@@ -0,0 +1,47 @@
+#ifndef BIOMETRICAL_CONVERTER_EXTRACT_H
+#define BIOMETRICAL_CONVERTER_EXTRACT_H
+
+#include <lfs.h>
+#include "arena.h"
+
+/*
+ * Detect minutiae and their qualities in an 8-bit grayscale image, like
+ * get_minutiae() without returning the maps or the binarized image. The
+ * block DFTs and the directional binarization run on the SIMD kernels in
+ * simd.h, like bc_dft_dir_powers() and bc_binarize(), split into bands of
+ * block rows on up to nthreads threads; the result is the same as NBIS's
+ * for any nthreads. The padded and binarized images, the block maps and the
+ * DFT working memory are carved from scratch and stay there until the
+ * caller resets it, so a context's arena serves them without malloc once it
+ * has grown to fit. The result is released with free_minutiae().
+ */
+extern int get_minutiae_only(MINUTIAE **ominutiae, unsigned char *idata, int iw, int ih,
+                             double ippmm, int nthreads, bc_arena *scratch);
+
+/*
+ * NBIS dft_dir_powers() on bc_dft_powers(), with the same arguments and
+ * results. pdata must extend BC_DFT_SLACK bytes past its pw x ph pixels.
+ */
+extern int bc_dft_dir_powers(double **powers, unsigned char *pdata, int blkoffset, int pw, int ph,
+                             const DFTWAVES *dftwaves, const ROTGRIDS *dftgrids);
+
+/*
+ * NBIS binarize_V2() on bc_dirbin_block(), with the same arguments and
+ * results: the padded 6-bit image binarized along each block's direction,
+ * then its holes filled.
+ */
+extern int bc_binarize(unsigned char **odata, int *ow, int *oh, unsigned char *pdata, int pw, int ph,
+                       int *direction_map, int mw, int mh, const ROTGRIDS *dirbingrids,
+                       const LFSPARMS *lfsparms);
+
+/*
+ * Detect minutiae only inside the fingerprint's bounding box, found from the
+ * contrast of 16x16 blocks, so that blank background around a small print
+ * costs no LFS work. The crop runs through get_minutiae_only() with
+ * nthreads and scratch; images mostly covered by the print are processed
+ * whole. Minutiae are returned in image coordinates.
+ */
+extern int get_minutiae_cropped(MINUTIAE **ominutiae, unsigned char *idata, int iw, int ih,
+                                double ippmm, int nthreads, bc_arena *scratch);
+
+#endif //BIOMETRICAL_CONVERTER_EXTRACT_H
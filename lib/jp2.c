@@ -0,0 +1,241 @@
+#include "jp2.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <openjpeg.h>
+
+// Input bytes read by the OpenJPEG stream callbacks.
+typedef struct {
+    const unsigned char *data;
+    OPJ_SIZE_T len;
+    OPJ_SIZE_T pos;
+} bc_jp2_src;
+
+static OPJ_SIZE_T
+src_read(void *buf, OPJ_SIZE_T n, void *arg) {
+    bc_jp2_src *src = (bc_jp2_src *) arg;
+
+    if (src->pos >= src->len)
+        return (OPJ_SIZE_T) -1;
+    if (n > src->len - src->pos)
+        n = src->len - src->pos;
+    memcpy(buf, src->data + src->pos, n);
+    src->pos += n;
+    return n;
+}
+
+static OPJ_OFF_T
+src_skip(OPJ_OFF_T n, void *arg) {
+    bc_jp2_src *src = (bc_jp2_src *) arg;
+
+    if (n < 0 || (OPJ_SIZE_T) n > src->len - src->pos)
+        return -1;
+    src->pos += (OPJ_SIZE_T) n;
+    return n;
+}
+
+static OPJ_BOOL
+src_seek(OPJ_OFF_T pos, void *arg) {
+    bc_jp2_src *src = (bc_jp2_src *) arg;
+
+    if (pos < 0 || (OPJ_SIZE_T) pos > src->len)
+        return OPJ_FALSE;
+    src->pos = (OPJ_SIZE_T) pos;
+    return OPJ_TRUE;
+}
+
+static void
+print_error(const char *msg, void *arg) {
+    (void) arg;
+    fprintf(stderr, "openjpeg: %s", msg);
+}
+
+static int
+be16(const unsigned char *p) {
+    return (p[0] << 8) | p[1];
+}
+
+static unsigned long long
+be32(const unsigned char *p) {
+    return ((unsigned long long) p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+/*
+ * Find the box of type in p[0, len), returning its contents and their
+ * length, or NULL.
+ */
+static const unsigned char *
+find_box(const unsigned char *p, unsigned long long len, const char *type, unsigned long long *olen) {
+    unsigned long long pos = 0, size, head;
+
+    while (pos + 8 <= len) {
+        size = be32(p + pos);
+        head = 8;
+        if (size == 1) {
+            if (pos + 16 > len)
+                return NULL;
+            size = (be32(p + pos + 8) << 32) | be32(p + pos + 12);
+            head = 16;
+        } else if (size == 0) {
+            size = len - pos;
+        }
+        if (size < head || size > len - pos)
+            return NULL;
+        if (memcmp(p + pos + 4, type, 4) == 0) {
+            *olen = size - head;
+            return p + pos + head;
+        }
+        pos += size;
+    }
+    return NULL;
+}
+
+/*
+ * Horizontal resolution from the JP2 capture resolution box, or the display
+ * one without it, in grid points per metre converted to inches. -1 when
+ * there is none, as for a raw codestream.
+ */
+static int
+jp2_ppi(const unsigned char *p, int len) {
+    const unsigned char *box, *res;
+    unsigned long long blen, rlen;
+    double ppm;
+    int num, den, exp;
+
+    if ((box = find_box(p, (unsigned long long) len, "jp2h", &blen)) == NULL ||
+        (res = find_box(box, blen, "res ", &rlen)) == NULL)
+        return -1;
+    if (((box = find_box(res, rlen, "resc", &blen)) == NULL || blen < 10) &&
+        ((box = find_box(res, rlen, "resd", &blen)) == NULL || blen < 10))
+        return -1;
+    num = be16(box + 4);
+    den = be16(box + 6);
+    exp = (signed char) box[9];
+    if (num == 0 || den == 0)
+        return -1;
+    ppm = (double) num / den;
+    for (; exp > 0; exp--)
+        ppm *= 10;
+    for (; exp < 0; exp++)
+        ppm /= 10;
+    return (int) (ppm * 0.0254 + 0.5);
+}
+
+// Sample of a component as 8 bits.
+static unsigned char
+sample8(const opj_image_comp_t *comp, size_t i) {
+    int v = comp->data[i];
+
+    if (comp->sgnd)
+        v += 1 << (comp->prec - 1);
+    if (comp->prec > 8)
+        v >>= comp->prec - 8;
+    else if (comp->prec < 8)
+        v <<= 8 - comp->prec;
+    return (unsigned char) (v < 0 ? 0 : v > 255 ? 255 : v);
+}
+
+int bc_jp2_decode(const unsigned char *idata, int ilen, int threads, int reduce, int target_ppi,
+                  unsigned char **odata, int *ow, int *oh, int *od, int *oppi, int *opw, int *oph) {
+    static const unsigned char jp2_sig[12] = {0, 0, 0, 12, 'j', 'P', ' ', ' ', 13, 10, 0x87, 10};
+    opj_dparameters_t params;
+    opj_codec_t *codec = NULL;
+    opj_stream_t *stream = NULL;
+    opj_image_t *image = NULL;
+    opj_codestream_info_v2_t *info;
+    bc_jp2_src src;
+    unsigned char *pixels = NULL;
+    int ppi, levels, comps, pw, ph, c;
+    size_t i, n;
+    int ret = -1;
+
+    ppi = jp2_ppi(idata, ilen);
+    if (reduce == 0 && target_ppi > 0 && ppi > 0)
+        while ((long long) target_ppi << (reduce + 1) <= ppi)
+            reduce++;
+
+    codec = opj_create_decompress(ilen >= 12 && memcmp(idata, jp2_sig, 12) == 0 ? OPJ_CODEC_JP2 : OPJ_CODEC_J2K);
+    stream = opj_stream_create(OPJ_J2K_STREAM_CHUNK_SIZE, OPJ_TRUE);
+    if (codec == NULL || stream == NULL) {
+        fprintf(stderr, "could not start JPEG 2000 decoder\n");
+        goto err_out;
+    }
+    opj_set_error_handler(codec, print_error, NULL);
+    opj_set_default_decoder_parameters(&params);
+    if (!opj_setup_decoder(codec, &params))
+        goto err_out;
+    // Without thread support in OpenJPEG this fails, and decoding stays on
+    // the calling thread.
+    if (threads > 1)
+        opj_codec_set_threads(codec, threads);
+
+    src.data = idata;
+    src.len = (OPJ_SIZE_T) ilen;
+    src.pos = 0;
+    opj_stream_set_user_data(stream, &src, NULL);
+    opj_stream_set_user_data_length(stream, (OPJ_UINT64) ilen);
+    opj_stream_set_read_function(stream, src_read);
+    opj_stream_set_skip_function(stream, src_skip);
+    opj_stream_set_seek_function(stream, src_seek);
+
+    if (!opj_read_header(stream, codec, &image)) {
+        fprintf(stderr, "cannot read JPEG 2000 header\n");
+        goto err_out;
+    }
+    if (reduce > 0) {
+        // The lowest resolution level cannot be discarded.
+        if ((info = opj_get_cstr_info(codec)) == NULL)
+            goto err_out;
+        levels = (int) info->m_default_tile_info.tccp_info[0].numresolutions - 1;
+        opj_destroy_cstr_info(&info);
+        if (reduce > levels)
+            reduce = levels;
+        if (!opj_set_decoded_resolution_factor(codec, (OPJ_UINT32) reduce))
+            goto err_out;
+    }
+    if (!opj_decode(codec, stream, image) || !opj_end_decompress(codec, stream)) {
+        fprintf(stderr, "cannot decode JPEG 2000 image\n");
+        goto err_out;
+    }
+
+    if (image->numcomps < 1)
+        goto err_out;
+    comps = image->numcomps >= 3 ? 3 : 1;
+    pw = (int) image->comps[0].w;
+    ph = (int) image->comps[0].h;
+    for (c = 1; c < comps; c++) {
+        if (image->comps[c].w != image->comps[0].w || image->comps[c].h != image->comps[0].h) {
+            fprintf(stderr, "unsupported subsampled JPEG 2000 components\n");
+            goto err_out;
+        }
+    }
+
+    n = (size_t) pw * ph;
+    if ((pixels = (unsigned char *) malloc(n * comps)) == NULL) {
+        fprintf(stderr, "could not allocate %d x %d JPEG 2000 pixels\n", pw, ph);
+        goto err_out;
+    }
+    for (c = 0; c < comps; c++)
+        for (i = 0; i < n; i++)
+            pixels[i * comps + c] = sample8(&image->comps[c], i);
+
+    *odata = pixels;
+    pixels = NULL;
+    *ow = (int) (image->x1 - image->x0);
+    *oh = (int) (image->y1 - image->y0);
+    *od = comps * 8;
+    *oppi = ppi;
+    *opw = pw;
+    *oph = ph;
+    ret = 0;
+
+    err_out:
+    free(pixels);
+    if (image != NULL)
+        opj_image_destroy(image);
+    if (stream != NULL)
+        opj_stream_destroy(stream);
+    if (codec != NULL)
+        opj_destroy_codec(codec);
+    return ret;
+}
@@ -0,0 +1,19 @@
+#ifndef BIOMETRICAL_CONVERTER_JP2_H
+#define BIOMETRICAL_CONVERTER_JP2_H
+
+/*
+ * Decode a JPEG 2000 image (JP2 file or raw J2K codestream) with OpenJPEG on
+ * up to threads threads. The image is w x h at ppi (-1 when the JP2
+ * resolution boxes do not say). Grayscale images decode to 8 bits and color
+ * images to interleaved 24-bit RGB; deeper samples are scaled down to 8
+ * bits. reduce discards that many wavelet levels, halving the size each
+ * time; with reduce = 0, target_ppi > 0 and a known resolution, as many
+ * levels are discarded as keep the result at or above target_ppi. Either
+ * way no more levels are discarded than the codestream has. pw x ph is the
+ * size of the pixels returned, which are released with free(). Returns 0 on
+ * success.
+ */
+extern int bc_jp2_decode(const unsigned char *idata, int ilen, int threads, int reduce, int target_ppi,
+                         unsigned char **odata, int *ow, int *oh, int *od, int *oppi, int *opw, int *oph);
+
+#endif //BIOMETRICAL_CONVERTER_JP2_H
@@ -0,0 +1,97 @@
+#include "jpeg.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <turbojpeg.h>
+
+// Largest DCT scaling denominator used; libjpeg-turbo always supports 1/2
+// and 1/4.
+#define MAX_REDUCE 4
+
+/*
+ * Resolution from the JFIF APP0 segment, as NBIS reads it: density in dots
+ * per inch, or per cm converted to inches. -1 when there is none.
+ */
+static int
+jfif_ppi(const unsigned char *p, int len) {
+    int i = 2, seg, density;
+
+    if (len < 4 || p[0] != 0xFF || p[1] != 0xD8)
+        return -1;
+    // Walk the segments before the first frame; JFIF must come first, but
+    // some writers put other APPn segments ahead of it.
+    while (i + 4 <= len && p[i] == 0xFF && p[i + 1] >= 0xE0 && p[i + 1] <= 0xEF) {
+        seg = (p[i + 2] << 8) | p[i + 3];
+        if (p[i + 1] == 0xE0 && seg >= 14 && i + 2 + seg <= len &&
+            p[i + 4] == 'J' && p[i + 5] == 'F' && p[i + 6] == 'I' && p[i + 7] == 'F' && p[i + 8] == 0) {
+            density = (p[i + 12] << 8) | p[i + 13];
+            switch (p[i + 11]) {
+                case 1:
+                    return density;
+                case 2:
+                    return (int) (density * 2.54 + 0.5);
+                default:
+                    return -1;
+            }
+        }
+        i += 2 + seg;
+    }
+    return -1;
+}
+
+int bc_jpeg_decode(const unsigned char *idata, int ilen, int target_ppi, unsigned char **odata,
+                   int *ow, int *oh, int *od, int *oppi, int *opw, int *oph) {
+    tjhandle tj;
+    tjscalingfactor scale = {1, 1};
+    unsigned char *pixels = NULL;
+    int w, h, subsamp, colorspace, ppi, pw, ph, comps;
+    int ret = -1;
+
+    if ((tj = tjInitDecompress()) == NULL) {
+        fprintf(stderr, "could not start JPEG decoder: %s\n", tjGetErrorStr2(NULL));
+        return -1;
+    }
+    if (tjDecompressHeader3(tj, idata, (unsigned long) ilen, &w, &h, &subsamp, &colorspace) != 0) {
+        fprintf(stderr, "cannot read JPEG header: %s\n", tjGetErrorStr2(tj));
+        goto err_out;
+    }
+    if (colorspace == TJCS_CMYK || colorspace == TJCS_YCCK) {
+        fprintf(stderr, "unsupported JPEG color space %d\n", colorspace);
+        goto err_out;
+    }
+    comps = colorspace == TJCS_GRAY ? 1 : 3;
+
+    ppi = jfif_ppi(idata, ilen);
+    if (target_ppi > 0 && ppi > 0) {
+        for (scale.denom = MAX_REDUCE; scale.denom > 1; scale.denom /= 2)
+            if (ppi >= (long long) target_ppi * scale.denom)
+                break;
+    }
+    pw = TJSCALED(w, scale);
+    ph = TJSCALED(h, scale);
+
+    if ((pixels = (unsigned char *) malloc((size_t) pw * ph * comps)) == NULL) {
+        fprintf(stderr, "could not allocate %d x %d JPEG pixels\n", pw, ph);
+        goto err_out;
+    }
+    // The decoder picks the scaling factor that gives pw x ph.
+    if (tjDecompress2(tj, idata, (unsigned long) ilen, pixels, pw, 0, ph,
+                      comps == 1 ? TJPF_GRAY : TJPF_RGB, 0) != 0) {
+        fprintf(stderr, "cannot decode JPEG: %s\n", tjGetErrorStr2(tj));
+        goto err_out;
+    }
+
+    *odata = pixels;
+    pixels = NULL;
+    *ow = w;
+    *oh = h;
+    *od = comps * 8;
+    *oppi = ppi;
+    *opw = pw;
+    *oph = ph;
+    ret = 0;
+
+    err_out:
+    free(pixels);
+    tjDestroy(tj);
+    return ret;
+}
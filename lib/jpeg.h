@@ -0,0 +1,16 @@
+#ifndef BIOMETRICAL_CONVERTER_JPEG_H
+#define BIOMETRICAL_CONVERTER_JPEG_H
+
+/*
+ * Decode a baseline JPEG with libjpeg-turbo. The image is w x h at ppi (-1
+ * when the JFIF header does not say); grayscale images decode to 8 bits and
+ * color images to interleaved 24-bit RGB. With target_ppi > 0 and a known
+ * resolution, the decoder scales down by 1/2 or 1/4 in the DCT domain while
+ * the result stays at or above target_ppi, and pw x ph is the size of the
+ * pixels returned; otherwise it equals w x h. The pixels are released with
+ * free(). Returns 0 on success.
+ */
+extern int bc_jpeg_decode(const unsigned char *idata, int ilen, int target_ppi, unsigned char **odata,
+                          int *ow, int *oh, int *od, int *oppi, int *opw, int *oph);
+
+#endif //BIOMETRICAL_CONVERTER_JPEG_H
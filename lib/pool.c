@@ -0,0 +1,142 @@
+#include "pool.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+// A worker's share of the tasks. The owner pops from head, thieves take
+// from tail; the lock is only contended while stealing.
+typedef struct {
+    pthread_mutex_t lock;
+    int *tasks;
+    int head;
+    int tail;
+} bc_deque;
+
+typedef struct {
+    bc_deque *deques;
+    int nworkers;
+    bc_task_fn fn;
+    void *arg;
+} bc_pool;
+
+typedef struct {
+    bc_pool *pool;
+    int id;
+} bc_worker;
+
+static int
+pop_task(bc_deque *deque, int *task) {
+    int found = 0;
+
+    pthread_mutex_lock(&deque->lock);
+    if (deque->head < deque->tail) {
+        *task = deque->tasks[deque->head++];
+        found = 1;
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return found;
+}
+
+static int
+steal_task(bc_pool *pool, int self, int *task) {
+    bc_deque *victim;
+    int i, found = 0;
+
+    for (i = 1; i < pool->nworkers && !found; i++) {
+        victim = &pool->deques[(self + i) % pool->nworkers];
+        pthread_mutex_lock(&victim->lock);
+        if (victim->head < victim->tail) {
+            *task = victim->tasks[--victim->tail];
+            found = 1;
+        }
+        pthread_mutex_unlock(&victim->lock);
+    }
+    return found;
+}
+
+static void *
+worker_main(void *arg) {
+    bc_worker *worker = (bc_worker *) arg;
+    bc_pool *pool = worker->pool;
+    int task;
+
+    while (pop_task(&pool->deques[worker->id], &task) ||
+           steal_task(pool, worker->id, &task))
+        pool->fn(pool->arg, worker->id, task);
+    return NULL;
+}
+
+int bc_pool_default_workers(void) {
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+    return n > 0 ? (int) n : 1;
+}
+
+int bc_pool_run(int nworkers, int ntasks, const int *order, bc_task_fn fn, void *arg) {
+    bc_pool pool;
+    bc_worker *workers = NULL;
+    pthread_t *threads = NULL;
+    int *started = NULL;
+    int *tasks = NULL;
+    int w, t, k, offset;
+    int retval = -1;
+
+    if (ntasks <= 0)
+        return 0;
+    if (nworkers > ntasks)
+        nworkers = ntasks;
+    if (nworkers <= 1) {
+        for (t = 0; t < ntasks; t++)
+            fn(arg, 0, order[t]);
+        return 0;
+    }
+
+    pool.nworkers = nworkers;
+    pool.fn = fn;
+    pool.arg = arg;
+    pool.deques = (bc_deque *) calloc(nworkers, sizeof(bc_deque));
+    workers = (bc_worker *) calloc(nworkers, sizeof(bc_worker));
+    threads = (pthread_t *) calloc(nworkers, sizeof(pthread_t));
+    started = (int *) calloc(nworkers, sizeof(int));
+    tasks = (int *) malloc(ntasks * sizeof(int));
+    if (pool.deques == NULL || workers == NULL || threads == NULL ||
+        started == NULL || tasks == NULL)
+        goto err_out;
+
+    // Deal the tasks round-robin so every worker starts on the highest
+    // priority tasks that are left.
+    offset = 0;
+    for (w = 0; w < nworkers; w++) {
+        pthread_mutex_init(&pool.deques[w].lock, NULL);
+        pool.deques[w].tasks = tasks + offset;
+        pool.deques[w].head = 0;
+        k = 0;
+        for (t = w; t < ntasks; t += nworkers)
+            tasks[offset + k++] = order[t];
+        pool.deques[w].tail = k;
+        offset += k;
+        workers[w].pool = &pool;
+        workers[w].id = w;
+    }
+
+    // Tasks of a worker whose thread cannot be started are stolen by the
+    // others, so a failed pthread_create only costs parallelism.
+    for (w = 1; w < nworkers; w++)
+        started[w] = pthread_create(&threads[w], NULL, worker_main, &workers[w]) == 0;
+    worker_main(&workers[0]);
+    for (w = 1; w < nworkers; w++)
+        if (started[w])
+            pthread_join(threads[w], NULL);
+
+    for (w = 0; w < nworkers; w++)
+        pthread_mutex_destroy(&pool.deques[w].lock);
+    retval = 0;
+
+    err_out:
+    free(pool.deques);
+    free(workers);
+    free(threads);
+    free(started);
+    free(tasks);
+    return retval;
+}
@@ -0,0 +1,21 @@
+#ifndef BIOMETRICAL_CONVERTER_POOL_H
+#define BIOMETRICAL_CONVERTER_POOL_H
+
+/*
+ * Runs one task; worker identifies the calling worker (0 .. nworkers-1) so
+ * tasks can use per-worker state without locking.
+ */
+typedef void (*bc_task_fn)(void *arg, int worker, int task);
+
+/*
+ * Run tasks 0 .. ntasks-1 on up to nworkers threads, the calling thread being
+ * worker 0. order lists the tasks by priority: they are dealt round-robin to
+ * the workers' deques, each worker takes its own tasks front to back and an
+ * idle worker steals from the back of another worker's deque. Returns once
+ * every task has run, or -1 if nothing could be set up.
+ */
+extern int bc_pool_run(int nworkers, int ntasks, const int *order, bc_task_fn fn, void *arg);
+
+extern int bc_pool_default_workers(void);
+
+#endif //BIOMETRICAL_CONVERTER_POOL_H
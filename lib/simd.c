@@ -0,0 +1,1041 @@
+#include "simd.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define BC_SIMD_X86
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#define BC_SIMD_NEON
+#include <arm_neon.h>
+#endif
+
+// Luma of one pixel. The weights sum to 256, so the sum fits in 16 bits,
+// which the vector versions rely on.
+#define GRAY(r, g, b) ((unsigned char) ((77 * (r) + 150 * (g) + 29 * (b) + 128) >> 8))
+
+// Rounded mean of a 2x2 block.
+#define MEAN4(a, b, c, d) ((unsigned char) (((a) + (b) + (c) + (d) + 2) >> 2))
+
+// Largest binarization grid whose sums of 8-bit pixels, and the center row
+// sum times the grid height, fit in signed 16-bit lanes.
+#define DIRBIN_MAX_TAPS 128
+
+// Binarized pixel values, as in NBIS.
+#define DIRBIN_BLACK 0
+#define DIRBIN_WHITE 255
+
+/*
+ * Four adjacent output columns of an area resample, read from the 16 source
+ * pixels at base. For tap i, byte 4k of shuf[i] is the offset of the pixel
+ * that column k reads, and the other bytes are 0x80. The offset is also 0x80
+ * for padding taps past a column's span. A byte shuffle then spreads the
+ * pixels into 32-bit lanes. weight[i][k] is that pixel's 16.16 weight.
+ */
+typedef struct {
+    int base;
+    const unsigned char (*shuf)[16];
+    const unsigned int (*weight)[4];
+} bc_area_group;
+
+typedef struct {
+    const char *name;
+    void (*rgb_to_gray)(const unsigned char *rgb, unsigned char *gray, size_t n);
+    // n output pixels from 2n pixels of two source rows.
+    void (*halve_row)(const unsigned char *r0, const unsigned char *r1, unsigned char *dst, size_t n);
+    // Add the pixel sum and sum of squares of every 16-pixel block of a row.
+    void (*block_row)(const unsigned char *row, size_t nblocks, unsigned int *sum, unsigned int *sumsq);
+    void (*dft_powers)(const unsigned char *blk, int *const *grids, int ngrids, int n,
+                       const double *waves, double *powers);
+    // Binarize an nx x ny block; grids are at most DIRBIN_MAX_TAPS pixels.
+    void (*dirbin_block)(const unsigned char *src, int src_stride, unsigned char *dst, int dst_stride,
+                         int nx, int ny, const int *grid, int grid_w, int grid_h, int cy);
+    void (*filter_lines)(const bc_filter_step *steps, int nsteps, const float *src, float *dst,
+                         int stride, int nlines);
+    void (*unquantize)(const short *q, float *dst, size_t n, float bin, float center);
+    // Horizontal area sums of n groups over one source row, 4n values; NULL
+    // where summing column by column is as fast.
+    void (*area_row)(const unsigned char *row, const bc_area_group *groups, size_t n, int taps,
+                     unsigned int *dst);
+} bc_kernels;
+
+static void
+rgb_to_gray_scalar(const unsigned char *rgb, unsigned char *gray, size_t n) {
+    size_t i;
+
+    for (i = 0; i < n; i++, rgb += 3)
+        gray[i] = GRAY(rgb[0], rgb[1], rgb[2]);
+}
+
+static void
+halve_row_scalar(const unsigned char *r0, const unsigned char *r1, unsigned char *dst, size_t n) {
+    size_t i;
+
+    for (i = 0; i < n; i++)
+        dst[i] = MEAN4(r0[2 * i], r0[2 * i + 1], r1[2 * i], r1[2 * i + 1]);
+}
+
+static void
+block_row_scalar(const unsigned char *row, size_t nblocks, unsigned int *sum, unsigned int *sumsq) {
+    unsigned int s, q;
+    size_t b, i;
+
+    for (b = 0; b < nblocks; b++, row += 16) {
+        s = q = 0;
+        for (i = 0; i < 16; i++) {
+            s += row[i];
+            q += row[i] * row[i];
+        }
+        sum[b] += s;
+        sumsq[b] += q;
+    }
+}
+
+// Sum of the n pixels at offsets from p; integer, so any order is exact.
+static inline int
+grid_row_sum(const unsigned char *p, const int *offsets, int n) {
+    int i, sum = 0;
+
+    for (i = 0; i < n; i++)
+        sum += p[offsets[i]];
+    return sum;
+}
+
+/*
+ * The DFT sums are doubles, so every version accumulates each wave's terms
+ * in row order with a separate multiply and add, exactly like NBIS
+ * dft_power(). The vector versions only run the waves side by side.
+ */
+static void
+dft_powers_scalar(const unsigned char *blk, int *const *grids, int ngrids, int n,
+                  const double *waves, double *powers) {
+    double c[BC_DFT_WAVES], s[BC_DFT_WAVES];
+    const double *wv;
+    int d, i, w, sum;
+
+    for (d = 0; d < ngrids; d++, powers += BC_DFT_WAVES) {
+        for (w = 0; w < BC_DFT_WAVES; w++)
+            c[w] = s[w] = 0.0;
+        for (i = 0, wv = waves; i < n; i++, wv += 2 * BC_DFT_WAVES) {
+            sum = grid_row_sum(blk, grids[d] + i * n, n);
+            for (w = 0; w < BC_DFT_WAVES; w++) {
+                c[w] += sum * wv[w];
+                s[w] += sum * wv[BC_DFT_WAVES + w];
+            }
+        }
+        for (w = 0; w < BC_DFT_WAVES; w++)
+            powers[w] = c[w] * c[w] + s[w] * s[w];
+    }
+}
+
+static void
+dirbin_block_scalar(const unsigned char *src, int src_stride, unsigned char *dst, int dst_stride,
+                    int nx, int ny, const int *grid, int grid_w, int grid_h, int cy) {
+    const unsigned char *p;
+    int x, y, gy, rsum, gsum, csum;
+
+    for (y = 0; y < ny; y++) {
+        for (x = 0; x < nx; x++) {
+            p = src + (size_t) y * src_stride + x;
+            gsum = csum = 0;
+            for (gy = 0; gy < grid_h; gy++) {
+                rsum = grid_row_sum(p, grid + gy * grid_w, grid_w);
+                gsum += rsum;
+                if (gy == cy)
+                    csum = rsum;
+            }
+            dst[(size_t) y * dst_stride + x] = csum * grid_h < gsum ? DIRBIN_BLACK : DIRBIN_WHITE;
+        }
+    }
+}
+
+/*
+ * The vector versions run one line per lane; like here, each step is a
+ * separate multiply (two when scaled) and add, in NBIS join_lets() order.
+ */
+static void
+filter_lines_scalar(const bc_filter_step *steps, int nsteps, const float *src, float *dst,
+                    int stride, int nlines) {
+    const bc_filter_step *st, *end = steps + nsteps;
+    float *d;
+    int l;
+
+    for (l = 0; l < nlines; l++) {
+        for (st = steps; st < end; st++) {
+            d = dst + (size_t) st->dst * stride + l;
+            if (st->src < 0)
+                *d = 0.0f;
+            else if (st->scaled)
+                *d += src[(size_t) st->src * stride + l] * st->coef * st->sfac;
+            else
+                *d += src[(size_t) st->src * stride + l] * st->coef;
+        }
+    }
+}
+
+// The product is a float and the half bin a double, as in NBIS.
+static void
+unquantize_scalar(const short *q, float *dst, size_t n, float bin, float center) {
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        if (q[i] == 0)
+            dst[i] = 0.0f;
+        else if (q[i] > 0)
+            dst[i] = (float) ((bin * ((float) q[i] - center)) + (bin / 2.0));
+        else
+            dst[i] = (float) ((bin * ((float) q[i] + center)) - (bin / 2.0));
+    }
+}
+
+static const bc_kernels scalar_kernels = {"scalar", rgb_to_gray_scalar, halve_row_scalar, block_row_scalar,
+                                          dft_powers_scalar, dirbin_block_scalar, filter_lines_scalar,
+                                          unquantize_scalar, NULL};
+
+#ifdef BC_SIMD_X86
+
+#define SSE41 __attribute__((target("sse4.1")))
+#define AVX2 __attribute__((target("avx2")))
+
+// Split 16 interleaved RGB pixels (48 bytes) into one 16-byte plane each.
+static inline SSE41 void
+deinterleave16_sse41(const unsigned char *p, __m128i *r, __m128i *g, __m128i *b) {
+    __m128i a0 = _mm_loadu_si128((const __m128i *) p);
+    __m128i a1 = _mm_loadu_si128((const __m128i *) (p + 16));
+    __m128i a2 = _mm_loadu_si128((const __m128i *) (p + 32));
+
+    *r = _mm_or_si128(_mm_or_si128(
+            _mm_shuffle_epi8(a0, _mm_setr_epi8(0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1)),
+            _mm_shuffle_epi8(a1, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14, -1, -1, -1, -1, -1))),
+            _mm_shuffle_epi8(a2, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 1, 4, 7, 10, 13)));
+    *g = _mm_or_si128(_mm_or_si128(
+            _mm_shuffle_epi8(a0, _mm_setr_epi8(1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1)),
+            _mm_shuffle_epi8(a1, _mm_setr_epi8(-1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1))),
+            _mm_shuffle_epi8(a2, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14)));
+    *b = _mm_or_si128(_mm_or_si128(
+            _mm_shuffle_epi8(a0, _mm_setr_epi8(2, 5, 8, 11, 14, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1)),
+            _mm_shuffle_epi8(a1, _mm_setr_epi8(-1, -1, -1, -1, -1, 1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1))),
+            _mm_shuffle_epi8(a2, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15)));
+}
+
+// 16 luma values from 16-bit channel values, before the final shift.
+static inline SSE41 __m128i
+weigh8_sse41(__m128i r, __m128i g, __m128i b) {
+    __m128i y = _mm_add_epi16(_mm_mullo_epi16(r, _mm_set1_epi16(77)),
+                              _mm_mullo_epi16(g, _mm_set1_epi16(150)));
+    y = _mm_add_epi16(y, _mm_mullo_epi16(b, _mm_set1_epi16(29)));
+    return _mm_srli_epi16(_mm_add_epi16(y, _mm_set1_epi16(128)), 8);
+}
+
+static SSE41 void
+rgb_to_gray_sse41(const unsigned char *rgb, unsigned char *gray, size_t n) {
+    const __m128i zero = _mm_setzero_si128();
+    __m128i r, g, b, lo, hi;
+    size_t i;
+
+    for (i = 0; i + 16 <= n; i += 16, rgb += 48) {
+        deinterleave16_sse41(rgb, &r, &g, &b);
+        lo = weigh8_sse41(_mm_unpacklo_epi8(r, zero), _mm_unpacklo_epi8(g, zero),
+                          _mm_unpacklo_epi8(b, zero));
+        hi = weigh8_sse41(_mm_unpackhi_epi8(r, zero), _mm_unpackhi_epi8(g, zero),
+                          _mm_unpackhi_epi8(b, zero));
+        _mm_storeu_si128((__m128i *) (gray + i), _mm_packus_epi16(lo, hi));
+    }
+    rgb_to_gray_scalar(rgb, gray + i, n - i);
+}
+
+static inline AVX2 __m256i
+weigh16_avx2(__m128i r, __m128i g, __m128i b) {
+    __m256i y = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_cvtepu8_epi16(r), _mm256_set1_epi16(77)),
+                                 _mm256_mullo_epi16(_mm256_cvtepu8_epi16(g), _mm256_set1_epi16(150)));
+    y = _mm256_add_epi16(y, _mm256_mullo_epi16(_mm256_cvtepu8_epi16(b), _mm256_set1_epi16(29)));
+    return _mm256_srli_epi16(_mm256_add_epi16(y, _mm256_set1_epi16(128)), 8);
+}
+
+static AVX2 void
+rgb_to_gray_avx2(const unsigned char *rgb, unsigned char *gray, size_t n) {
+    __m128i r, g, b;
+    __m256i y0, y1;
+    size_t i;
+
+    for (i = 0; i + 32 <= n; i += 32, rgb += 96) {
+        deinterleave16_sse41(rgb, &r, &g, &b);
+        y0 = weigh16_avx2(r, g, b);
+        deinterleave16_sse41(rgb + 48, &r, &g, &b);
+        y1 = weigh16_avx2(r, g, b);
+        // packus works per 128-bit lane; restore pixel order afterwards.
+        _mm256_storeu_si256((__m256i *) (gray + i),
+                            _mm256_permute4x64_epi64(_mm256_packus_epi16(y0, y1), 0xD8));
+    }
+    rgb_to_gray_sse41(rgb, gray + i, n - i);
+}
+
+// Sums of horizontal pixel pairs of both rows, 16 bits each.
+static inline SSE41 __m128i
+pair_sums_sse41(const unsigned char *r0, const unsigned char *r1) {
+    const __m128i ones = _mm_set1_epi8(1);
+
+    return _mm_add_epi16(_mm_maddubs_epi16(_mm_loadu_si128((const __m128i *) r0), ones),
+                         _mm_maddubs_epi16(_mm_loadu_si128((const __m128i *) r1), ones));
+}
+
+static SSE41 void
+halve_row_sse41(const unsigned char *r0, const unsigned char *r1, unsigned char *dst, size_t n) {
+    const __m128i two = _mm_set1_epi16(2);
+    __m128i lo, hi;
+    size_t i;
+
+    for (i = 0; i + 16 <= n; i += 16, r0 += 32, r1 += 32) {
+        lo = _mm_srli_epi16(_mm_add_epi16(pair_sums_sse41(r0, r1), two), 2);
+        hi = _mm_srli_epi16(_mm_add_epi16(pair_sums_sse41(r0 + 16, r1 + 16), two), 2);
+        _mm_storeu_si128((__m128i *) (dst + i), _mm_packus_epi16(lo, hi));
+    }
+    halve_row_scalar(r0, r1, dst + i, n - i);
+}
+
+static inline AVX2 __m256i
+pair_sums_avx2(const unsigned char *r0, const unsigned char *r1) {
+    const __m256i ones = _mm256_set1_epi8(1);
+
+    return _mm256_add_epi16(_mm256_maddubs_epi16(_mm256_loadu_si256((const __m256i *) r0), ones),
+                            _mm256_maddubs_epi16(_mm256_loadu_si256((const __m256i *) r1), ones));
+}
+
+static AVX2 void
+halve_row_avx2(const unsigned char *r0, const unsigned char *r1, unsigned char *dst, size_t n) {
+    const __m256i two = _mm256_set1_epi16(2);
+    __m256i lo, hi;
+    size_t i;
+
+    for (i = 0; i + 32 <= n; i += 32, r0 += 64, r1 += 64) {
+        lo = _mm256_srli_epi16(_mm256_add_epi16(pair_sums_avx2(r0, r1), two), 2);
+        hi = _mm256_srli_epi16(_mm256_add_epi16(pair_sums_avx2(r0 + 32, r1 + 32), two), 2);
+        _mm256_storeu_si256((__m256i *) (dst + i),
+                            _mm256_permute4x64_epi64(_mm256_packus_epi16(lo, hi), 0xD8));
+    }
+    halve_row_sse41(r0, r1, dst + i, n - i);
+}
+
+static SSE41 void
+block_row_sse41(const unsigned char *row, size_t nblocks, unsigned int *sum, unsigned int *sumsq) {
+    const __m128i zero = _mm_setzero_si128();
+    __m128i v, s, lo, hi, q;
+    size_t b;
+
+    for (b = 0; b < nblocks; b++, row += 16) {
+        v = _mm_loadu_si128((const __m128i *) row);
+        // Two 64-bit sums of 8 pixels each.
+        s = _mm_sad_epu8(v, zero);
+        lo = _mm_unpacklo_epi8(v, zero);
+        hi = _mm_unpackhi_epi8(v, zero);
+        q = _mm_add_epi32(_mm_madd_epi16(lo, lo), _mm_madd_epi16(hi, hi));
+        q = _mm_add_epi32(q, _mm_shuffle_epi32(q, 0x4E));
+        q = _mm_add_epi32(q, _mm_shuffle_epi32(q, 0xB1));
+        sum[b] += (unsigned int) (_mm_cvtsi128_si32(s) + _mm_extract_epi32(s, 2));
+        sumsq[b] += (unsigned int) _mm_cvtsi128_si32(q);
+    }
+}
+
+// Waves 0-1 and 2-3 of two grids at a time, so four independent sums per
+// wave pair keep the adders busy.
+static SSE41 void
+dft_powers_sse41(const unsigned char *blk, int *const *grids, int ngrids, int n,
+                 const double *waves, double *powers) {
+    __m128d c0, c1, s0, s1, e0, e1, t0, t1, r, q, wc0, wc1, ws0, ws1;
+    const double *wv;
+    int d, i;
+
+    for (d = 0; d + 2 <= ngrids; d += 2, powers += 2 * BC_DFT_WAVES) {
+        c0 = c1 = s0 = s1 = e0 = e1 = t0 = t1 = _mm_setzero_pd();
+        for (i = 0, wv = waves; i < n; i++, wv += 2 * BC_DFT_WAVES) {
+            wc0 = _mm_loadu_pd(wv);
+            wc1 = _mm_loadu_pd(wv + 2);
+            ws0 = _mm_loadu_pd(wv + BC_DFT_WAVES);
+            ws1 = _mm_loadu_pd(wv + BC_DFT_WAVES + 2);
+            r = _mm_set1_pd((double) grid_row_sum(blk, grids[d] + i * n, n));
+            q = _mm_set1_pd((double) grid_row_sum(blk, grids[d + 1] + i * n, n));
+            c0 = _mm_add_pd(c0, _mm_mul_pd(r, wc0));
+            c1 = _mm_add_pd(c1, _mm_mul_pd(r, wc1));
+            s0 = _mm_add_pd(s0, _mm_mul_pd(r, ws0));
+            s1 = _mm_add_pd(s1, _mm_mul_pd(r, ws1));
+            e0 = _mm_add_pd(e0, _mm_mul_pd(q, wc0));
+            e1 = _mm_add_pd(e1, _mm_mul_pd(q, wc1));
+            t0 = _mm_add_pd(t0, _mm_mul_pd(q, ws0));
+            t1 = _mm_add_pd(t1, _mm_mul_pd(q, ws1));
+        }
+        _mm_storeu_pd(powers, _mm_add_pd(_mm_mul_pd(c0, c0), _mm_mul_pd(s0, s0)));
+        _mm_storeu_pd(powers + 2, _mm_add_pd(_mm_mul_pd(c1, c1), _mm_mul_pd(s1, s1)));
+        _mm_storeu_pd(powers + BC_DFT_WAVES, _mm_add_pd(_mm_mul_pd(e0, e0), _mm_mul_pd(t0, t0)));
+        _mm_storeu_pd(powers + BC_DFT_WAVES + 2, _mm_add_pd(_mm_mul_pd(e1, e1), _mm_mul_pd(t1, t1)));
+    }
+    dft_powers_scalar(blk, grids + d, ngrids - d, n, waves, powers);
+}
+
+// Eight pixels of one row per step, the sums in 16-bit lanes.
+static SSE41 void
+dirbin_block_sse41(const unsigned char *src, int src_stride, unsigned char *dst, int dst_stride,
+                   int nx, int ny, const int *grid, int grid_w, int grid_h, int cy) {
+    const __m128i white = _mm_set1_epi16(DIRBIN_WHITE);
+    const unsigned char *p;
+    __m128i rsum, gsum, csum, black;
+    int x, y, gx, gy;
+
+    for (y = 0; y < ny; y++) {
+        for (x = 0; x + 8 <= nx; x += 8) {
+            p = src + (size_t) y * src_stride + x;
+            gsum = csum = _mm_setzero_si128();
+            for (gy = 0; gy < grid_h; gy++) {
+                rsum = _mm_setzero_si128();
+                for (gx = 0; gx < grid_w; gx++)
+                    rsum = _mm_add_epi16(rsum, _mm_cvtepu8_epi16(
+                            _mm_loadl_epi64((const __m128i *) (p + grid[gy * grid_w + gx]))));
+                gsum = _mm_add_epi16(gsum, rsum);
+                if (gy == cy)
+                    csum = rsum;
+            }
+            black = _mm_cmplt_epi16(_mm_mullo_epi16(csum, _mm_set1_epi16((short) grid_h)), gsum);
+            _mm_storel_epi64((__m128i *) (dst + (size_t) y * dst_stride + x),
+                             _mm_packus_epi16(_mm_andnot_si128(black, white), white));
+        }
+        dirbin_block_scalar(src + (size_t) y * src_stride + x, src_stride, dst + (size_t) y * dst_stride + x,
+                            dst_stride, nx - x, 1, grid, grid_w, grid_h, cy);
+    }
+}
+
+// Gathers 32 bits per pixel and keeps the low byte, hence BC_DFT_SLACK.
+static inline AVX2 int
+grid_row_sum_avx2(const unsigned char *p, const int *offsets, int n) {
+    const __m256i low = _mm256_set1_epi32(0xFF);
+    __m256i acc = _mm256_setzero_si256();
+    __m128i sum;
+    int i;
+
+    for (i = 0; i + 8 <= n; i += 8)
+        acc = _mm256_add_epi32(acc, _mm256_and_si256(low, _mm256_i32gather_epi32(
+                (const int *) p, _mm256_loadu_si256((const __m256i *) (offsets + i)), 1)));
+    sum = _mm_add_epi32(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0x4E));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0xB1));
+    return _mm_cvtsi128_si32(sum) + grid_row_sum(p, offsets + i, n - i);
+}
+
+static AVX2 void
+dft_powers_avx2(const unsigned char *blk, int *const *grids, int ngrids, int n,
+                const double *waves, double *powers) {
+    __m256d c0, s0, c1, s1, r, q, wc, ws;
+    const double *wv;
+    int d, i;
+
+    for (d = 0; d + 2 <= ngrids; d += 2, powers += 2 * BC_DFT_WAVES) {
+        c0 = s0 = c1 = s1 = _mm256_setzero_pd();
+        for (i = 0, wv = waves; i < n; i++, wv += 2 * BC_DFT_WAVES) {
+            wc = _mm256_loadu_pd(wv);
+            ws = _mm256_loadu_pd(wv + BC_DFT_WAVES);
+            r = _mm256_set1_pd((double) grid_row_sum_avx2(blk, grids[d] + i * n, n));
+            q = _mm256_set1_pd((double) grid_row_sum_avx2(blk, grids[d + 1] + i * n, n));
+            c0 = _mm256_add_pd(c0, _mm256_mul_pd(r, wc));
+            s0 = _mm256_add_pd(s0, _mm256_mul_pd(r, ws));
+            c1 = _mm256_add_pd(c1, _mm256_mul_pd(q, wc));
+            s1 = _mm256_add_pd(s1, _mm256_mul_pd(q, ws));
+        }
+        _mm256_storeu_pd(powers, _mm256_add_pd(_mm256_mul_pd(c0, c0), _mm256_mul_pd(s0, s0)));
+        _mm256_storeu_pd(powers + BC_DFT_WAVES, _mm256_add_pd(_mm256_mul_pd(c1, c1), _mm256_mul_pd(s1, s1)));
+    }
+    dft_powers_scalar(blk, grids + d, ngrids - d, n, waves, powers);
+}
+
+// Four lines at a time.
+static SSE41 void
+filter_lines_sse41(const bc_filter_step *steps, int nsteps, const float *src, float *dst,
+                   int stride, int nlines) {
+    const bc_filter_step *st, *end = steps + nsteps;
+    __m128 x;
+    float *d;
+    int l;
+
+    for (l = 0; l + 4 <= nlines; l += 4) {
+        for (st = steps; st < end; st++) {
+            d = dst + (size_t) st->dst * stride + l;
+            if (st->src < 0) {
+                _mm_storeu_ps(d, _mm_setzero_ps());
+                continue;
+            }
+            x = _mm_mul_ps(_mm_loadu_ps(src + (size_t) st->src * stride + l), _mm_set1_ps(st->coef));
+            if (st->scaled)
+                x = _mm_mul_ps(x, _mm_set1_ps(st->sfac));
+            _mm_storeu_ps(d, _mm_add_ps(_mm_loadu_ps(d), x));
+        }
+    }
+    filter_lines_scalar(steps, nsteps, src + l, dst + l, stride, nlines - l);
+}
+
+// Four results from four coefficients sign-extended to 32 bits.
+static inline SSE41 __m128
+unquantize4_sse41(__m128i qi, __m128 bin, __m128 center, __m128d half) {
+    __m128 f = _mm_cvtepi32_ps(qi);
+    __m128 neg = _mm_castsi128_ps(_mm_cmplt_epi32(qi, _mm_setzero_si128()));
+    __m128 nonzero = _mm_castsi128_ps(_mm_xor_si128(_mm_cmpeq_epi32(qi, _mm_setzero_si128()),
+                                                    _mm_set1_epi32(-1)));
+    __m128 p = _mm_mul_ps(bin, _mm_blendv_ps(_mm_sub_ps(f, center), _mm_add_ps(f, center), neg));
+    // Subtracting the half bin is adding its negation.
+    __m128 sign = _mm_blendv_ps(_mm_set1_ps(1.0f), _mm_set1_ps(-1.0f), neg);
+    __m128d lo = _mm_add_pd(_mm_cvtps_pd(p), _mm_mul_pd(_mm_cvtps_pd(sign), half));
+    __m128d hi = _mm_add_pd(_mm_cvtps_pd(_mm_movehl_ps(p, p)),
+                            _mm_mul_pd(_mm_cvtps_pd(_mm_movehl_ps(sign, sign)), half));
+
+    return _mm_and_ps(_mm_movelh_ps(_mm_cvtpd_ps(lo), _mm_cvtpd_ps(hi)), nonzero);
+}
+
+static SSE41 void
+unquantize_sse41(const short *q, float *dst, size_t n, float bin, float center) {
+    const __m128 vbin = _mm_set1_ps(bin), vcenter = _mm_set1_ps(center);
+    const __m128d half = _mm_set1_pd(bin / 2.0);
+    size_t i;
+
+    for (i = 0; i + 4 <= n; i += 4)
+        _mm_storeu_ps(dst + i, unquantize4_sse41(_mm_cvtepi16_epi32(_mm_loadl_epi64((const __m128i *) (q + i))),
+                                                 vbin, vcenter, half));
+    unquantize_scalar(q + i, dst + i, n - i, bin, center);
+}
+
+static AVX2 void
+filter_lines_avx2(const bc_filter_step *steps, int nsteps, const float *src, float *dst,
+                  int stride, int nlines) {
+    const bc_filter_step *st, *end = steps + nsteps;
+    __m256 x;
+    float *d;
+    int l;
+
+    for (l = 0; l + 8 <= nlines; l += 8) {
+        for (st = steps; st < end; st++) {
+            d = dst + (size_t) st->dst * stride + l;
+            if (st->src < 0) {
+                _mm256_storeu_ps(d, _mm256_setzero_ps());
+                continue;
+            }
+            x = _mm256_mul_ps(_mm256_loadu_ps(src + (size_t) st->src * stride + l), _mm256_set1_ps(st->coef));
+            if (st->scaled)
+                x = _mm256_mul_ps(x, _mm256_set1_ps(st->sfac));
+            _mm256_storeu_ps(d, _mm256_add_ps(_mm256_loadu_ps(d), x));
+        }
+    }
+    filter_lines_sse41(steps, nsteps, src + l, dst + l, stride, nlines - l);
+}
+
+static AVX2 void
+unquantize_avx2(const short *q, float *dst, size_t n, float bin, float center) {
+    const __m256 vbin = _mm256_set1_ps(bin), vcenter = _mm256_set1_ps(center);
+    const __m256 one = _mm256_set1_ps(1.0f), minus = _mm256_set1_ps(-1.0f);
+    const __m256d half = _mm256_set1_pd(bin / 2.0);
+    __m256i qi;
+    __m256 f, neg, nonzero, p, sign;
+    __m256d lo, hi;
+    size_t i;
+
+    for (i = 0; i + 8 <= n; i += 8) {
+        qi = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *) (q + i)));
+        f = _mm256_cvtepi32_ps(qi);
+        neg = _mm256_castsi256_ps(_mm256_cmpgt_epi32(_mm256_setzero_si256(), qi));
+        nonzero = _mm256_castsi256_ps(_mm256_xor_si256(_mm256_cmpeq_epi32(qi, _mm256_setzero_si256()),
+                                                       _mm256_set1_epi32(-1)));
+        p = _mm256_mul_ps(vbin, _mm256_blendv_ps(_mm256_sub_ps(f, vcenter), _mm256_add_ps(f, vcenter), neg));
+        sign = _mm256_blendv_ps(one, minus, neg);
+        lo = _mm256_add_pd(_mm256_cvtps_pd(_mm256_castps256_ps128(p)),
+                           _mm256_mul_pd(_mm256_cvtps_pd(_mm256_castps256_ps128(sign)), half));
+        hi = _mm256_add_pd(_mm256_cvtps_pd(_mm256_extractf128_ps(p, 1)),
+                           _mm256_mul_pd(_mm256_cvtps_pd(_mm256_extractf128_ps(sign, 1)), half));
+        _mm256_storeu_ps(dst + i, _mm256_and_ps(_mm256_insertf128_ps(
+                _mm256_castps128_ps256(_mm256_cvtpd_ps(lo)), _mm256_cvtpd_ps(hi), 1), nonzero));
+    }
+    unquantize_sse41(q + i, dst + i, n - i, bin, center);
+}
+
+static SSE41 void
+area_row_sse41(const unsigned char *row, const bc_area_group *groups, size_t n, int taps,
+               unsigned int *dst) {
+    const bc_area_group *g;
+    __m128i px, acc;
+    size_t j;
+    int i;
+
+    for (j = 0, g = groups; j < n; j++, g++) {
+        px = _mm_loadu_si128((const __m128i *) (row + g->base));
+        acc = _mm_setzero_si128();
+        for (i = 0; i < taps; i++)
+            acc = _mm_add_epi32(acc, _mm_mullo_epi32(
+                    _mm_shuffle_epi8(px, _mm_loadu_si128((const __m128i *) g->shuf[i])),
+                    _mm_loadu_si128((const __m128i *) g->weight[i])));
+        _mm_storeu_si128((__m128i *) (dst + 4 * j), acc);
+    }
+}
+
+// Two groups per vector, one in each 128-bit lane, as the byte shuffle
+// works within lanes.
+static AVX2 void
+area_row_avx2(const unsigned char *row, const bc_area_group *groups, size_t n, int taps,
+              unsigned int *dst) {
+    const bc_area_group *g;
+    __m256i px, acc, shuf, weight;
+    size_t j;
+    int i;
+
+    for (j = 0, g = groups; j + 2 <= n; j += 2, g += 2) {
+        px = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i *) (row + g[0].base))),
+                                     _mm_loadu_si128((const __m128i *) (row + g[1].base)), 1);
+        acc = _mm256_setzero_si256();
+        for (i = 0; i < taps; i++) {
+            shuf = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i *) g[0].shuf[i])),
+                                           _mm_loadu_si128((const __m128i *) g[1].shuf[i]), 1);
+            weight = _mm256_inserti128_si256(
+                    _mm256_castsi128_si256(_mm_loadu_si128((const __m128i *) g[0].weight[i])),
+                    _mm_loadu_si128((const __m128i *) g[1].weight[i]), 1);
+            acc = _mm256_add_epi32(acc, _mm256_mullo_epi32(_mm256_shuffle_epi8(px, shuf), weight));
+        }
+        _mm256_storeu_si256((__m256i *) (dst + 4 * j), acc);
+    }
+    area_row_sse41(row, g, n - j, taps, dst + 4 * j);
+}
+
+static const bc_kernels sse41_kernels = {"sse4.1", rgb_to_gray_sse41, halve_row_sse41, block_row_sse41,
+                                         dft_powers_sse41, dirbin_block_sse41, filter_lines_sse41,
+                                         unquantize_sse41, area_row_sse41};
+// One block row is a single 128-bit vector, and eight pixels of a block row
+// share a direction, so AVX2 has nothing to add there.
+static const bc_kernels avx2_kernels = {"avx2", rgb_to_gray_avx2, halve_row_avx2, block_row_sse41,
+                                        dft_powers_avx2, dirbin_block_sse41, filter_lines_avx2,
+                                        unquantize_avx2, area_row_avx2};
+
+#endif // BC_SIMD_X86
+
+#ifdef BC_SIMD_NEON
+
+static void
+rgb_to_gray_neon(const unsigned char *rgb, unsigned char *gray, size_t n) {
+    uint8x16x3_t px;
+    uint16x8_t lo, hi;
+    size_t i;
+
+    for (i = 0; i + 16 <= n; i += 16, rgb += 48) {
+        px = vld3q_u8(rgb);
+        lo = vmull_u8(vget_low_u8(px.val[0]), vdup_n_u8(77));
+        lo = vmlal_u8(lo, vget_low_u8(px.val[1]), vdup_n_u8(150));
+        lo = vmlal_u8(lo, vget_low_u8(px.val[2]), vdup_n_u8(29));
+        hi = vmull_u8(vget_high_u8(px.val[0]), vdup_n_u8(77));
+        hi = vmlal_u8(hi, vget_high_u8(px.val[1]), vdup_n_u8(150));
+        hi = vmlal_u8(hi, vget_high_u8(px.val[2]), vdup_n_u8(29));
+        // Rounding narrow: (x + 128) >> 8.
+        vst1q_u8(gray + i, vcombine_u8(vrshrn_n_u16(lo, 8), vrshrn_n_u16(hi, 8)));
+    }
+    rgb_to_gray_scalar(rgb, gray + i, n - i);
+}
+
+static void
+halve_row_neon(const unsigned char *r0, const unsigned char *r1, unsigned char *dst, size_t n) {
+    uint16x8_t lo, hi;
+    size_t i;
+
+    for (i = 0; i + 16 <= n; i += 16, r0 += 32, r1 += 32) {
+        lo = vpadalq_u8(vpaddlq_u8(vld1q_u8(r0)), vld1q_u8(r1));
+        hi = vpadalq_u8(vpaddlq_u8(vld1q_u8(r0 + 16)), vld1q_u8(r1 + 16));
+        // Rounding narrow: (x + 2) >> 2.
+        vst1q_u8(dst + i, vcombine_u8(vrshrn_n_u16(lo, 2), vrshrn_n_u16(hi, 2)));
+    }
+    halve_row_scalar(r0, r1, dst + i, n - i);
+}
+
+static void
+block_row_neon(const unsigned char *row, size_t nblocks, unsigned int *sum, unsigned int *sumsq) {
+    uint8x16_t v;
+    uint64x2_t s;
+    uint32x4_t q;
+    size_t b;
+
+    for (b = 0; b < nblocks; b++, row += 16) {
+        v = vld1q_u8(row);
+        s = vpaddlq_u32(vpaddlq_u16(vpaddlq_u8(v)));
+        // A square of 8 bits fits in 16.
+        q = vpaddlq_u16(vmull_u8(vget_low_u8(v), vget_low_u8(v)));
+        q = vpadalq_u16(q, vmull_u8(vget_high_u8(v), vget_high_u8(v)));
+        sum[b] += (unsigned int) (vgetq_lane_u64(s, 0) + vgetq_lane_u64(s, 1));
+        sumsq[b] += vgetq_lane_u32(q, 0) + vgetq_lane_u32(q, 1) + vgetq_lane_u32(q, 2) + vgetq_lane_u32(q, 3);
+    }
+}
+
+#ifdef __aarch64__
+
+// Double lanes exist on AArch64 only; 32-bit NEON keeps the scalar DFT.
+static void
+dft_powers_neon(const unsigned char *blk, int *const *grids, int ngrids, int n,
+                const double *waves, double *powers) {
+    float64x2_t c0, c1, s0, s1, e0, e1, t0, t1, r, q, wc0, wc1, ws0, ws1;
+    const double *wv;
+    int d, i;
+
+    for (d = 0; d + 2 <= ngrids; d += 2, powers += 2 * BC_DFT_WAVES) {
+        c0 = c1 = s0 = s1 = e0 = e1 = t0 = t1 = vdupq_n_f64(0.0);
+        for (i = 0, wv = waves; i < n; i++, wv += 2 * BC_DFT_WAVES) {
+            wc0 = vld1q_f64(wv);
+            wc1 = vld1q_f64(wv + 2);
+            ws0 = vld1q_f64(wv + BC_DFT_WAVES);
+            ws1 = vld1q_f64(wv + BC_DFT_WAVES + 2);
+            r = vdupq_n_f64((double) grid_row_sum(blk, grids[d] + i * n, n));
+            q = vdupq_n_f64((double) grid_row_sum(blk, grids[d + 1] + i * n, n));
+            c0 = vaddq_f64(c0, vmulq_f64(r, wc0));
+            c1 = vaddq_f64(c1, vmulq_f64(r, wc1));
+            s0 = vaddq_f64(s0, vmulq_f64(r, ws0));
+            s1 = vaddq_f64(s1, vmulq_f64(r, ws1));
+            e0 = vaddq_f64(e0, vmulq_f64(q, wc0));
+            e1 = vaddq_f64(e1, vmulq_f64(q, wc1));
+            t0 = vaddq_f64(t0, vmulq_f64(q, ws0));
+            t1 = vaddq_f64(t1, vmulq_f64(q, ws1));
+        }
+        vst1q_f64(powers, vaddq_f64(vmulq_f64(c0, c0), vmulq_f64(s0, s0)));
+        vst1q_f64(powers + 2, vaddq_f64(vmulq_f64(c1, c1), vmulq_f64(s1, s1)));
+        vst1q_f64(powers + BC_DFT_WAVES, vaddq_f64(vmulq_f64(e0, e0), vmulq_f64(t0, t0)));
+        vst1q_f64(powers + BC_DFT_WAVES + 2, vaddq_f64(vmulq_f64(e1, e1), vmulq_f64(t1, t1)));
+    }
+    dft_powers_scalar(blk, grids + d, ngrids - d, n, waves, powers);
+}
+
+#else
+#define dft_powers_neon dft_powers_scalar
+#endif
+
+static void
+dirbin_block_neon(const unsigned char *src, int src_stride, unsigned char *dst, int dst_stride,
+                  int nx, int ny, const int *grid, int grid_w, int grid_h, int cy) {
+    const unsigned char *p;
+    uint16x8_t rsum, gsum, csum, black;
+    int x, y, gx, gy;
+
+    for (y = 0; y < ny; y++) {
+        for (x = 0; x + 8 <= nx; x += 8) {
+            p = src + (size_t) y * src_stride + x;
+            gsum = csum = vdupq_n_u16(0);
+            for (gy = 0; gy < grid_h; gy++) {
+                rsum = vdupq_n_u16(0);
+                for (gx = 0; gx < grid_w; gx++)
+                    rsum = vaddw_u8(rsum, vld1_u8(p + grid[gy * grid_w + gx]));
+                gsum = vaddq_u16(gsum, rsum);
+                if (gy == cy)
+                    csum = rsum;
+            }
+            black = vcltq_u16(vmulq_n_u16(csum, (uint16_t) grid_h), gsum);
+            vst1_u8(dst + (size_t) y * dst_stride + x, vmovn_u16(vbicq_u16(vdupq_n_u16(DIRBIN_WHITE), black)));
+        }
+        dirbin_block_scalar(src + (size_t) y * src_stride + x, src_stride, dst + (size_t) y * dst_stride + x,
+                            dst_stride, nx - x, 1, grid, grid_w, grid_h, cy);
+    }
+}
+
+static void
+filter_lines_neon(const bc_filter_step *steps, int nsteps, const float *src, float *dst,
+                  int stride, int nlines) {
+    const bc_filter_step *st, *end = steps + nsteps;
+    float32x4_t x;
+    float *d;
+    int l;
+
+    for (l = 0; l + 4 <= nlines; l += 4) {
+        for (st = steps; st < end; st++) {
+            d = dst + (size_t) st->dst * stride + l;
+            if (st->src < 0) {
+                vst1q_f32(d, vdupq_n_f32(0.0f));
+                continue;
+            }
+            x = vmulq_n_f32(vld1q_f32(src + (size_t) st->src * stride + l), st->coef);
+            if (st->scaled)
+                x = vmulq_n_f32(x, st->sfac);
+            vst1q_f32(d, vaddq_f32(vld1q_f32(d), x));
+        }
+    }
+    filter_lines_scalar(steps, nsteps, src + l, dst + l, stride, nlines - l);
+}
+
+#ifdef __aarch64__
+
+static void
+unquantize_neon(const short *q, float *dst, size_t n, float bin, float center) {
+    const float32x4_t vcenter = vdupq_n_f32(center);
+    const float64x2_t half = vdupq_n_f64(bin / 2.0);
+    int32x4_t qi;
+    uint32x4_t neg, nonzero;
+    float32x4_t f, p, sign;
+    float64x2_t lo, hi;
+    size_t i;
+
+    for (i = 0; i + 4 <= n; i += 4) {
+        qi = vmovl_s16(vld1_s16(q + i));
+        f = vcvtq_f32_s32(qi);
+        neg = vcltq_s32(qi, vdupq_n_s32(0));
+        nonzero = vmvnq_u32(vceqq_s32(qi, vdupq_n_s32(0)));
+        p = vmulq_n_f32(vbslq_f32(neg, vaddq_f32(f, vcenter), vsubq_f32(f, vcenter)), bin);
+        sign = vbslq_f32(neg, vdupq_n_f32(-1.0f), vdupq_n_f32(1.0f));
+        lo = vaddq_f64(vcvt_f64_f32(vget_low_f32(p)), vmulq_f64(vcvt_f64_f32(vget_low_f32(sign)), half));
+        hi = vaddq_f64(vcvt_high_f64_f32(p), vmulq_f64(vcvt_high_f64_f32(sign), half));
+        vst1q_f32(dst + i, vreinterpretq_f32_u32(vandq_u32(
+                vreinterpretq_u32_f32(vcvt_high_f32_f64(vcvt_f32_f64(lo), hi)), nonzero)));
+    }
+    unquantize_scalar(q + i, dst + i, n - i, bin, center);
+}
+
+// The table lookup returns 0 for the 0x80 offsets, like pshufb.
+static void
+area_row_neon(const unsigned char *row, const bc_area_group *groups, size_t n, int taps,
+              unsigned int *dst) {
+    const bc_area_group *g;
+    uint8x16_t px;
+    uint32x4_t acc;
+    size_t j;
+    int i;
+
+    for (j = 0, g = groups; j < n; j++, g++) {
+        px = vld1q_u8(row + g->base);
+        acc = vdupq_n_u32(0);
+        for (i = 0; i < taps; i++)
+            acc = vmlaq_u32(acc, vreinterpretq_u32_u8(vqtbl1q_u8(px, vld1q_u8(g->shuf[i]))),
+                            vld1q_u32(g->weight[i]));
+        vst1q_u32(dst + 4 * j, acc);
+    }
+}
+
+#else
+#define unquantize_neon unquantize_scalar
+#define area_row_neon NULL
+#endif
+
+static const bc_kernels neon_kernels = {"neon", rgb_to_gray_neon, halve_row_neon, block_row_neon,
+                                        dft_powers_neon, dirbin_block_neon, filter_lines_neon,
+                                        unquantize_neon, area_row_neon};
+
+#endif // BC_SIMD_NEON
+
+static const bc_kernels *kernels = &scalar_kernels;
+static pthread_once_t kernels_once = PTHREAD_ONCE_INIT;
+
+static void
+select_kernels(void) {
+#if defined(BC_SIMD_X86)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        kernels = &avx2_kernels;
+    else if (__builtin_cpu_supports("sse4.1"))
+        kernels = &sse41_kernels;
+#elif defined(BC_SIMD_NEON)
+    kernels = &neon_kernels;
+#endif
+}
+
+static const bc_kernels *
+get_kernels(void) {
+    pthread_once(&kernels_once, select_kernels);
+    return kernels;
+}
+
+void bc_rgb_to_gray(const unsigned char *rgb, unsigned char *gray, size_t n) {
+    get_kernels()->rgb_to_gray(rgb, gray, n);
+}
+
+void bc_halve(const unsigned char *src, int w, int h, unsigned char *dst) {
+    const bc_kernels *k = get_kernels();
+    int dw = w / 2, y;
+
+    for (y = 0; y < h / 2; y++)
+        k->halve_row(src + (size_t) 2 * y * w, src + (size_t) (2 * y + 1) * w, dst + (size_t) y * dw, dw);
+}
+
+void bc_block_stats(const unsigned char *src, int w, int h, unsigned int *sum, unsigned int *sumsq) {
+    const bc_kernels *k = get_kernels();
+    int bw = w / 16, bh = h / 16, y;
+
+    memset(sum, 0, (size_t) bw * bh * sizeof(unsigned int));
+    memset(sumsq, 0, (size_t) bw * bh * sizeof(unsigned int));
+    for (y = 0; y < bh * 16; y++)
+        k->block_row(src + (size_t) y * w, bw, sum + (size_t) (y / 16) * bw, sumsq + (size_t) (y / 16) * bw);
+}
+
+void bc_dft_powers(const unsigned char *blk, int *const *grids, int ngrids, int n,
+                   const double *waves, double *powers) {
+    get_kernels()->dft_powers(blk, grids, ngrids, n, waves, powers);
+}
+
+void bc_dirbin_block(const unsigned char *src, int src_stride, unsigned char *dst, int dst_stride,
+                     int nx, int ny, const int *grid, int grid_w, int grid_h, int cy) {
+    if (grid_w * grid_h > DIRBIN_MAX_TAPS)
+        dirbin_block_scalar(src, src_stride, dst, dst_stride, nx, ny, grid, grid_w, grid_h, cy);
+    else
+        get_kernels()->dirbin_block(src, src_stride, dst, dst_stride, nx, ny, grid, grid_w, grid_h, cy);
+}
+
+void bc_filter_lines(const bc_filter_step *steps, int nsteps, const float *src, float *dst,
+                     int stride, int nlines) {
+    get_kernels()->filter_lines(steps, nsteps, src, dst, stride, nlines);
+}
+
+void bc_unquantize(const short *q, float *dst, size_t n, float bin, float center) {
+    get_kernels()->unquantize(q, dst, n, bin, center);
+}
+
+/*
+ * Source span of every output pixel along one axis: first pixel, pixel
+ * count and 16.16 fixed-point weights that sum to 1 << 16.
+ */
+typedef struct {
+    int first;
+    int count;
+    unsigned int *weights;
+} bc_span;
+
+static bc_span *
+area_spans(int n, int dn, unsigned int **weights) {
+    bc_span *spans;
+    double scale = (double) n / dn, lo, hi, cover;
+    unsigned int *w, total;
+    int i, j, big, max = (int) scale + 2;
+
+    spans = (bc_span *) malloc(dn * sizeof(bc_span));
+    w = (unsigned int *) malloc((size_t) dn * max * sizeof(unsigned int));
+    if (spans == NULL || w == NULL) {
+        free(spans);
+        free(w);
+        return NULL;
+    }
+    *weights = w;
+    for (i = 0; i < dn; i++, w += max) {
+        lo = i * scale;
+        hi = lo + scale;
+        spans[i].first = (int) lo;
+        spans[i].count = 0;
+        spans[i].weights = w;
+        total = 0;
+        big = 0;
+        for (j = spans[i].first; j < n && j < hi; j++) {
+            cover = (j + 1 < hi ? j + 1 : hi) - (j > lo ? j : lo);
+            w[spans[i].count] = (unsigned int) (cover / scale * 65536.0 + 0.5);
+            if (w[spans[i].count] > w[big])
+                big = spans[i].count;
+            total += w[spans[i].count++];
+        }
+        // Put the rounding error on the largest weight so flat areas stay
+        // flat; a sliver at the span's edge may have rounded to 0.
+        w[big] += 65536 - total;
+    }
+    return spans;
+}
+
+/*
+ * Groups of four output columns for area_row(), from the left while their
+ * spans fit in 16 source pixels that can be read without passing the row
+ * end, which holds up to about 3.5:1. *taps is the longest span. Returns the
+ * number of groups; the columns after them are summed one at a time.
+ */
+static int
+area_groups(const bc_span *xs, int w, int dw, bc_area_group **groups, void **mem, int *taps) {
+    bc_area_group *g;
+    unsigned char (*shuf)[16];
+    unsigned int (*weight)[4];
+    int n, x, i, k, off;
+
+    *taps = 0;
+    for (n = 0; 4 * n + 4 <= dw; n++) {
+        x = 4 * n;
+        if (xs[x].first + 16 > w || xs[x + 3].first + xs[x + 3].count > xs[x].first + 16)
+            break;
+        for (k = 0; k < 4; k++)
+            if (xs[x + k].count > *taps)
+                *taps = xs[x + k].count;
+    }
+    *groups = NULL;
+    *mem = NULL;
+    if (n == 0)
+        return 0;
+    *mem = malloc((size_t) n * (sizeof(bc_area_group) + *taps * (sizeof(*shuf) + sizeof(*weight))));
+    if (*mem == NULL)
+        return -1;
+    g = *groups = (bc_area_group *) *mem;
+    weight = (unsigned int (*)[4]) (g + n);
+    shuf = (unsigned char (*)[16]) (weight + (size_t) n * *taps);
+    memset(shuf, 0x80, (size_t) n * *taps * sizeof(*shuf));
+    memset(weight, 0, (size_t) n * *taps * sizeof(*weight));
+    for (x = 0; x < 4 * n; x += 4, g++, shuf += *taps, weight += *taps) {
+        g->base = xs[x].first;
+        g->shuf = (const unsigned char (*)[16]) shuf;
+        g->weight = (const unsigned int (*)[4]) weight;
+        for (k = 0; k < 4; k++) {
+            off = xs[x + k].first - g->base;
+            for (i = 0; i < xs[x + k].count; i++) {
+                shuf[i][4 * k] = (unsigned char) (off + i);
+                weight[i][k] = xs[x + k].weights[i];
+            }
+        }
+    }
+    return n;
+}
+
+/*
+ * Separable: every source row of a span is summed horizontally, then the
+ * row sums are weighted vertically. All sums are exact integers, so this
+ * gives the same pixels as weighting each source pixel by both weights.
+ */
+int bc_resample_area(const unsigned char *src, int w, int h, unsigned char *dst, int dw, int dh) {
+    const bc_kernels *k = get_kernels();
+    bc_span *xs = NULL, *ys = NULL;
+    bc_area_group *groups;
+    unsigned int *xw = NULL, *yw = NULL, *hsum = NULL, sum;
+    unsigned long long *acc = NULL, v;
+    const unsigned char *row;
+    void *gmem = NULL;
+    int x, y, i, j, ngroups, taps, retval = -1;
+
+    if (dw <= 0 || dh <= 0 || dw > w || dh > h)
+        return -1;
+    xs = area_spans(w, dw, &xw);
+    ys = area_spans(h, dh, &yw);
+    hsum = (unsigned int *) malloc((size_t) dw * sizeof(unsigned int));
+    acc = (unsigned long long *) malloc((size_t) dw * sizeof(unsigned long long));
+    if (xs == NULL || ys == NULL || hsum == NULL || acc == NULL)
+        goto err_out;
+    ngroups = 0;
+    if (k->area_row != NULL && (ngroups = area_groups(xs, w, dw, &groups, &gmem, &taps)) < 0)
+        goto err_out;
+
+    for (y = 0; y < dh; y++) {
+        memset(acc, 0, (size_t) dw * sizeof(unsigned long long));
+        for (j = 0; j < ys[y].count; j++) {
+            row = src + (size_t) (ys[y].first + j) * w;
+            if (ngroups > 0)
+                k->area_row(row, groups, ngroups, taps, hsum);
+            for (x = 4 * ngroups; x < dw; x++) {
+                sum = 0;
+                for (i = 0; i < xs[x].count; i++)
+                    sum += xs[x].weights[i] * row[xs[x].first + i];
+                hsum[x] = sum;
+            }
+            for (x = 0; x < dw; x++)
+                acc[x] += (unsigned long long) ys[y].weights[j] * hsum[x];
+        }
+        for (x = 0; x < dw; x++) {
+            // The weights multiply to 1 << 32 in total.
+            v = (acc[x] + (1ULL << 31)) >> 32;
+            dst[(size_t) y * dw + x] = (unsigned char) (v > 255 ? 255 : v);
+        }
+    }
+    retval = 0;
+
+    err_out:
+    if (xs != NULL)
+        free(xw);
+    if (ys != NULL)
+        free(yw);
+    free(xs);
+    free(ys);
+    free(hsum);
+    free(acc);
+    free(gmem);
+    return retval;
+}
+
+const char *bc_simd_name(void) {
+    return get_kernels()->name;
+}
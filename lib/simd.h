@@ -0,0 +1,95 @@
+#ifndef BIOMETRICAL_CONVERTER_SIMD_H
+#define BIOMETRICAL_CONVERTER_SIMD_H
+
+#include <stddef.h>
+
+/*
+ * Pixel kernels with a scalar version and, where the compiler supports it,
+ * SSE4.1/AVX2 or NEON versions. The best version for the running CPU is
+ * picked on first use. All versions give bit-identical results.
+ */
+
+/* Interleaved RGB to 8-bit luma with BT.601 weights 77/150/29, rounded. */
+extern void bc_rgb_to_gray(const unsigned char *rgb, unsigned char *gray, size_t n);
+
+/*
+ * Halve both dimensions of 8-bit pixels with a rounded 2x2 mean; dst is
+ * (w / 2) x (h / 2) and an odd last row or column is dropped.
+ */
+extern void bc_halve(const unsigned char *src, int w, int h, unsigned char *dst);
+
+/*
+ * Shrink 8-bit pixels to dw x dh (at most w x h) by area averaging, for
+ * ratios bc_halve() does not cover. The horizontal sums run on the vector
+ * kernels for up to about 3.5:1 across; wider ratios, the last columns and
+ * the vertical pass are scalar. Returns -1 on bad sizes or when out of
+ * memory.
+ */
+extern int bc_resample_area(const unsigned char *src, int w, int h, unsigned char *dst, int dw, int dh);
+
+/*
+ * Pixel sum and sum of squares of every full 16x16 block of 8-bit pixels,
+ * row-major; sum and sumsq hold (w / 16) * (h / 16) values each and a
+ * partial last row or column of blocks is skipped.
+ */
+extern void bc_block_stats(const unsigned char *src, int w, int h, unsigned int *sum, unsigned int *sumsq);
+
+/* Waves bc_dft_powers() evaluates together; LFS uses four. */
+#define BC_DFT_WAVES 4
+
+/* Bytes bc_dft_powers() may read past the last pixel of a grid. */
+#define BC_DFT_SLACK 3
+
+/*
+ * DFT powers of one window of pixels along every rotated grid, as NBIS
+ * dft_dir_powers() computes them. Each grids[d] holds n x n offsets from
+ * blk, row by row; the pixels of a grid row are summed and the n row sums
+ * run through the waves. waves holds, for each of the n rows, the
+ * BC_DFT_WAVES cosine terms followed by the BC_DFT_WAVES sine terms; unused
+ * waves are zero. powers receives BC_DFT_WAVES values per grid.
+ */
+extern void bc_dft_powers(const unsigned char *blk, int *const *grids, int ngrids, int n,
+                          const double *waves, double *powers);
+
+/*
+ * Directional binarization of an nx x ny block, deciding each pixel like
+ * NBIS dirbinarize(): black (0) when the center row cy of the rotated grid
+ * sums to less than the grid's mean row, white (255) otherwise. grid holds
+ * grid_w x grid_h offsets from the pixel, row by row.
+ */
+extern void bc_dirbin_block(const unsigned char *src, int src_stride, unsigned char *dst, int dst_stride,
+                            int nx, int ny, const int *grid, int grid_w, int grid_h, int cy);
+
+/*
+ * One step of a 1-D filter pass, see bc_filter_lines(): dst is cleared when
+ * src is negative, otherwise x[src] * coef is added to it, multiplied by
+ * sfac first when scaled is set.
+ */
+typedef struct {
+    int dst;
+    int src;
+    float coef;
+    float sfac;
+    int scaled;
+} bc_filter_step;
+
+/*
+ * Run the steps over nlines lines side by side: line l reads its samples
+ * from src + l and writes them to dst + l, consecutive samples stride floats
+ * apart. Every line gets the float operations of the steps in their order,
+ * so all versions round alike.
+ */
+extern void bc_filter_lines(const bc_filter_step *steps, int nsteps, const float *src, float *dst,
+                            int stride, int nlines);
+
+/*
+ * Dequantize n WSQ coefficients of one subband like NBIS unquantize(): 0
+ * stays 0, others are moved by the bin center, scaled by the bin width and
+ * set to the middle of the bin, the last addition done in double.
+ */
+extern void bc_unquantize(const short *q, float *dst, size_t n, float bin, float center);
+
+/* Name of the kernel set in use: "avx2", "sse4.1", "neon" or "scalar". */
+extern const char *bc_simd_name(void);
+
+#endif //BIOMETRICAL_CONVERTER_SIMD_H
@@ -0,0 +1,358 @@
+#include "transcode.h"
+#include "converter.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/queue.h>
+#include <biomdi.h>
+#include <fmr.h>
+
+/*
+ * Field layouts, per format:
+ *
+ *   ANSI header   format id, version, length (2, or 0 then 4), CBEFF product
+ *                 id (4), capture equipment (2), image size and resolution
+ *                 (4 x 2), view count, reserved
+ *   ISO header    as ANSI without the CBEFF product id, length always 4
+ *   view          finger position, view/impression, quality, minutiae count,
+ *                 minutiae, extended data length (2) and data
+ *   minutia       ANSI/ISO: type:2 x:14, rsvd:2 y:14, angle, quality
+ *                 normal card: as ISO without quality, x/y in 0.01 mm
+ *                 compact card: x, y in 0.1 mm, type:2 angle:6
+ *
+ * Angles are 2 degree steps for ANSI, 256 steps per circle for ISO and the
+ * normal card, and 64 steps for the compact card. Extended data is dropped,
+ * as in fmr2fmr.
+ */
+
+typedef struct {
+    unsigned char cbeff[4];
+    unsigned char capture[2];
+    unsigned short x_size, y_size, x_res, y_res;
+    int num_views;
+} bc_fmr_header;
+
+typedef struct {
+    int header;             // record header length, 0 for cards
+    int minutia;            // bytes per minutia
+    int angle_steps;        // angle steps per full circle
+    int card;
+} bc_fmr_layout;
+
+#define GET16(p) ((unsigned short) (((p)[0] << 8) | (p)[1]))
+#define GET32(p) (((unsigned int) (p)[0] << 24) | ((unsigned int) (p)[1] << 16) | \
+                  ((unsigned int) (p)[2] << 8) | (unsigned int) (p)[3])
+#define PUT16(p, v) do { (p)[0] = (unsigned char) ((v) >> 8); (p)[1] = (unsigned char) (v); } while (0)
+#define PUT32(p, v) do { PUT16(p, (v) >> 16); PUT16((p) + 2, v); } while (0)
+
+#define COORD_MAX 0x3FFF
+
+/*
+ * Whether bc_fmr2fmr() converts in_type to out_type the way this file does.
+ * It copies records within one format and maps ANSI and ISO views onto each
+ * other, but runs card conversions through its ANSI view conversions, whose
+ * units this does not reproduce.
+ */
+static int
+same_as_biomdi(int in_type, int out_type) {
+    if (in_type == out_type)
+        return 1;
+    return (in_type == FMR_STD_ANSI && out_type == FMR_STD_ISO) ||
+           (in_type == FMR_STD_ISO && out_type == FMR_STD_ANSI);
+}
+
+static int
+get_layout(int type, bc_fmr_layout *layout) {
+    switch (type) {
+        case FMR_STD_ANSI:
+            layout->header = FMR_ANSI_SMALL_HEADER_LENGTH;
+            layout->minutia = FMD_DATA_LENGTH;
+            layout->angle_steps = 180;
+            layout->card = 0;
+            return 0;
+        case FMR_STD_ISO:
+            layout->header = FMR_ISO_HEADER_LENGTH;
+            layout->minutia = FMD_DATA_LENGTH;
+            layout->angle_steps = 256;
+            layout->card = 0;
+            return 0;
+        case FMR_STD_ISO_NORMAL_CARD:
+            layout->header = 0;
+            layout->minutia = FMD_ISO_NORMAL_CARD_DATA_LENGTH;
+            layout->angle_steps = 256;
+            layout->card = 1;
+            return 0;
+        case FMR_STD_ISO_COMPACT_CARD:
+            layout->header = 0;
+            layout->minutia = FMD_ISO_COMPACT_CARD_DATA_LENGTH;
+            layout->angle_steps = 64;
+            layout->card = 1;
+            return 0;
+        default:
+            return -1;
+    }
+}
+
+// Coordinate units per centimetre: the resolution for records, fixed
+// metric units for cards.
+static unsigned int
+coord_units(int type, unsigned int res) {
+    switch (type) {
+        case FMR_STD_ISO_NORMAL_CARD:
+            return 1000;
+        case FMR_STD_ISO_COMPACT_CARD:
+            return 100;
+        default:
+            return res;
+    }
+}
+
+static unsigned int
+rescale(unsigned int v, unsigned int from, unsigned int to, unsigned int max) {
+    unsigned long r;
+
+    if (from == to)
+        return v;
+    r = ((unsigned long) v * to * 2 + from) / ((unsigned long) from * 2);
+    return r > max ? max : (unsigned int) r;
+}
+
+/*
+ * Returns 0, -1 if the header is damaged, or TRANSCODE_UNSUPPORTED for a
+ * spec version other than the one the layouts above describe.
+ */
+static int
+read_header(const unsigned char *p, size_t ilen, int type, bc_fmr_header *hdr, size_t *pos) {
+    size_t len;
+
+    memset(hdr, 0, sizeof(*hdr));
+    if (ilen < FMR_ISO_HEADER_LENGTH || memcmp(p, FMR_FORMAT_ID, FMR_FORMAT_ID_LEN) != 0)
+        return -1;
+    p += FMR_FORMAT_ID_LEN;
+    if (memcmp(p, type == FMR_STD_ANSI ? FMR_ANSI_SPEC_VERSION : FMR_ISO_SPEC_VERSION,
+               FMR_SPEC_VERSION_LEN) != 0)
+        return TRANSCODE_UNSUPPORTED;
+    p += FMR_SPEC_VERSION_LEN;
+    if (type == FMR_STD_ANSI) {
+        len = GET16(p);
+        p += 2;
+        *pos = FMR_ANSI_SMALL_HEADER_LENGTH;
+        if (len == 0) {
+            if (ilen < FMR_ANSI_LARGE_HEADER_LENGTH)
+                return -1;
+            len = GET32(p);
+            p += 4;
+            *pos = FMR_ANSI_LARGE_HEADER_LENGTH;
+        }
+        if (ilen < *pos)
+            return -1;
+        memcpy(hdr->cbeff, p, 4);
+        p += 4;
+    } else {
+        len = GET32(p);
+        p += 4;
+        *pos = FMR_ISO_HEADER_LENGTH;
+    }
+    if (len > ilen)
+        return -1;
+    memcpy(hdr->capture, p, 2);
+    hdr->x_size = GET16(p + 2);
+    hdr->y_size = GET16(p + 4);
+    hdr->x_res = GET16(p + 6);
+    hdr->y_res = GET16(p + 8);
+    hdr->num_views = p[10];
+    return 0;
+}
+
+/*
+ * Walk the views of a record, or the single view of a card. Returns the
+ * number of minutiae over all views, or -1 if the input is truncated.
+ */
+static long
+count_minutiae(const unsigned char *idata, size_t ilen, size_t pos,
+               const bc_fmr_layout *in, int num_views) {
+    long total = 0;
+    size_t n;
+    int v;
+
+    if (in->card) {
+        if (ilen % in->minutia != 0)
+            return -1;
+        return (long) (ilen / in->minutia);
+    }
+    for (v = 0; v < num_views; v++) {
+        if (pos + FVMR_HEADER_LENGTH > ilen)
+            return -1;
+        n = idata[pos + 3];
+        pos += FVMR_HEADER_LENGTH + n * in->minutia;
+        if (pos + FEDB_HEADER_LENGTH > ilen)
+            return -1;
+        pos += FEDB_HEADER_LENGTH + GET16(idata + pos);
+        if (pos > ilen)
+            return -1;
+        total += (long) n;
+    }
+    return total;
+}
+
+static void
+transcode_minutia(const unsigned char *ip, int in_type, const bc_fmr_layout *in,
+                  unsigned char *op, int out_type, const bc_fmr_layout *out,
+                  unsigned int xres, unsigned int yres) {
+    unsigned int type, x, y, angle, quality = 0;
+    unsigned int max;
+
+    if (in_type == FMR_STD_ISO_COMPACT_CARD) {
+        x = ip[0];
+        y = ip[1];
+        type = ip[2] >> 6;
+        angle = ip[2] & 0x3F;
+    } else {
+        type = ip[0] >> 6;
+        x = GET16(ip) & COORD_MAX;
+        y = GET16(ip + 2) & COORD_MAX;
+        angle = ip[4];
+        if (!in->card)
+            quality = ip[5];
+    }
+
+    max = out_type == FMR_STD_ISO_COMPACT_CARD ? 0xFF : COORD_MAX;
+    x = rescale(x, coord_units(in_type, xres), coord_units(out_type, xres), max);
+    y = rescale(y, coord_units(in_type, yres), coord_units(out_type, yres), max);
+    angle = rescale(angle, in->angle_steps, out->angle_steps, 0xFFFF) % out->angle_steps;
+
+    if (out_type == FMR_STD_ISO_COMPACT_CARD) {
+        op[0] = (unsigned char) x;
+        op[1] = (unsigned char) y;
+        op[2] = (unsigned char) ((type << 6) | angle);
+    } else {
+        PUT16(op, (type << 14) | x);
+        PUT16(op + 2, y);
+        op[4] = (unsigned char) angle;
+        if (!out->card)
+            op[5] = (unsigned char) quality;
+    }
+}
+
+int transcode_fmr(const unsigned char *idata, size_t ilen, int in_type, int out_type,
+                  int xres, int yres, unsigned char *obuf, size_t osize, size_t *olen) {
+    bc_fmr_layout in, out;
+    bc_fmr_header hdr;
+    const unsigned char *ip;
+    unsigned char *op;
+    size_t pos = 0, len;
+    long total;
+    int num_views, v, m, n, out_views;
+    int ret;
+
+    if (get_layout(in_type, &in) != 0 || get_layout(out_type, &out) != 0)
+        return BC_ERR_ARGUMENT;
+    if (!same_as_biomdi(in_type, out_type))
+        return TRANSCODE_UNSUPPORTED;
+
+    if (in.card) {
+        memset(&hdr, 0, sizeof(hdr));
+        hdr.x_res = (unsigned short) xres;
+        hdr.y_res = (unsigned short) yres;
+        num_views = 1;
+    } else {
+        if ((ret = read_header(idata, ilen, in_type, &hdr, &pos)) != 0) {
+            if (ret == TRANSCODE_UNSUPPORTED)
+                return ret;
+            fprintf(stderr, "could not read %s record header\n",
+                    in_type == FMR_STD_ANSI ? "ANSI" : "ISO");
+            return BC_ERR_READ;
+        }
+        num_views = hdr.num_views;
+    }
+    if (in.card != out.card && (hdr.x_res == 0 || hdr.y_res == 0)) {
+        fprintf(stderr, "card conversion needs a resolution\n");
+        return BC_ERR_ARGUMENT;
+    }
+
+    if ((total = count_minutiae(idata, ilen, pos, &in, num_views)) < 0) {
+        fprintf(stderr, "truncated minutiae record\n");
+        return BC_ERR_READ;
+    }
+    if (in.card && total > FMR_MAX_NUM_MINUTIAE && !out.card) {
+        fprintf(stderr, "too many minutiae for one finger view\n");
+        return BC_ERR_FORMAT;
+    }
+
+    // Cards hold the minutiae of all views back to back; records get one
+    // view header and an empty extended data block per view.
+    out_views = in.card ? 1 : num_views;
+    len = (size_t) total * out.minutia;
+    if (!out.card) {
+        len += out.header + (size_t) out_views * (FVMR_HEADER_LENGTH + FEDB_HEADER_LENGTH);
+        if (out_type == FMR_STD_ANSI && len > 0xFFFF)
+            len += FMR_ANSI_LARGE_HEADER_LENGTH - FMR_ANSI_SMALL_HEADER_LENGTH;
+    }
+    *olen = len;
+    if (obuf == NULL || osize < len)
+        return BC_ERR_BUFFER_TOO_SMALL;
+
+    op = obuf;
+    if (!out.card) {
+        memcpy(op, FMR_FORMAT_ID, FMR_FORMAT_ID_LEN);
+        memcpy(op + FMR_FORMAT_ID_LEN,
+               out_type == FMR_STD_ANSI ? FMR_ANSI_SPEC_VERSION : FMR_ISO_SPEC_VERSION,
+               FMR_SPEC_VERSION_LEN);
+        op += FMR_FORMAT_ID_LEN + FMR_SPEC_VERSION_LEN;
+        if (out_type == FMR_STD_ANSI) {
+            if (len > 0xFFFF) {
+                PUT16(op, 0);
+                PUT32(op + 2, len);
+                op += 6;
+            } else {
+                PUT16(op, len);
+                op += 2;
+            }
+            memcpy(op, hdr.cbeff, 4);
+            op += 4;
+        } else {
+            PUT32(op, len);
+            op += 4;
+        }
+        memcpy(op, hdr.capture, 2);
+        PUT16(op + 2, hdr.x_size);
+        PUT16(op + 4, hdr.y_size);
+        PUT16(op + 6, hdr.x_res);
+        PUT16(op + 8, hdr.y_res);
+        op[10] = (unsigned char) out_views;
+        op[11] = 0;
+        op += 12;
+    }
+
+    for (v = 0; v < num_views; v++) {
+        if (in.card) {
+            ip = idata;
+            n = (int) total;
+        } else {
+            ip = idata + pos;
+            n = ip[3];
+        }
+        if (!out.card) {
+            if (in.card) {
+                memset(op, 0, FVMR_HEADER_LENGTH);
+                op[3] = (unsigned char) n;
+            } else {
+                memcpy(op, ip, FVMR_HEADER_LENGTH);
+            }
+            op += FVMR_HEADER_LENGTH;
+        }
+        if (!in.card)
+            ip += FVMR_HEADER_LENGTH;
+
+        for (m = 0; m < n; m++, ip += in.minutia, op += out.minutia)
+            transcode_minutia(ip, in_type, &in, op, out_type, &out, hdr.x_res, hdr.y_res);
+
+        if (!out.card) {
+            PUT16(op, 0);
+            op += FEDB_HEADER_LENGTH;
+        }
+        if (!in.card)
+            pos = (size_t) (ip - idata) + FEDB_HEADER_LENGTH + GET16(ip);
+    }
+    return BC_OK;
+}
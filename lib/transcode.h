@@ -0,0 +1,24 @@
+#ifndef BIOMETRICAL_CONVERTER_TRANSCODE_H
+#define BIOMETRICAL_CONVERTER_TRANSCODE_H
+
+#include <stddef.h>
+
+/*
+ * transcode_fmr() result for a conversion or spec version it does not
+ * handle; the caller converts those through biomdi instead.
+ */
+#define TRANSCODE_UNSUPPORTED 1
+
+/*
+ * Rewrite a minutiae record from one FMR_STD_* format to another in a single
+ * pass over the input bytes, without building an FMR object tree. Card
+ * formats carry no header, so their resolution comes from xres/yres. The
+ * output length is computed before anything is written; when osize is too
+ * small nothing is written and *olen holds the size needed. Only the
+ * conversions whose output is byte for byte that of bc_fmr2fmr() are done.
+ * Returns a BC_ERR_* code or TRANSCODE_UNSUPPORTED.
+ */
+extern int transcode_fmr(const unsigned char *idata, size_t ilen, int in_type, int out_type,
+                         int xres, int yres, unsigned char *obuf, size_t osize, size_t *olen);
+
+#endif //BIOMETRICAL_CONVERTER_TRANSCODE_H
@@ -0,0 +1,707 @@
+#include "wsqdec.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wsq.h>
+#include "simd.h"
+
+// Codes up to this long decode with one table lookup.
+#define FAST_BITS 9
+
+// Rows the inverse transform filters side by side in its row pass.
+#define ROW_BAND 16
+
+/*
+ * Decoding tables of one Huffman table: a direct lookup on the next
+ * FAST_BITS bits, and for longer codes the canonical-code bounds per length
+ * as in JPEG (ITU T.81 F.2.2.3).
+ */
+typedef struct {
+    unsigned short fast[1 << FAST_BITS];    // length << 8 | symbol; 0 = longer code
+    int maxcode[MAX_HUFFBITS + 1];          // largest code of each length, -1 if none
+    int mincode[MAX_HUFFBITS + 1];
+    int valptr[MAX_HUFFBITS + 1];           // index of the first symbol of each length
+    const unsigned char *values;
+} bc_huff;
+
+/*
+ * Entropy-coded data with the stuffed zero bytes removed. Bits are kept
+ * left-aligned in acc. A marker stops refilling; it takes effect when a
+ * code needs more bits than came before it.
+ */
+typedef struct {
+    const unsigned char *p, *end;
+    unsigned long long acc;
+    int nbits;
+    unsigned short marker;
+} bc_bits;
+
+static int
+build_huff(bc_huff *huff, const DHT_TABLE *dht) {
+    int len, i, k = 0, code = 0, fill;
+
+    memset(huff->fast, 0, sizeof(huff->fast));
+    huff->values = dht->huffvalues;
+    for (len = 1; len <= MAX_HUFFBITS; len++) {
+        huff->valptr[len] = k;
+        huff->mincode[len] = code;
+        for (i = 0; i < dht->huffbits[len - 1]; i++, k++, code++) {
+            if (code >= 1 << len || k >= MAX_HUFFCOUNTS_WSQ) {
+                fprintf(stderr, "ERROR : bc_wsq_decode : invalid Huffman table\n");
+                return -1;
+            }
+            if (len <= FAST_BITS) {
+                // Every FAST_BITS-bit pattern starting with this code.
+                for (fill = 0; fill < 1 << (FAST_BITS - len); fill++)
+                    huff->fast[(code << (FAST_BITS - len)) | fill] =
+                            (unsigned short) (len << 8 | dht->huffvalues[k]);
+            }
+        }
+        huff->maxcode[len] = dht->huffbits[len - 1] > 0 ? code - 1 : -1;
+        code <<= 1;
+    }
+    return 0;
+}
+
+static void
+refill(bc_bits *bits) {
+    unsigned char b;
+
+    while (bits->nbits <= 56 && bits->marker == 0 && bits->p < bits->end) {
+        b = *bits->p;
+        if (b == 0xFF) {
+            if (bits->p + 1 >= bits->end)
+                return;
+            if (bits->p[1] != 0x00) {
+                bits->marker = (unsigned short) (0xFF00 | bits->p[1]);
+                bits->p += 2;
+                return;
+            }
+            bits->p++;
+        }
+        bits->p++;
+        bits->acc |= (unsigned long long) b << (56 - bits->nbits);
+        bits->nbits += 8;
+    }
+}
+
+static void
+consume(bc_bits *bits, int n) {
+    bits->acc <<= n;
+    bits->nbits -= n;
+}
+
+/*
+ * Next symbol, or -1 when the block ended at a marker, or -2 on corrupt
+ * data.
+ */
+static int
+decode_symbol(bc_bits *bits, const bc_huff *huff) {
+    int e, len, code;
+
+    if (bits->nbits < MAX_HUFFBITS)
+        refill(bits);
+    e = huff->fast[bits->acc >> (64 - FAST_BITS)];
+    if (e != 0) {
+        len = e >> 8;
+        if (len > bits->nbits)
+            return bits->marker != 0 ? -1 : -2;
+        consume(bits, len);
+        return e & 0xFF;
+    }
+    for (len = FAST_BITS + 1; len <= MAX_HUFFBITS; len++) {
+        if (len > bits->nbits)
+            return bits->marker != 0 ? -1 : -2;
+        code = (int) (bits->acc >> (64 - len));
+        if (code <= huff->maxcode[len]) {
+            consume(bits, len);
+            return huff->values[huff->valptr[len] + code - huff->mincode[len]];
+        }
+    }
+    return -2;
+}
+
+// n (8 or 16) raw bits following an escape symbol, or -1.
+static int
+get_bits(bc_bits *bits, int n) {
+    int v;
+
+    refill(bits);
+    if (bits->nbits < n)
+        return -1;
+    v = (int) (bits->acc >> (64 - n));
+    consume(bits, n);
+    return v;
+}
+
+/*
+ * Huffman-decode the blocks following the frame header into qdata, as NBIS
+ * huffman_decode_data_mem() does. Symbols follow the WSQ specification:
+ * 1-100 are zero runs, 101-104 escape 8 or 16-bit coefficients, 105-106
+ * escape 8 or 16-bit zero runs, and 107-254 are coefficients offset by 180.
+ */
+static int
+decode_blocks(short *qdata, int npix, DTT_TABLE *dtt, DQT_TABLE *dqt, DHT_TABLE *dht,
+              unsigned char **cbufptr, unsigned char *ebufptr) {
+    bc_huff huff;
+    bc_bits bits;
+    unsigned short marker;
+    int blk = 0, ipc = 0, sym, v, n;
+    int ret;
+
+    if ((ret = getc_marker_wsq(&marker, TBLS_N_SOB, cbufptr, ebufptr)))
+        return ret;
+    while (marker != EOI_WSQ) {
+        if (marker != 0) {
+            blk++;
+            while (marker != SOB_WSQ) {
+                if ((ret = getc_table_wsq(marker, dtt, dqt, dht, cbufptr, ebufptr)))
+                    return ret;
+                if ((ret = getc_marker_wsq(&marker, TBLS_N_SOB, cbufptr, ebufptr)))
+                    return ret;
+            }
+            // Block header: length, then the Huffman table number.
+            if (ebufptr - *cbufptr < 3 || (*cbufptr)[2] >= MAX_DHT_TABLES ||
+                dht[(*cbufptr)[2]].tabdef != 1) {
+                fprintf(stderr, "ERROR : bc_wsq_decode : bad block header\n");
+                return -1;
+            }
+            if (build_huff(&huff, &dht[(*cbufptr)[2]]) != 0)
+                return -1;
+            *cbufptr += 3;
+            bits.p = *cbufptr;
+            bits.end = ebufptr;
+            bits.acc = 0;
+            bits.nbits = 0;
+            bits.marker = 0;
+            marker = 0;
+        }
+
+        if ((sym = decode_symbol(&bits, &huff)) == -1) {
+            // The block is done; unused bits before the marker are padding.
+            marker = bits.marker;
+            *cbufptr = (unsigned char *) bits.p;
+            while (marker == COM_WSQ && blk == 3) {
+                if ((ret = getc_table_wsq(marker, dtt, dqt, dht, cbufptr, ebufptr)))
+                    return ret;
+                if ((ret = getc_marker_wsq(&marker, ANY_WSQ, cbufptr, ebufptr)))
+                    return ret;
+            }
+            continue;
+        }
+        if (sym < 0)
+            goto corrupt;
+
+        if (sym > 0 && sym <= 100) {
+            n = sym;
+            v = 0;
+        } else if (sym > 106 && sym < 0xFF) {
+            n = 1;
+            v = sym - 180;
+        } else {
+            switch (sym) {
+                case 101:
+                case 102:
+                    n = 1;
+                    v = get_bits(&bits, 8);
+                    break;
+                case 103:
+                case 104:
+                    n = 1;
+                    v = get_bits(&bits, 16);
+                    break;
+                case 105:
+                    n = get_bits(&bits, 8);
+                    v = 0;
+                    break;
+                case 106:
+                    n = get_bits(&bits, 16);
+                    v = 0;
+                    break;
+                default:
+                    goto corrupt;
+            }
+            if (n < 0 || v < 0)
+                goto corrupt;
+            if (sym == 102 || sym == 104)
+                v = -v;
+        }
+        if (n > npix - ipc)
+            goto corrupt;
+        if (v == 0) {
+            // qdata starts zeroed.
+            ipc += n;
+        } else {
+            qdata[ipc++] = (short) v;
+        }
+    }
+    return 0;
+
+    corrupt:
+    fprintf(stderr, "ERROR : bc_wsq_decode : corrupt entropy-coded data\n");
+    return -1;
+}
+
+/*
+ * Dequantize into a zeroed w x h image, subband by subband in coding order
+ * as NBIS unquantize() does; subbands with a zero bin were not coded.
+ */
+static int
+unquantize_image(float *fdata, const DQT_TABLE *dqt, const Q_TREE *q_tree, const short *qdata, int w) {
+    const short *q = qdata;
+    int cnt, row;
+
+    if (dqt->dqt_def != 1) {
+        fprintf(stderr, "ERROR : bc_wsq_decode : quantization table not defined\n");
+        return -1;
+    }
+    for (cnt = 0; cnt < NUM_SUBBANDS; cnt++) {
+        if (dqt->q_bin[cnt] == 0.0)
+            continue;
+        for (row = 0; row < q_tree[cnt].leny; row++, q += q_tree[cnt].lenx)
+            bc_unquantize(q, fdata + (size_t) (q_tree[cnt].y + row) * w + q_tree[cnt].x,
+                          (size_t) q_tree[cnt].lenx, dqt->q_bin[cnt], dqt->bin_center);
+    }
+    return 0;
+}
+
+/*
+ * The steps NBIS join_lets() takes over one line of len samples, for
+ * bc_filter_lines(). Only usable when ok: join_lets() may read or write
+ * outside very short lines, and may leave an output it never cleared, so
+ * such lines go to join_lets() itself.
+ */
+typedef struct {
+    bc_filter_step *steps;
+    int n;
+    int cap;
+    int len;
+    unsigned char *cleared;
+    int ok;
+} bc_plan;
+
+/*
+ * What join_lets() keeps for a whole line. Positions are sample indices
+ * where join_lets() has pointers: lp0-lp1 is the low-pass half of the
+ * input and hp0-hp1 the high-pass half.
+ */
+typedef struct {
+    const float *lo, *hi;
+    int lsz, hsz;
+    int lp0, lp1, hp0, hp1;
+    int asym;
+    int da_ev;
+} bc_join;
+
+static void
+push_step(bc_plan *plan, int dst, int src, float coef, float sfac) {
+    bc_filter_step *grown;
+
+    if (!plan->ok)
+        return;
+    if (dst < 0 || dst >= plan->len || src >= plan->len || (src >= 0 && !plan->cleared[dst])) {
+        plan->ok = 0;
+        return;
+    }
+    if (plan->n == plan->cap) {
+        if ((grown = (bc_filter_step *) realloc(plan->steps, 2 * plan->cap * sizeof(bc_filter_step))) == NULL) {
+            plan->ok = 0;
+            return;
+        }
+        plan->steps = grown;
+        plan->cap *= 2;
+    }
+    if (src < 0)
+        plan->cleared[dst] = 1;
+    plan->steps[plan->n].dst = dst;
+    plan->steps[plan->n].src = src;
+    plan->steps[plan->n].coef = coef;
+    plan->steps[plan->n].sfac = sfac;
+    plan->steps[plan->n].scaled = sfac != 1.0f;
+    plan->n++;
+}
+
+static void
+clear_step(bc_plan *plan, int dst) {
+    push_step(plan, dst, -1, 0.0f, 1.0f);
+}
+
+static void
+tap_step(bc_plan *plan, int dst, int src, float coef, float sfac) {
+    if (src < 0)
+        plan->ok = 0;
+    else
+        push_step(plan, dst, src, coef, sfac);
+}
+
+// One low-pass output of join_lets(): *limg = 0.0, then every other tap.
+static void
+low_output(bc_plan *plan, const bc_join *j, int limg, int tap, int lpx, int lpxstr, int lle, int lre) {
+    int i;
+
+    clear_step(plan, limg);
+    for (i = tap; i < j->lsz; i += 2) {
+        tap_step(plan, limg, lpx, j->lo[i], 1.0f);
+        if (lpx == j->lp0) {
+            if (lle) {
+                lpxstr = 0;
+                lle = 0;
+            } else
+                lpxstr = 1;
+        }
+        if (lpx == j->lp1) {
+            if (lre) {
+                lpxstr = 0;
+                lre = 0;
+            } else
+                lpxstr = -1;
+        }
+        lpx += lpxstr;
+    }
+}
+
+/*
+ * The high-pass taps join_lets() adds to one output. Even filters run with
+ * the taps negated and a sign factor that follows the mirroring.
+ */
+static void
+high_output(bc_plan *plan, const bc_join *j, int himg, int tap, int hpx, int hpxstr, int hle, int hre,
+            int fhre, float sfac) {
+    int i;
+
+    for (i = tap; i < j->hsz; i += 2) {
+        tap_step(plan, himg, hpx, j->asym ? -j->hi[i] : j->hi[i], sfac);
+        if (hpx == j->hp0) {
+            if (hle) {
+                hpxstr = 0;
+                hle = 0;
+            } else {
+                hpxstr = 1;
+                sfac = 1.0f;
+            }
+        }
+        if (hpx == j->hp1) {
+            if (hre) {
+                hpxstr = 0;
+                hre = 0;
+                if (j->asym && j->da_ev) {
+                    hre = 1;
+                    fhre--;
+                    sfac = (float) fhre;
+                    if (sfac == 0.0f)
+                        hre = 0;
+                }
+            } else {
+                hpxstr = -1;
+                if (j->asym)
+                    sfac = -1.0f;
+            }
+        }
+        hpx += hpxstr;
+    }
+}
+
+/*
+ * Plan the synthesis of one line of len samples as join_lets() does it,
+ * with its variable names: the low-pass and high-pass start pixels walk
+ * towards the line start and mirror there, two outputs per input pair.
+ */
+static void
+plan_join(bc_plan *plan, int len, const DTT_TABLE *dtt, int inv) {
+    bc_join j;
+    unsigned char *cleared;
+    int llen, hlen, loc, hoc, lotap, hotap, olle, olre, ohle, ohre, ofhre, fhre;
+    int lspx, lspxstr, lstap, lle2, lre2, hspx, hspxstr, hstap, hle2, hre2;
+    int limg = 0, himg = 0, pix, tap;
+    float ssfac, osfac;
+
+    plan->n = 0;
+    plan->len = len;
+    plan->ok = 0;
+    if (plan->cap == 0) {
+        if ((plan->steps = (bc_filter_step *) malloc(256 * sizeof(bc_filter_step))) == NULL)
+            return;
+        plan->cap = 256;
+    }
+    if ((cleared = (unsigned char *) realloc(plan->cleared, len > 0 ? len : 1)) == NULL)
+        return;
+    plan->cleared = cleared;
+    memset(cleared, 0, len);
+    plan->ok = 1;
+
+    j.lo = dtt->lofilt;
+    j.hi = dtt->hifilt;
+    j.lsz = dtt->losz;
+    j.hsz = dtt->hisz;
+    j.da_ev = len % 2;
+    if (j.da_ev) {
+        llen = (len + 1) / 2;
+        hlen = llen - 1;
+    } else {
+        llen = len / 2;
+        hlen = llen;
+    }
+    if (j.lsz % 2) {
+        j.asym = 0;
+        ssfac = 1.0f;
+        ofhre = 0;
+        loc = (j.lsz - 1) / 4;
+        hoc = (j.hsz + 1) / 4 - 1;
+        lotap = ((j.lsz - 1) / 2) % 2;
+        hotap = ((j.hsz + 1) / 2) % 2;
+        olle = 0;
+        olre = !j.da_ev;
+        ohle = 1;
+        ohre = j.da_ev;
+    } else {
+        j.asym = 1;
+        ssfac = -1.0f;
+        ofhre = 2;
+        loc = j.lsz / 4 - 1;
+        hoc = j.hsz / 4 - 1;
+        lotap = (j.lsz / 2) % 2;
+        hotap = (j.hsz / 2) % 2;
+        olle = 1;
+        olre = !j.da_ev;
+        ohle = 1;
+        ohre = 1;
+        if (loc == -1) {
+            loc = 0;
+            olle = 0;
+        }
+        if (hoc == -1) {
+            hoc = 0;
+            ohle = 0;
+        }
+    }
+    if (inv) {
+        j.hp0 = 0;
+        j.lp0 = hlen;
+    } else {
+        j.lp0 = 0;
+        j.hp0 = llen;
+    }
+    j.lp1 = j.lp0 + llen - 1;
+    j.hp1 = j.hp0 + hlen - 1;
+
+    // The high-pass taps of the first pair may reach the second output
+    // before the low-pass ones clear it.
+    clear_step(plan, 0);
+    clear_step(plan, 1);
+    lspx = j.lp0 + loc;
+    lspxstr = -1;
+    lstap = lotap;
+    lle2 = olle;
+    lre2 = olre;
+    hspx = j.hp0 + hoc;
+    hspxstr = -1;
+    hstap = hotap;
+    hle2 = ohle;
+    hre2 = ohre;
+    osfac = ssfac;
+
+    for (pix = 0; pix < hlen; pix++) {
+        for (tap = lstap; tap >= 0; tap--)
+            low_output(plan, &j, limg++, tap, lspx, lspxstr, lle2, lre2);
+        if (lspx == j.lp0) {
+            if (lle2) {
+                lspxstr = 0;
+                lle2 = 0;
+            } else
+                lspxstr = 1;
+        }
+        lspx += lspxstr;
+        lstap = 1;
+
+        for (tap = hstap; tap >= 0; tap--)
+            high_output(plan, &j, himg++, tap, hspx, hspxstr, hle2, hre2, ofhre, osfac);
+        if (hspx == j.hp0) {
+            if (hle2) {
+                hspxstr = 0;
+                hle2 = 0;
+            } else {
+                hspxstr = 1;
+                osfac = 1.0f;
+            }
+        }
+        hspx += hspxstr;
+        hstap = 1;
+    }
+
+    if (j.da_ev)
+        lstap = lotap ? 1 : 0;
+    else
+        lstap = lotap ? 2 : 1;
+    for (tap = 1; tap >= lstap; tap--)
+        low_output(plan, &j, limg++, tap, lspx, lspxstr, lle2, lre2);
+
+    fhre = ofhre;
+    if (j.da_ev) {
+        hstap = hotap ? 1 : 0;
+        if (j.hsz == 2) {
+            hspx -= hspxstr;
+            fhre = 1;
+        }
+    } else
+        hstap = hotap ? 2 : 1;
+    for (tap = 1; tap >= hstap; tap--)
+        high_output(plan, &j, himg++, tap, hspx, hspxstr, hle2, hre2, fhre, osfac);
+
+    for (pix = 0; pix < len && plan->ok; pix++)
+        if (!cleared[pix])
+            plan->ok = 0;
+}
+
+// join_lets() down the lenx columns of a node, into fdata1.
+static void
+join_columns(bc_plan *plan, float *fdata1, float *base, const W_TREE *node, int w, DTT_TABLE *dtt) {
+    plan_join(plan, node->leny, dtt, node->inv_cl);
+    if (plan->ok)
+        bc_filter_lines(plan->steps, plan->n, base, fdata1, w, node->lenx);
+    else
+        join_lets(fdata1, base, node->lenx, node->leny, 1, w, dtt->hifilt, dtt->hisz, dtt->lofilt, dtt->losz,
+                  node->inv_cl);
+}
+
+/*
+ * join_lets() along the leny rows of a node, back into the image. Bands of
+ * rows are transposed into band so that their samples sit side by side.
+ */
+static void
+join_rows(bc_plan *plan, float *base, float *fdata1, const W_TREE *node, int w, DTT_TABLE *dtt, float *band) {
+    float *in = band, *out = band + (size_t) ROW_BAND * node->lenx;
+    int r0, n, r, k;
+
+    plan_join(plan, node->lenx, dtt, node->inv_rw);
+    if (!plan->ok) {
+        join_lets(base, fdata1, node->leny, node->lenx, w, 1, dtt->hifilt, dtt->hisz, dtt->lofilt, dtt->losz,
+                  node->inv_rw);
+        return;
+    }
+    for (r0 = 0; r0 < node->leny; r0 += ROW_BAND) {
+        n = node->leny - r0 < ROW_BAND ? node->leny - r0 : ROW_BAND;
+        for (r = 0; r < n; r++)
+            for (k = 0; k < node->lenx; k++)
+                in[(size_t) k * n + r] = fdata1[(size_t) (r0 + r) * w + k];
+        bc_filter_lines(plan->steps, plan->n, in, out, n, n);
+        for (r = 0; r < n; r++)
+            for (k = 0; k < node->lenx; k++)
+                base[(size_t) (r0 + r) * w + k] = out[(size_t) k * n + r];
+    }
+}
+
+/*
+ * Inverse wavelet transform like NBIS wsq_reconstruct(): from the last node
+ * of the tree to the first, synthesize the columns and then the rows of the
+ * node's area. Each join_lets() pass becomes a list of steps run on many
+ * lines at once by bc_filter_lines(), in join_lets() order, so the pixels
+ * are the same.
+ */
+static int
+reconstruct(float *fdata, int w, int h, const W_TREE *w_tree, DTT_TABLE *dtt) {
+    bc_plan plan;
+    float *fdata1, *band, *base;
+    int node;
+
+    if (dtt->lodef != 1 || dtt->hidef != 1) {
+        fprintf(stderr, "ERROR : bc_wsq_decode : transform table not defined\n");
+        return -1;
+    }
+    fdata1 = (float *) malloc((size_t) w * h * sizeof(float));
+    band = (float *) malloc((size_t) 2 * ROW_BAND * w * sizeof(float));
+    if (fdata1 == NULL || band == NULL) {
+        fprintf(stderr, "ERROR : bc_wsq_decode : malloc : fdata1\n");
+        free(fdata1);
+        free(band);
+        return -1;
+    }
+    memset(&plan, 0, sizeof(plan));
+    for (node = W_TREELEN - 1; node >= 0; node--) {
+        base = fdata + (size_t) w_tree[node].y * w + w_tree[node].x;
+        join_columns(&plan, fdata1, base, &w_tree[node], w, dtt);
+        join_rows(&plan, base, fdata1, &w_tree[node], w, dtt, band);
+    }
+    free(plan.steps);
+    free(plan.cleared);
+    free(band);
+    free(fdata1);
+    return 0;
+}
+
+int bc_wsq_decode(unsigned char *idata, int ilen, unsigned char **odata, int *ow, int *oh, int *oppi) {
+    DTT_TABLE dtt;
+    DQT_TABLE dqt;
+    DHT_TABLE dht[MAX_DHT_TABLES];
+    FRM_HEADER_WSQ frm;
+    W_TREE w_tree[W_TREELEN];
+    Q_TREE q_tree[Q_TREELEN];
+    unsigned char *cbufptr = idata, *ebufptr = idata + ilen, *cdata = NULL;
+    unsigned short marker;
+    short *qdata = NULL;
+    float *fdata = NULL;
+    int w, h, ppi, i;
+    int ret;
+
+    memset(&dtt, 0, sizeof(dtt));
+    memset(&dqt, 0, sizeof(dqt));
+    for (i = 0; i < MAX_DHT_TABLES; i++)
+        dht[i].tabdef = 0;
+
+    if ((ret = getc_marker_wsq(&marker, SOI_WSQ, &cbufptr, ebufptr)))
+        goto err_out;
+    if ((ret = getc_marker_wsq(&marker, TBLS_N_SOF, &cbufptr, ebufptr)))
+        goto err_out;
+    while (marker != SOF_WSQ) {
+        if ((ret = getc_table_wsq(marker, &dtt, &dqt, dht, &cbufptr, ebufptr)))
+            goto err_out;
+        if ((ret = getc_marker_wsq(&marker, TBLS_N_SOF, &cbufptr, ebufptr)))
+            goto err_out;
+    }
+    if ((ret = getc_frame_header_wsq(&frm, &cbufptr, ebufptr)))
+        goto err_out;
+    w = frm.width;
+    h = frm.height;
+    if ((ret = getc_ppi_wsq(&ppi, idata, ilen)))
+        goto err_out;
+
+    build_wsq_trees(w_tree, W_TREELEN, q_tree, Q_TREELEN, w, h);
+
+    ret = -1;
+    if ((qdata = (short *) calloc((size_t) w * h, sizeof(short))) == NULL) {
+        fprintf(stderr, "ERROR : bc_wsq_decode : calloc : qdata\n");
+        goto err_out;
+    }
+    if ((ret = decode_blocks(qdata, w * h, &dtt, &dqt, dht, &cbufptr, ebufptr)))
+        goto err_out;
+    ret = -1;
+    if ((fdata = (float *) calloc((size_t) w * h, sizeof(float))) == NULL) {
+        fprintf(stderr, "ERROR : bc_wsq_decode : calloc : fdata\n");
+        goto err_out;
+    }
+    if ((ret = unquantize_image(fdata, &dqt, q_tree, qdata, w)))
+        goto err_out;
+    free(qdata);
+    qdata = NULL;
+    if ((ret = reconstruct(fdata, w, h, w_tree, &dtt)))
+        goto err_out;
+
+    ret = -1;
+    if ((cdata = (unsigned char *) malloc((size_t) w * h)) == NULL) {
+        fprintf(stderr, "ERROR : bc_wsq_decode : malloc : cdata\n");
+        goto err_out;
+    }
+    conv_img_2_uchar(cdata, fdata, w, h, frm.m_shift, frm.r_scale);
+
+    *odata = cdata;
+    *ow = w;
+    *oh = h;
+    *oppi = ppi;
+    ret = 0;
+
+    err_out:
+    free(qdata);
+    free(fdata);
+    free(dtt.lofilt);
+    free(dtt.hifilt);
+    return ret;
+}
@@ -0,0 +1,17 @@
+#ifndef BIOMETRICAL_CONVERTER_WSQDEC_H
+#define BIOMETRICAL_CONVERTER_WSQDEC_H
+
+/*
+ * Decode a WSQ image to 8-bit grayscale, like NBIS wsq_decode_mem() but
+ * reentrant: the tables live on the caller's stack rather than in NBIS
+ * globals, and the entropy-coded data goes through lookup-table Huffman
+ * decoding instead of NBIS's bit-at-a-time decoder, which keeps its bit
+ * buffer in static variables. Dequantization and the inverse wavelet
+ * transform run on the SIMD kernels in NBIS's float operation order, and
+ * table parsing is NBIS's own, so the pixels are identical. ppi is -1 when
+ * the image does not say. The pixels are released with free(). Returns 0 on
+ * success.
+ */
+extern int bc_wsq_decode(unsigned char *idata, int ilen, unsigned char **odata, int *ow, int *oh, int *oppi);
+
+#endif //BIOMETRICAL_CONVERTER_WSQDEC_H
@@ -0,0 +1,195 @@
+/*
+ * Checks the in-tree LFS stages against NBIS on the sample image: the block
+ * DFT powers, the binarized image and the final minutiae, detected on one
+ * or more threads, must all match bit for bit.
+ *
+ * usage: test_lfs <sample.wsq>
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+#include <lfs.h>
+#include <wsq.h>
+#include "../lib/extract.h"
+#include "../lib/simd.h"
+#include "test_util.h"
+
+// The DFT powers of every block window, the way gen_initial_maps() places
+// them, and the binarized image for NBIS's own maps.
+static void
+check_stages(unsigned char *idata, int iw, int ih) {
+    const LFSPARMS *lfsparms = &lfsparms_V2;
+    DIR2RAD *dir2rad;
+    DFTWAVES *dftwaves;
+    ROTGRIDS *dftgrids, *dirbingrids;
+    unsigned char *pdata, *sdata, *bdata, *bdata_ref;
+    int *blkoffs, *dmap, *lcmap, *lfmap, *hcmap;
+    double **powers, **powers_ref;
+    int maxpad, pw, ph, mw, mh, bw, bh, bw_ref, bh_ref;
+    int bi, offset, win_x, win_y, w, d, diffs;
+
+    maxpad = get_max_padding_V2(lfsparms->windowsize, lfsparms->windowoffset,
+                                lfsparms->dirbin_grid_w, lfsparms->dirbin_grid_h);
+    if (init_dir2rad(&dir2rad, lfsparms->num_directions) != 0 ||
+        init_dftwaves(&dftwaves, g_dft_coefs, lfsparms->num_dft_waves, lfsparms->windowsize) != 0 ||
+        init_rotgrids(&dftgrids, iw, ih, maxpad, lfsparms->start_dir_angle, lfsparms->num_directions,
+                      lfsparms->windowsize, lfsparms->windowsize, RELATIVE2ORIGIN) != 0 ||
+        init_rotgrids(&dirbingrids, iw, ih, maxpad, lfsparms->start_dir_angle, lfsparms->num_directions,
+                      lfsparms->dirbin_grid_w, lfsparms->dirbin_grid_h, RELATIVE2CENTER) != 0 ||
+        pad_uchar_image(&pdata, &pw, &ph, idata, iw, ih, maxpad, lfsparms->pad_value) != 0) {
+        CHECK(0, "could not set up LFS tables");
+        return;
+    }
+    bits_8to6(pdata, pw, ph);
+    // bc_dft_dir_powers() may read a few bytes past the image.
+    sdata = (unsigned char *) calloc((size_t) pw * ph + BC_DFT_SLACK, 1);
+    memcpy(sdata, pdata, (size_t) pw * ph);
+
+    if (block_offsets(&blkoffs, &mw, &mh, iw, ih, maxpad, lfsparms->blocksize) != 0 ||
+        alloc_dir_powers(&powers, dftwaves->nwaves, dftgrids->ngrids) != 0 ||
+        alloc_dir_powers(&powers_ref, dftwaves->nwaves, dftgrids->ngrids) != 0) {
+        CHECK(0, "could not allocate DFT powers");
+        return;
+    }
+    diffs = 0;
+    for (bi = 0; bi < mw * mh; bi++) {
+        offset = blkoffs[bi] - lfsparms->windowoffset * pw - lfsparms->windowoffset;
+        win_x = MIN(MAX(offset % pw, maxpad), pw - maxpad - lfsparms->windowsize - 1);
+        win_y = MIN(MAX(offset / pw, maxpad), ph - maxpad - lfsparms->windowsize - 1);
+        offset = win_y * pw + win_x;
+        dft_dir_powers(powers_ref, pdata, offset, pw, ph, dftwaves, dftgrids);
+        bc_dft_dir_powers(powers, sdata, offset, pw, ph, dftwaves, dftgrids);
+        for (w = 0; w < dftwaves->nwaves; w++)
+            for (d = 0; d < dftgrids->ngrids; d++)
+                diffs += memcmp(&powers[w][d], &powers_ref[w][d], sizeof(double)) != 0;
+    }
+    CHECK(diffs == 0, "%d DFT powers differ from dft_dir_powers() in %dx%d", diffs, iw, ih);
+
+    if (gen_image_maps(&dmap, &lcmap, &lfmap, &hcmap, &mw, &mh, pdata, pw, ph,
+                       dir2rad, dftwaves, dftgrids, lfsparms) != 0 ||
+        binarize_V2(&bdata_ref, &bw_ref, &bh_ref, pdata, pw, ph, dmap, mw, mh, dirbingrids, lfsparms) != 0) {
+        CHECK(0, "NBIS binarization failed");
+        return;
+    }
+    CHECK(bc_binarize(&bdata, &bw, &bh, sdata, pw, ph, dmap, mw, mh, dirbingrids, lfsparms) == 0,
+          "bc_binarize() failed");
+    CHECK(bw == bw_ref && bh == bh_ref && memcmp(bdata, bdata_ref, (size_t) bw * bh) == 0,
+          "binarized image differs from binarize_V2() in %dx%d", iw, ih);
+
+    free(bdata);
+    free(bdata_ref);
+    free(dmap);
+    free(lcmap);
+    free(lfmap);
+    free(hcmap);
+    free_dir_powers(powers, dftwaves->nwaves);
+    free_dir_powers(powers_ref, dftwaves->nwaves);
+    free(blkoffs);
+    free(sdata);
+    free(pdata);
+    free_rotgrids(dirbingrids);
+    free_rotgrids(dftgrids);
+    free_dftwaves(dftwaves);
+    free_dir2rad(dir2rad);
+}
+
+static int
+same_minutia(const MINUTIA *a, const MINUTIA *b) {
+    int i;
+
+    if (a->x != b->x || a->y != b->y || a->ex != b->ex || a->ey != b->ey ||
+        a->direction != b->direction || a->reliability != b->reliability ||
+        a->type != b->type || a->appearing != b->appearing || a->num_nbrs != b->num_nbrs)
+        return 0;
+    for (i = 0; i < a->num_nbrs; i++)
+        if (a->nbrs[i] != b->nbrs[i] || a->ridge_counts[i] != b->ridge_counts[i])
+            return 0;
+    return 1;
+}
+
+// get_minutiae_only() on nthreads threads against get_minutiae() on the
+// same pixels, with scratch left over from earlier calls.
+static void
+check_minutiae(unsigned char *idata, int iw, int ih, double ippmm, int nthreads, bc_arena *scratch) {
+    MINUTIAE *minutiae, *minutiae_ref;
+    unsigned char *bdata;
+    int *qmap, *dmap, *lcmap, *lfmap, *hcmap;
+    int mw, mh, bw, bh, bd, i;
+
+    if (get_minutiae(&minutiae_ref, &qmap, &dmap, &lcmap, &lfmap, &hcmap, &mw, &mh,
+                     &bdata, &bw, &bh, &bd, idata, iw, ih, 8, ippmm, &lfsparms_V2) != 0) {
+        CHECK(0, "get_minutiae() failed");
+        return;
+    }
+    bc_arena_reset(scratch);
+    if (get_minutiae_only(&minutiae, idata, iw, ih, ippmm, nthreads, scratch) != 0) {
+        CHECK(0, "get_minutiae_only() failed");
+        return;
+    }
+    CHECK(minutiae->num == minutiae_ref->num, "%d minutiae instead of %d in %dx%d on %d thread(s)",
+          minutiae->num, minutiae_ref->num, iw, ih, nthreads);
+    for (i = 0; i < minutiae->num && i < minutiae_ref->num; i++)
+        if (!same_minutia(minutiae->list[i], minutiae_ref->list[i]))
+            break;
+    CHECK(i == MIN(minutiae->num, minutiae_ref->num), "minutia %d differs in %dx%d on %d thread(s)",
+          i, iw, ih, nthreads);
+
+    free_minutiae(minutiae);
+    free_minutiae(minutiae_ref);
+    free(qmap);
+    free(dmap);
+    free(lcmap);
+    free(lfmap);
+    free(hcmap);
+    free(bdata);
+}
+
+int main(int argc, char **argv) {
+    static const int threads[] = {1, 2, 3, 8};
+    unsigned char *data, *idata, *crop;
+    int len, iw, ih, id, ippi, lossy, cw, ch, y, t;
+    double ippmm;
+    bc_arena scratch;
+
+    if (argc != 2) {
+        fprintf(stderr, "usage: test_lfs <sample.wsq>\n");
+        return EXIT_FAILURE;
+    }
+    if ((data = read_file(argv[1], &len)) == NULL ||
+        wsq_decode_mem(&idata, &iw, &ih, &id, &ippi, &lossy, data, len) != 0) {
+        fprintf(stderr, "could not decode %s\n", argv[1]);
+        return EXIT_FAILURE;
+    }
+    ippmm = (ippi > 0 ? ippi : DEFAULT_PPI) / MM_PER_INCH;
+    printf("kernels: %s\n", bc_simd_name());
+    bc_arena_init(&scratch);
+
+    check_stages(idata, iw, ih);
+    // The same minutiae however many threads detect them.
+    for (t = 0; t < (int) (sizeof(threads) / sizeof(threads[0])); t++)
+        check_minutiae(idata, iw, ih, ippmm, threads[t], &scratch);
+
+    // Partial blocks along the right and bottom edges.
+    cw = iw - 5;
+    ch = ih - 3;
+    crop = (unsigned char *) malloc((size_t) cw * ch);
+    for (y = 0; y < ch; y++)
+        memcpy(crop + (size_t) y * cw, idata + (size_t) y * iw, cw);
+    check_stages(crop, cw, ch);
+    check_minutiae(crop, cw, ch, ippmm, 1, &scratch);
+    check_minutiae(crop, cw, ch, ippmm, 3, &scratch);
+    // Again in the arena the larger image grew.
+    check_minutiae(idata, iw, ih, ippmm, 1, &scratch);
+
+    bc_arena_release(&scratch);
+    free(crop);
+    free(idata);
+    free(data);
+    if (failures > 0) {
+        fprintf(stderr, "%d check(s) failed\n", failures);
+        return EXIT_FAILURE;
+    }
+    printf("ok\n");
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,131 @@
+/*
+ * Checks bc_fmr_transcode() against bc_fmr2fmr() for every pair of ANSI,
+ * ISO, ISONC and ISOCC: both must succeed or fail alike and give the same
+ * bytes. The records come from the sample image, as a single view and as a
+ * two-view record, and from a copy labelled with another spec version.
+ *
+ * usage: test_transcode <sample.wsq>
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <converter.h>
+#include "test_util.h"
+
+#define NUM_RECORD_TYPES 4
+static char *record_types[NUM_RECORD_TYPES] = {"ANSI", "ISO", "ISONC", "ISOCC"};
+
+// Card resolution, in pixels per cm: 500 ppi.
+#define CARD_RES 197
+
+// Offset and length of the spec version in an ANSI or ISO record.
+#define SPEC_VERSION_OFFSET 4
+#define SPEC_VERSION_LEN 4
+
+// One record of in_type converted to out_type both ways.
+static void
+check_pair(bc_context *ctx, unsigned char *idata, int ilen, char *in_type, char *out_type, const char *what) {
+    unsigned char *ref = NULL, *obuf;
+    int ref_len = 0, ref_ret, ret, olen, size_len;
+
+    ref_ret = bc_fmr2fmr(ctx, idata, ilen, &ref, &ref_len, in_type, out_type, CARD_RES, CARD_RES);
+
+    // Size query first, then the record it left in the context.
+    ret = bc_fmr_transcode(ctx, idata, ilen, in_type, out_type, CARD_RES, CARD_RES, NULL, 0, &size_len);
+    if (ref_ret != BC_OK) {
+        CHECK(ret == ref_ret, "%s %s -> %s: size query gave %d, bc_fmr2fmr() %d",
+              what, in_type, out_type, ret, ref_ret);
+        return;
+    }
+    CHECK(ret == BC_ERR_BUFFER_TOO_SMALL && size_len == ref_len,
+          "%s %s -> %s: size query gave %d and %d bytes instead of %d",
+          what, in_type, out_type, ret, size_len, ref_len);
+
+    obuf = (unsigned char *) malloc(ref_len);
+    ret = bc_result_copy(ctx, obuf, ref_len, &olen);
+    CHECK(ret == BC_OK && olen == ref_len && memcmp(obuf, ref, ref_len) == 0,
+          "%s %s -> %s: bc_result_copy() after the size query gave %d", what, in_type, out_type, ret);
+
+    // And the conversion straight into a buffer of that size.
+    memset(obuf, 0, ref_len);
+    ret = bc_fmr_transcode(ctx, idata, ilen, in_type, out_type, CARD_RES, CARD_RES, obuf, ref_len, &olen);
+    CHECK(ret == BC_OK, "%s %s -> %s: bc_fmr_transcode() gave %d", what, in_type, out_type, ret);
+    if (ret == BC_OK) {
+        CHECK(olen == ref_len, "%s %s -> %s: %d bytes instead of %d", what, in_type, out_type, olen, ref_len);
+        CHECK(olen != ref_len || memcmp(obuf, ref, ref_len) == 0,
+              "%s %s -> %s: bytes differ from bc_fmr2fmr()", what, in_type, out_type);
+    }
+    free(obuf);
+    bc_free(ref);
+}
+
+// Every pair, starting from an ANSI record converted to each type.
+static void
+check_all(bc_context *ctx, unsigned char *ansi, int ansi_len, const char *what) {
+    unsigned char *src[NUM_RECORD_TYPES];
+    int src_len[NUM_RECORD_TYPES], i, o;
+
+    for (i = 0; i < NUM_RECORD_TYPES; i++) {
+        if (bc_fmr2fmr(ctx, ansi, ansi_len, &src[i], &src_len[i], "ANSI", record_types[i],
+                       CARD_RES, CARD_RES) != BC_OK) {
+            // No source of this type to convert from.
+            src[i] = NULL;
+            continue;
+        }
+        for (o = 0; o < NUM_RECORD_TYPES; o++)
+            check_pair(ctx, src[i], src_len[i], record_types[i], record_types[o], what);
+    }
+    for (i = 0; i < NUM_RECORD_TYPES; i++)
+        if (src[i] != NULL)
+            bc_free(src[i]);
+}
+
+int main(int argc, char **argv) {
+    bc_context *ctx;
+    bc_finger fingers[2];
+    unsigned char *sample, *ansi, *multi;
+    int sample_len, ansi_len, multi_len, o;
+
+    if (argc != 2) {
+        fprintf(stderr, "usage: test_transcode <sample.wsq>\n");
+        return EXIT_FAILURE;
+    }
+    if ((sample = read_file(argv[1], &sample_len)) == NULL) {
+        fprintf(stderr, "could not read %s\n", argv[1]);
+        return EXIT_FAILURE;
+    }
+    if ((ctx = bc_context_create()) == NULL ||
+        bc_img2fmr(ctx, sample, sample_len, "ANSI", &ansi, &ansi_len) != BC_OK) {
+        fprintf(stderr, "could not build a record from %s\n", argv[1]);
+        return EXIT_FAILURE;
+    }
+    check_all(ctx, ansi, ansi_len, "one view:");
+
+    fingers[0].idata = sample;
+    fingers[0].ilen = sample_len;
+    fingers[0].position = 2;
+    fingers[0].impression = 0;
+    fingers[1] = fingers[0];
+    fingers[1].position = 7;
+    if (bc_img2fmr_multi(ctx, fingers, 2, "ANSI", &multi, &multi_len) != BC_OK) {
+        CHECK(0, "could not build a two-view record");
+    } else {
+        check_all(ctx, multi, multi_len, "two views:");
+        bc_free(multi);
+    }
+
+    // A version the single pass does not know must convert like bc_fmr2fmr().
+    memcpy(ansi + SPEC_VERSION_OFFSET, "030", SPEC_VERSION_LEN);
+    for (o = 0; o < NUM_RECORD_TYPES; o++)
+        check_pair(ctx, ansi, ansi_len, "ANSI", record_types[o], "version 030:");
+
+    bc_free(ansi);
+    bc_context_destroy(ctx);
+    free(sample);
+    if (failures > 0) {
+        fprintf(stderr, "%d check(s) failed\n", failures);
+        return EXIT_FAILURE;
+    }
+    printf("ok\n");
+    return EXIT_SUCCESS;
+}
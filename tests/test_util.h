@@ -0,0 +1,45 @@
+#ifndef BIOMETRICAL_CONVERTER_TEST_UTIL_H
+#define BIOMETRICAL_CONVERTER_TEST_UTIL_H
+
+/*
+ * Helpers shared by the tests, each of which is a single translation unit:
+ * CHECK() reports a failed condition and counts it in failures, which main()
+ * turns into the exit status.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+static int failures = 0;
+
+#define CHECK(cond, ...) do { \
+    if (!(cond)) { \
+        fprintf(stderr, "FAIL %s:%d: ", __FILE__, __LINE__); \
+        fprintf(stderr, __VA_ARGS__); \
+        fprintf(stderr, "\n"); \
+        failures++; \
+    } \
+} while (0)
+
+// Whole file into a malloc()ed buffer, or NULL.
+static unsigned char *
+read_file(const char *path, int *len) {
+    unsigned char *data;
+    FILE *f;
+    long size;
+
+    if ((f = fopen(path, "rb")) == NULL)
+        return NULL;
+    fseek(f, 0, SEEK_END);
+    size = ftell(f);
+    rewind(f);
+    data = (unsigned char *) malloc(size > 0 ? size : 1);
+    if (data != NULL && fread(data, 1, size, f) != (size_t) size) {
+        free(data);
+        data = NULL;
+    }
+    fclose(f);
+    *len = (int) size;
+    return data;
+}
+
+#endif //BIOMETRICAL_CONVERTER_TEST_UTIL_H
@@ -0,0 +1,124 @@
+/*
+ * Checks the library's WSQ decoder against NBIS wsq_decode_mem(): the
+ * sample image, then a corpus made from it by re-encoding crops of odd and
+ * even sizes at several bit rates, must decode to the same pixels. Damaged
+ * input must be rejected, not read past its end.
+ *
+ * usage: test_wsq <sample.wsq>
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wsq.h>
+#include "../lib/simd.h"
+#include "../lib/wsqdec.h"
+#include "test_util.h"
+
+// Bit rates the corpus is encoded at: low, the usual 15:1, and high enough
+// for many 16-bit escapes.
+#define NUM_RATES 3
+static const float rates[NUM_RATES] = {0.3f, 0.75f, 2.25f};
+
+// bc_wsq_decode() against wsq_decode_mem() on one image.
+static void
+check_decode(unsigned char *data, int len, const char *what) {
+    unsigned char *ref, *pix;
+    int rw, rh, rd, rppi, lossy, w, h, ppi;
+
+    if (wsq_decode_mem(&ref, &rw, &rh, &rd, &rppi, &lossy, data, len) != 0) {
+        CHECK(0, "NBIS could not decode %s", what);
+        return;
+    }
+    if (bc_wsq_decode(data, len, &pix, &w, &h, &ppi) != 0) {
+        CHECK(0, "could not decode %s", what);
+        free(ref);
+        return;
+    }
+    CHECK(w == rw && h == rh, "%s is %dx%d instead of %dx%d", what, w, h, rw, rh);
+    CHECK(ppi == rppi, "%s has %d ppi instead of %d", what, ppi, rppi);
+    if (w == rw && h == rh)
+        CHECK(memcmp(pix, ref, (size_t) w * h) == 0, "%s pixels differ from NBIS", what);
+    free(pix);
+    free(ref);
+}
+
+// Re-encode the cw x ch top-left crop of the image at every rate.
+static void
+check_crop(const unsigned char *idata, int iw, int cw, int ch, int ppi) {
+    unsigned char *crop, *data;
+    char what[64];
+    int len, r, y;
+
+    crop = (unsigned char *) malloc((size_t) cw * ch);
+    for (y = 0; y < ch; y++)
+        memcpy(crop + (size_t) y * cw, idata + (size_t) y * iw, cw);
+    for (r = 0; r < NUM_RATES; r++) {
+        snprintf(what, sizeof(what), "%dx%d at %.2f bpp", cw, ch, rates[r]);
+        if (wsq_encode_mem(&data, &len, rates[r], crop, cw, ch, 8, ppi, NULL) != 0) {
+            CHECK(0, "could not encode %s", what);
+            continue;
+        }
+        check_decode(data, len, what);
+        free(data);
+    }
+    free(crop);
+}
+
+// Truncated and zeroed streams fail cleanly.
+static void
+check_damaged(const unsigned char *data, int len) {
+    unsigned char *copy, *pix;
+    int w, h, ppi, cut;
+
+    copy = (unsigned char *) malloc(len);
+    for (cut = 2; cut < len; cut += len / 7) {
+        memcpy(copy, data, cut);
+        if (bc_wsq_decode(copy, cut, &pix, &w, &h, &ppi) == 0) {
+            CHECK(0, "decoded %d of %d bytes", cut, len);
+            free(pix);
+        }
+    }
+    memset(copy, 0, len);
+    if (bc_wsq_decode(copy, len, &pix, &w, &h, &ppi) == 0) {
+        CHECK(0, "decoded zeros");
+        free(pix);
+    }
+    free(copy);
+}
+
+int main(int argc, char **argv) {
+    unsigned char *data, *idata;
+    int len, iw, ih, id, ippi, lossy;
+
+    if (argc != 2) {
+        fprintf(stderr, "usage: test_wsq <sample.wsq>\n");
+        return EXIT_FAILURE;
+    }
+    if ((data = read_file(argv[1], &len)) == NULL ||
+        wsq_decode_mem(&idata, &iw, &ih, &id, &ippi, &lossy, data, len) != 0) {
+        fprintf(stderr, "could not decode %s\n", argv[1]);
+        return EXIT_FAILURE;
+    }
+    if (ippi <= 0)
+        ippi = 500;
+    printf("kernels: %s\n", bc_simd_name());
+
+    check_decode(data, len, argv[1]);
+    check_crop(idata, iw, iw, ih, ippi);
+    // Odd sizes take the other branches of the wavelet tree.
+    check_crop(idata, iw, iw - 1, ih - 3, ippi);
+    check_crop(idata, iw, iw / 2 + 1, ih / 2, ippi);
+    check_crop(idata, iw, 257, 131, ippi);
+    // Deep subbands a few samples long, which the transform leaves to NBIS.
+    check_crop(idata, iw, 45, 37, ippi);
+    check_damaged(data, len);
+
+    free(idata);
+    free(data);
+    if (failures > 0) {
+        fprintf(stderr, "%d check(s) failed\n", failures);
+        return EXIT_FAILURE;
+    }
+    printf("ok\n");
+    return EXIT_SUCCESS;
+}
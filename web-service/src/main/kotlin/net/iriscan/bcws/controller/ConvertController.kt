@@ -1,77 +1,248 @@
 package net.iriscan.bcws.controller
 
-import com.sun.jna.ptr.IntByReference
-import com.sun.jna.ptr.PointerByReference
-import kotlinx.coroutines.Dispatchers
 import kotlinx.coroutines.async
 import kotlinx.coroutines.awaitAll
 import kotlinx.coroutines.coroutineScope
+import kotlinx.coroutines.reactive.awaitSingle
+import kotlinx.coroutines.reactor.mono
+import kotlinx.coroutines.sync.Semaphore
+import kotlinx.coroutines.sync.withPermit
 import net.iriscan.bcws.dto.*
 import net.iriscan.bcws.extension.decodeBase64
 import net.iriscan.bcws.extension.encodeBase64
-import net.iriscan.bcws.lib.ConverterFactory
 import net.iriscan.bcws.lib.FileFormat
-import org.springframework.web.bind.annotation.CrossOrigin
-import org.springframework.web.bind.annotation.PostMapping
-import org.springframework.web.bind.annotation.RequestBody
-import org.springframework.web.bind.annotation.RestController
+import net.iriscan.bcws.lib.NativeExecutor
+import net.iriscan.bcws.lib.ResultCache
+import org.springframework.core.io.buffer.DataBuffer
+import org.springframework.core.io.buffer.DataBufferUtils
+import org.springframework.http.HttpEntity
+import org.springframework.http.HttpStatus
+import org.springframework.http.MediaType
+import org.springframework.http.client.MultipartBodyBuilder
+import org.springframework.http.codec.multipart.Part
+import org.springframework.util.MultiValueMap
+import org.springframework.web.bind.annotation.*
+import org.springframework.web.server.ResponseStatusException
+import reactor.core.publisher.Flux
+import reactor.core.publisher.Mono
+import java.nio.ByteBuffer
 
 /**
  * @author Slava Gornostal
  */
 @CrossOrigin
 @RestController
-class ConvertController {
-
-    private val converter = ConverterFactory.instance
+class ConvertController(private val executor: NativeExecutor, private val cache: ResultCache) {
 
     @PostMapping("/convert")
-    fun convert(@RequestBody request: Request): Response =
+    suspend fun convert(@RequestBody request: Request): Response =
         Response(convertOne(request.input, request.inputType, request.outputType, request.imageResX, request.imageResY))
 
+    @PostMapping(
+        "/convert",
+        consumes = [MediaType.APPLICATION_OCTET_STREAM_VALUE],
+        produces = [MediaType.APPLICATION_OCTET_STREAM_VALUE]
+    )
+    suspend fun convertBinary(
+        @RequestBody body: Flux<DataBuffer>,
+        @RequestParam inputType: FileFormat,
+        @RequestParam outputType: FileFormat,
+        @RequestParam(defaultValue = "0") imageResX: Int,
+        @RequestParam(defaultValue = "0") imageResY: Int
+    ): ByteArray = convertContent(body, inputType, outputType, imageResX, imageResY)
+
+    @PostMapping(
+        "/convert",
+        consumes = [MediaType.MULTIPART_FORM_DATA_VALUE],
+        produces = [MediaType.APPLICATION_OCTET_STREAM_VALUE]
+    )
+    suspend fun convertMultipart(
+        @RequestPart("file") file: Part,
+        @RequestParam inputType: FileFormat,
+        @RequestParam outputType: FileFormat,
+        @RequestParam(defaultValue = "0") imageResX: Int,
+        @RequestParam(defaultValue = "0") imageResY: Int
+    ): ByteArray = convertContent(file.content(), inputType, outputType, imageResX, imageResY)
+
+    @GetMapping("/cache")
+    fun cacheStats(): CacheStats = cache.stats()
+
+    /**
+     * A batch keeps at most one item per native thread in flight, so it
+     * cannot fill the executor queue by itself. An item turned away because
+     * other requests hold the executor gets an `error` instead of `output`;
+     * the rest of the batch goes on.
+     */
     @PostMapping("/convert-batch")
     suspend fun convertBatch(@RequestBody request: BatchRequestList): BatchResponseList = coroutineScope {
+        val permits = Semaphore(executor.threads)
         val converted = request.data
             .map {
-                async(Dispatchers.Default) {
-                    BatchResponse(
-                        it.id,
-                        convertOne(it.input, it.inputType, it.outputType, it.imageResX, it.imageResY)
-                    )
+                async {
+                    permits.withPermit {
+                        admitted({ e -> BatchResponse(it.id, error = e.reason) }) {
+                            BatchResponse(
+                                it.id,
+                                convertOne(it.input, it.inputType, it.outputType, it.imageResX, it.imageResY)
+                            )
+                        }
+                    }
                 }
             }
             .awaitAll()
         BatchResponseList(converted)
     }
 
-    private fun convertOne(
+    /**
+     * Streaming batch: one request per NDJSON line in, one result per line out
+     * as soon as it is ready. Items are read from the body only as native
+     * threads free up, so a large batch is never held in memory as a whole.
+     * A failed item yields an error line and the stream goes on.
+     */
+    @PostMapping(
+        "/convert-batch",
+        consumes = [MediaType.APPLICATION_NDJSON_VALUE],
+        produces = [MediaType.APPLICATION_NDJSON_VALUE]
+    )
+    fun convertBatchStream(@RequestBody requests: Flux<BatchRequest>): Flux<BatchStreamResponse> =
+        requests.flatMap({ item ->
+            mono {
+                BatchStreamResponse(
+                    item.id,
+                    output = convertOne(item.input, item.inputType, item.outputType, item.imageResX, item.imageResY)
+                )
+            }.onErrorResume { e ->
+                Mono.just(BatchStreamResponse(item.id, error = e.message ?: e.javaClass.simpleName))
+            }
+        }, executor.threads)
+
+    /**
+     * Every part is one item, named by its id. Types come from the query
+     * parameters and can be overridden per part with the X-Input-Type and
+     * X-Output-Type part headers. Results are returned as multipart/mixed,
+     * one octet-stream part per item under the same name. An item turned
+     * away by the executor comes back as a text part with the reason and
+     * its status code in the X-Error-Status part header.
+     */
+    @PostMapping(
+        "/convert-batch",
+        consumes = [MediaType.MULTIPART_FORM_DATA_VALUE],
+        produces = [MediaType.MULTIPART_MIXED_VALUE]
+    )
+    suspend fun convertBatchMultipart(
+        @RequestBody parts: Flux<Part>,
+        @RequestParam(required = false) inputType: FileFormat?,
+        @RequestParam(required = false) outputType: FileFormat?,
+        @RequestParam(defaultValue = "0") imageResX: Int,
+        @RequestParam(defaultValue = "0") imageResY: Int
+    ): MultiValueMap<String, HttpEntity<*>> = coroutineScope {
+        val permits = Semaphore(executor.threads)
+        // Check every part before converting any.
+        val items = parts.collectList().awaitSingle()
+            .map {
+                val itemInputType = partType(it, INPUT_TYPE_HEADER) ?: inputType
+                val itemOutputType = partType(it, OUTPUT_TYPE_HEADER) ?: outputType
+                if (itemInputType == null || itemOutputType == null)
+                    throw ResponseStatusException(
+                        HttpStatus.BAD_REQUEST, "Input and output types are required for part ${it.name()}."
+                    )
+                Triple(it, itemInputType, itemOutputType)
+            }
+        val converted = items
+            .map { (part, itemInputType, itemOutputType) ->
+                async {
+                    permits.withPermit {
+                        part.name() to admitted<Any>({ e -> e }) {
+                            convertContent(part.content(), itemInputType, itemOutputType, imageResX, imageResY)
+                        }
+                    }
+                }
+            }
+            .awaitAll()
+        val body = MultipartBodyBuilder()
+        converted.forEach { (id, result) ->
+            if (result is ResponseStatusException)
+                body.part(id, result.reason ?: "", MediaType.TEXT_PLAIN)
+                    .header(ERROR_STATUS_HEADER, result.rawStatusCode.toString())
+            else
+                body.part(id, result, MediaType.APPLICATION_OCTET_STREAM)
+        }
+        body.build()
+    }
+
+    /**
+     * Base64 is decoded and encoded on the native thread too, so only
+     * admitted items ever hold their decoded bytes. The cache is keyed on
+     * the base64 text itself, digested without copying it.
+     */
+    private suspend fun convertOne(
         inputBase64: String,
         inputType: FileFormat,
         outputType: FileFormat,
         imageResX: Int = 0,
         imageResY: Int = 0
     ): String {
-        val input = inputBase64.decodeBase64()
-        val out = PointerByReference()
-        val outLength = IntByReference()
-        when {
-            inputType.isImage() && outputType.isMinutae() ->
-                converter.img2fmr(input, input.size, inputType.name, out, outLength)
+        val key = cache.key(inputBase64, inputType, outputType, imageResX, imageResY)
+        cache.get(key)?.let { return it.encodeBase64() }
+        return executor.run(inputBase64.length / 4L * 3) {
+            val input = inputBase64.decodeBase64()
+            val output = executor.session().convert(ByteBuffer.wrap(input), inputType, outputType, imageResX, imageResY)
+            cache.put(key, output)
+            output.encodeBase64()
+        }
+    }
 
-            inputType.isMinutae() && outputType.isMinutae() &&
-                    (outputType == FileFormat.ISOC || outputType == FileFormat.ISOCC) ->
-                converter.fmr2fmr_iso_card(
-                    input, input.size, out, outLength,
-                    inputType.name, outputType.name, imageResX, imageResY
-                )
+    /**
+     * Joins the body into one buffer and converts it in place. Netty's pooled
+     * buffers are direct, so a single-chunk body is never copied on the heap.
+     */
+    private suspend fun convertContent(
+        content: Flux<DataBuffer>,
+        inputType: FileFormat,
+        outputType: FileFormat,
+        imageResX: Int,
+        imageResY: Int
+    ): ByteArray {
+        val buffer = DataBufferUtils.join(content).awaitSingle()
+        try {
+            val key = cache.key(buffer.asByteBuffer(), inputType, outputType, imageResX, imageResY)
+            cache.get(key)?.let { return it }
+            return executor.run(buffer.readableByteCount().toLong()) {
+                executor.session().convert(buffer.asByteBuffer(), inputType, outputType, imageResX, imageResY)
+                    .also { cache.put(key, it) }
+            }
+        } finally {
+            DataBufferUtils.release(buffer)
+        }
+    }
 
-            inputType.isMinutae() && outputType.isMinutae() ->
-                converter.fmr2fmr(input, input.size, out, outLength, inputType.name, outputType.name)
+    /**
+     * Runs one batch item. When the executor turns it away with 429 or 503,
+     * the item's result comes from [rejected] instead, so one busy moment
+     * does not cancel the items around it.
+     */
+    private suspend fun <T> admitted(rejected: (ResponseStatusException) -> T, block: suspend () -> T): T =
+        try {
+            block()
+        } catch (e: ResponseStatusException) {
+            if (e.status != HttpStatus.TOO_MANY_REQUESTS && e.status != HttpStatus.SERVICE_UNAVAILABLE)
+                throw e
+            rejected(e)
+        }
 
-            else -> throw IllegalStateException("Conversion is not supported.")
+    private fun partType(part: Part, header: String): FileFormat? =
+        part.headers().getFirst(header)?.let {
+            try {
+                FileFormat.valueOf(it)
+            } catch (e: IllegalArgumentException) {
+                throw ResponseStatusException(HttpStatus.BAD_REQUEST, "Unknown $header $it for part ${part.name()}.")
+            }
         }
 
-        return out.value.getByteArray(0, outLength.value).encodeBase64()
+    companion object {
+        private const val INPUT_TYPE_HEADER = "X-Input-Type"
+        private const val OUTPUT_TYPE_HEADER = "X-Output-Type"
+        private const val ERROR_STATUS_HEADER = "X-Error-Status"
     }
 
-}
\ No newline at end of file
+}
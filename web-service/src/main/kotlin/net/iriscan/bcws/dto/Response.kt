@@ -1,9 +1,24 @@
 package net.iriscan.bcws.dto
 
+import com.fasterxml.jackson.annotation.JsonInclude
+
 /**
  * @author Slava Gornostal
  */
 data class Response(val output: String)
-data class BatchResponse(val id: String, val output: String)
+
+/**
+ * One item of a batch: the output, or why this item was not admitted.
+ */
+@JsonInclude(JsonInclude.Include.NON_NULL)
+data class BatchResponse(val id: String, val output: String? = null, val error: String? = null)
 
 data class BatchResponseList(val data: List<BatchResponse>)
+
+/**
+ * One line of a streamed batch: the output, or the error for this item only.
+ */
+@JsonInclude(JsonInclude.Include.NON_NULL)
+data class BatchStreamResponse(val id: String, val output: String? = null, val error: String? = null)
+
+data class CacheStats(val hits: Long, val misses: Long, val entries: Int, val capacity: Int)
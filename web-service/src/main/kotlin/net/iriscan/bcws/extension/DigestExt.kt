@@ -0,0 +1,38 @@
+package net.iriscan.bcws.extension
+
+import java.nio.ByteBuffer
+import java.security.MessageDigest
+
+private const val CHUNK = 4096
+
+/**
+ * SHA-256 of the remaining bytes. Direct buffers are digested in small
+ * chunks rather than copied whole. The position is left unchanged.
+ */
+fun ByteBuffer.sha256(): ByteArray {
+    val digest = MessageDigest.getInstance("SHA-256")
+    digest.update(duplicate())
+    return digest.digest()
+}
+
+/**
+ * SHA-256 of the ISO-8859-1 bytes of the string, the same digest as
+ * `toByteArray(ISO_8859_1).sha256()` without encoding the whole string.
+ * Meant for base64 text, where every char fits in a byte.
+ */
+fun String.sha256Latin1(): ByteArray {
+    val digest = MessageDigest.getInstance("SHA-256")
+    val chunk = ByteArray(minOf(length, CHUNK))
+    var i = 0
+    while (i < length) {
+        val n = minOf(length - i, CHUNK)
+        for (j in 0 until n) {
+            // Unmappable chars become '?', as the encoder would make them.
+            val c = this[i + j].code
+            chunk[j] = (if (c <= 0xff) c else '?'.code).toByte()
+        }
+        digest.update(chunk, 0, n)
+        i += n
+    }
+    return digest.digest()
+}
@@ -1,38 +1,57 @@
 package net.iriscan.bcws.lib
 
-import com.sun.jna.Library
-import com.sun.jna.ptr.IntByReference
-import com.sun.jna.ptr.PointerByReference
+import com.sun.jna.Native
+import com.sun.jna.NativeLibrary
+import com.sun.jna.Pointer
+import java.nio.ByteBuffer
 
 /**
+ * Direct-mapped bindings to the converter library's context API. Results are
+ * written into caller buffers, so no native memory is handed to the JVM and
+ * nothing has to be freed per call.
+ *
  * @author Slava Gornostal
  */
-interface Converter : Library {
-    fun img2fmr(
-        input: ByteArray,
-        inputLength: Int,
-        outputType: String,
-        output: PointerByReference,
-        outputLength: IntByReference
-    ): Int
+object Converter {
+    const val BC_OK = 0
+    const val BC_ERR_BUFFER_TOO_SMALL = -8
+
+    init {
+        NativeLibrary.addSearchPath("converter", "/usr/local/lib")
+        Native.register(Converter::class.java, "converter")
+    }
 
-    fun fmr2fmr(
-        input: ByteArray,
+    @JvmStatic
+    external fun bc_context_create(): Pointer?
+
+    @JvmStatic
+    external fun bc_context_destroy(ctx: Pointer)
+
+    @JvmStatic
+    external fun bc_img2fmr_into(
+        ctx: Pointer,
+        input: ByteBuffer,
         inputLength: Int,
-        output: PointerByReference,
-        outputLength: IntByReference,
-        inputType: String,
         outputType: String,
+        output: ByteBuffer,
+        outputSize: Int,
+        outputLength: IntArray
     ): Int
 
-    fun fmr2fmr_iso_card(
-        input: ByteArray,
+    @JvmStatic
+    external fun bc_fmr2fmr_into(
+        ctx: Pointer,
+        input: ByteBuffer,
         inputLength: Int,
-        output: PointerByReference,
-        outputLength: IntByReference,
         inputType: String,
         outputType: String,
         imageResX: Int,
         imageResY: Int,
+        output: ByteBuffer,
+        outputSize: Int,
+        outputLength: IntArray
     ): Int
+
+    @JvmStatic
+    external fun bc_result_copy(ctx: Pointer, output: ByteBuffer, outputSize: Int, outputLength: IntArray): Int
 }
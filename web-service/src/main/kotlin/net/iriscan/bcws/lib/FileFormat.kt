@@ -9,6 +9,7 @@ enum class FileFormat {
 
     fun isMinutae(): Boolean = arrayOf(ISO, ISOC, ISOCC, ANSI).contains(this)
     fun isImage(): Boolean = !isMinutae()
+    fun isCard(): Boolean = this == ISOC || this == ISOCC
 
 
 }
\ No newline at end of file
@@ -0,0 +1,90 @@
+package net.iriscan.bcws.lib
+
+import kotlinx.coroutines.asCoroutineDispatcher
+import kotlinx.coroutines.withContext
+import org.springframework.beans.factory.DisposableBean
+import org.springframework.beans.factory.annotation.Value
+import org.springframework.http.HttpStatus
+import org.springframework.stereotype.Component
+import org.springframework.web.server.ResponseStatusException
+import java.util.concurrent.ConcurrentLinkedQueue
+import java.util.concurrent.Executors
+import java.util.concurrent.TimeUnit
+import java.util.concurrent.atomic.AtomicInteger
+import java.util.concurrent.atomic.AtomicLong
+
+/**
+ * Runs blocking native conversions on a fixed pool sized to the core count,
+ * away from the WebFlux event loop. Work is admitted only while the number
+ * of pending conversions and the bytes they hold stay under their limits;
+ * beyond that callers get 429 (queue full) or 503 (memory budget spent)
+ * right away instead of queueing without bound. Each native thread keeps its
+ * own [NativeSession] for its lifetime.
+ */
+@Component
+class NativeExecutor(
+    @Value("\${converter.executor.threads:0}") threads: Int,
+    @Value("\${converter.executor.queue-capacity:0}") queueCapacity: Int,
+    @Value("\${converter.executor.max-in-flight-bytes:536870912}") private val maxInFlightBytes: Long
+) : DisposableBean {
+
+    val threads: Int = if (threads > 0) threads else Runtime.getRuntime().availableProcessors()
+
+    private val capacity = this.threads + if (queueCapacity > 0) queueCapacity else 4 * this.threads
+    private val threadCount = AtomicInteger()
+    private val executor = Executors.newFixedThreadPool(this.threads) { task ->
+        Thread(task, "$THREAD_PREFIX${threadCount.incrementAndGet()}").apply { isDaemon = true }
+    }
+    private val dispatcher = executor.asCoroutineDispatcher()
+    private val pending = AtomicInteger()
+    private val inFlightBytes = AtomicLong()
+    private val sessions = ConcurrentLinkedQueue<NativeSession>()
+    private val session = ThreadLocal.withInitial { NativeSession().also(sessions::add) }
+
+    /**
+     * Runs [block] on a native thread, counting [bytes] against the
+     * in-flight budget until it finishes.
+     */
+    suspend fun <T> run(bytes: Long, block: () -> T): T {
+        admit(bytes)
+        try {
+            return withContext(dispatcher) { block() }
+        } finally {
+            pending.decrementAndGet()
+            inFlightBytes.addAndGet(-bytes)
+        }
+    }
+
+    /**
+     * Session of the calling native thread; only valid inside [run].
+     */
+    fun session(): NativeSession {
+        check(Thread.currentThread().name.startsWith(THREAD_PREFIX)) { "Not on a native converter thread." }
+        return session.get()
+    }
+
+    private fun admit(bytes: Long) {
+        if (pending.incrementAndGet() > capacity) {
+            pending.decrementAndGet()
+            throw ResponseStatusException(HttpStatus.TOO_MANY_REQUESTS, "Converter queue is full.")
+        }
+        val before = inFlightBytes.getAndAdd(bytes)
+        // An input larger than the whole budget may still run on its own.
+        if (before > 0 && before + bytes > maxInFlightBytes) {
+            inFlightBytes.addAndGet(-bytes)
+            pending.decrementAndGet()
+            throw ResponseStatusException(HttpStatus.SERVICE_UNAVAILABLE, "Converter memory budget is spent.")
+        }
+    }
+
+    override fun destroy() {
+        dispatcher.close()
+        if (executor.awaitTermination(SHUTDOWN_TIMEOUT_SECONDS, TimeUnit.SECONDS))
+            sessions.forEach(NativeSession::close)
+    }
+
+    companion object {
+        private const val THREAD_PREFIX = "native-convert-"
+        private const val SHUTDOWN_TIMEOUT_SECONDS = 10L
+    }
+}
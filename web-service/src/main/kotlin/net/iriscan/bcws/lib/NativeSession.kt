@@ -0,0 +1,85 @@
+package net.iriscan.bcws.lib
+
+import com.sun.jna.Pointer
+import java.io.Closeable
+import java.nio.ByteBuffer
+
+/**
+ * Native state of one converter thread: a library context and direct
+ * buffers that are reused across calls and only ever grow.
+ */
+class NativeSession : Closeable {
+
+    private val context: Pointer = Converter.bc_context_create()
+        ?: throw OutOfMemoryError("Could not create converter context.")
+    private var input: ByteBuffer = ByteBuffer.allocateDirect(INITIAL_INPUT_SIZE)
+    private var output: ByteBuffer = ByteBuffer.allocateDirect(INITIAL_OUTPUT_SIZE)
+    private val outputLength = IntArray(1)
+
+    /**
+     * Converts the remaining bytes of [data]. Direct buffers are passed to
+     * native code as they are; heap buffers are first copied into the
+     * session's input buffer.
+     */
+    fun convert(
+        data: ByteBuffer,
+        inputType: FileFormat,
+        outputType: FileFormat,
+        imageResX: Int,
+        imageResY: Int
+    ): ByteArray {
+        val length = data.remaining()
+        val source = if (data.isDirect) data.slice() else stage(data)
+        var status = when {
+            inputType.isImage() && outputType.isMinutae() ->
+                Converter.bc_img2fmr_into(
+                    context, source, length, outputType.name,
+                    output, output.capacity(), outputLength
+                )
+
+            inputType.isMinutae() && outputType.isMinutae() ->
+                Converter.bc_fmr2fmr_into(
+                    context, source, length, inputType.name, outputType.name,
+                    if (outputType.isCard()) imageResX else 0, if (outputType.isCard()) imageResY else 0,
+                    output, output.capacity(), outputLength
+                )
+
+            else -> throw IllegalStateException("Conversion is not supported.")
+        }
+        if (status == Converter.BC_ERR_BUFFER_TOO_SMALL) {
+            // The record is kept in the context; fetch it without converting again.
+            output = ByteBuffer.allocateDirect(grow(output.capacity(), outputLength[0]))
+            status = Converter.bc_result_copy(context, output, output.capacity(), outputLength)
+        }
+        check(status == Converter.BC_OK) { "Conversion failed with status $status." }
+
+        val result = ByteArray(outputLength[0])
+        output.duplicate().get(result)
+        return result
+    }
+
+    private fun stage(data: ByteBuffer): ByteBuffer {
+        if (input.capacity() < data.remaining())
+            input = ByteBuffer.allocateDirect(grow(input.capacity(), data.remaining()))
+        input.clear()
+        input.put(data.duplicate())
+        input.flip()
+        return input
+    }
+
+    override fun close() {
+        Converter.bc_context_destroy(context)
+    }
+
+    companion object {
+        private const val INITIAL_INPUT_SIZE = 1 shl 20
+        private const val INITIAL_OUTPUT_SIZE = 4 shl 10
+
+        private fun grow(current: Int, needed: Int): Int {
+            var size = current
+            while (size < needed)
+                size *= 2
+            return size
+        }
+    }
+}
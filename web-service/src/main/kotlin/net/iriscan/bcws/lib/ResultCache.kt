@@ -0,0 +1,121 @@
+package net.iriscan.bcws.lib
+
+import kotlinx.coroutines.asCoroutineDispatcher
+import kotlinx.coroutines.withContext
+import net.iriscan.bcws.dto.CacheStats
+import net.iriscan.bcws.extension.sha256
+import net.iriscan.bcws.extension.sha256Latin1
+import org.springframework.beans.factory.DisposableBean
+import org.springframework.beans.factory.annotation.Value
+import org.springframework.stereotype.Component
+import java.nio.ByteBuffer
+import java.util.concurrent.Executors
+import java.util.concurrent.atomic.AtomicInteger
+
+/**
+ * Bounded LRU of converted records, keyed by a SHA-256 digest of the request
+ * input and the conversion parameters. Unlike a fast non-cryptographic hash,
+ * the digest cannot be made to collide, so a crafted input never gets
+ * another request's record. It sits in front of [NativeExecutor], so a hit
+ * is answered without admission, decoding or extraction. Digests are
+ * computed on a small fixed pool of their own, never on the event loop, and
+ * not counted against the converter's admission limits. Disabled when
+ * `converter.cache.entries` is 0.
+ */
+@Component
+class ResultCache(
+    @Value("\${converter.cache.entries:0}") private val capacity: Int,
+    @Value("\${converter.cache.digest-threads:0}") digestThreads: Int
+) : DisposableBean {
+
+    data class Key(
+        val digest0: Long,
+        val digest1: Long,
+        val digest2: Long,
+        val digest3: Long,
+        val length: Int,
+        val base64: Boolean,
+        val inputType: FileFormat,
+        val outputType: FileFormat,
+        val imageResX: Int,
+        val imageResY: Int
+    )
+
+    private val entries = object : LinkedHashMap<Key, ByteArray>(16, 0.75f, true) {
+        override fun removeEldestEntry(eldest: MutableMap.MutableEntry<Key, ByteArray>): Boolean = size > capacity
+    }
+    private var hits = 0L
+    private var misses = 0L
+
+    // Threads start on first use, so a disabled cache never creates any.
+    private val digestThreadCount = AtomicInteger()
+    private val digestExecutor = Executors.newFixedThreadPool(
+        if (digestThreads > 0) digestThreads else Runtime.getRuntime().availableProcessors()
+    ) { task ->
+        Thread(task, "$DIGEST_THREAD_PREFIX${digestThreadCount.incrementAndGet()}").apply { isDaemon = true }
+    }
+    private val digestDispatcher = digestExecutor.asCoroutineDispatcher()
+
+    /**
+     * Key for converting the remaining bytes of [input], or null when the
+     * cache is disabled.
+     */
+    suspend fun key(input: ByteBuffer, inputType: FileFormat, outputType: FileFormat, imageResX: Int, imageResY: Int): Key? =
+        if (capacity <= 0) null
+        else withContext(digestDispatcher) {
+            key(input.sha256(), input.remaining(), false, inputType, outputType, imageResX, imageResY)
+        }
+
+    /**
+     * Key for converting base64 text, digested as is, or null when the cache
+     * is disabled.
+     */
+    suspend fun key(inputBase64: String, inputType: FileFormat, outputType: FileFormat, imageResX: Int, imageResY: Int): Key? =
+        if (capacity <= 0) null
+        else withContext(digestDispatcher) {
+            key(inputBase64.sha256Latin1(), inputBase64.length, true, inputType, outputType, imageResX, imageResY)
+        }
+
+    private fun key(
+        digest: ByteArray,
+        length: Int,
+        base64: Boolean,
+        inputType: FileFormat,
+        outputType: FileFormat,
+        imageResX: Int,
+        imageResY: Int
+    ): Key {
+        val d = ByteBuffer.wrap(digest)
+        // The resolution only reaches the converter for card output.
+        return if (outputType.isCard())
+            Key(d.long, d.long, d.long, d.long, length, base64, inputType, outputType, imageResX, imageResY)
+        else
+            Key(d.long, d.long, d.long, d.long, length, base64, inputType, outputType, 0, 0)
+    }
+
+    fun get(key: Key?): ByteArray? {
+        if (key == null)
+            return null
+        synchronized(entries) {
+            val output = entries[key]
+            if (output != null) hits++ else misses++
+            return output
+        }
+    }
+
+    fun put(key: Key?, output: ByteArray) {
+        if (key == null)
+            return
+        synchronized(entries) { entries[key] = output }
+    }
+
+    fun stats(): CacheStats = synchronized(entries) { CacheStats(hits, misses, entries.size, capacity) }
+
+    override fun destroy() {
+        digestDispatcher.close()
+    }
+
+    companion object {
+        private const val DIGEST_THREAD_PREFIX = "cache-digest-"
+    }
+}